@@ -0,0 +1,296 @@
+/**
+ * File: EsWriter.cpp
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: Implementation of EsWriter/EsSink batched ES output
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "EsWriter.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#define ES_DIRECT_ALIGN     4096
+#define ES_MAX_IOV          1024
+
+static uint64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+EsSink::EsSink(const string& path, const EsWriterConfig& config, EsWriterStats& stats)
+    : mPath(path),
+      mConfig(config),
+      mStats(stats),
+      mFd(-1),
+      mDirect(false),
+      mBuffer(nullptr),
+      mBufferLen(0),
+      mPending(0),
+      mWritten(0) {
+}
+
+EsSink::~EsSink() {
+    close();
+}
+
+int EsSink::open(bool keep) {
+    int flags = O_WRONLY | O_CREAT | (keep ? 0 : O_TRUNC);
+    if (mConfig.directIo) {
+        mFd = ::open(mPath.c_str(), flags | O_DIRECT, 0644);
+        if (mFd >= 0) {
+            mDirect = true;
+        } else {
+            std::cerr << "O_DIRECT not supported for " << mPath << ", using buffered writes" << std::endl;
+        }
+    }
+    if (mFd < 0) {
+        mFd = ::open(mPath.c_str(), flags, 0644);
+    }
+    if (mFd < 0) {
+        return -1;
+    }
+    if (mConfig.preallocate > 0) {
+        // Best effort, not every filesystem supports it
+        fallocate(mFd, FALLOC_FL_KEEP_SIZE, 0, mConfig.preallocate);
+    }
+    size_t size = (mConfig.bufferSize + ES_DIRECT_ALIGN - 1) / ES_DIRECT_ALIGN * ES_DIRECT_ALIGN;
+    if (size == 0) {
+        size = ES_DIRECT_ALIGN;
+    }
+    if (posix_memalign((void**)&mBuffer, ES_DIRECT_ALIGN, size) != 0) {
+        mBuffer = nullptr;
+        ::close(mFd);
+        mFd = -1;
+        return -1;
+    }
+    mIov.reserve(ES_MAX_IOV);
+    return 0;
+}
+
+void EsSink::append(const uint8_t* data, size_t len, bool stable) {
+    if (mFd < 0 || len == 0) {
+        return;
+    }
+    size_t capacity = (mConfig.bufferSize + ES_DIRECT_ALIGN - 1) / ES_DIRECT_ALIGN * ES_DIRECT_ALIGN;
+    if (stable && !mDirect) {
+        struct iovec* last = mIov.empty() ? nullptr : &mIov.back();
+        if (last && (const uint8_t*)last->iov_base + last->iov_len == data) {
+            last->iov_len += len;
+        } else {
+            mIov.push_back({(void*)data, len});
+        }
+        mPending += len;
+    } else {
+        while (len > 0) {
+            if (mBufferLen == capacity) {
+                mDirect ? flushDirect(false) : flush();
+            }
+            size_t n = std::min(len, capacity - mBufferLen);
+            uint8_t* dst = mBuffer + mBufferLen;
+            memcpy(dst, data, n);
+            if (!mDirect) {
+                struct iovec* last = mIov.empty() ? nullptr : &mIov.back();
+                if (last && (uint8_t*)last->iov_base + last->iov_len == dst) {
+                    last->iov_len += n;
+                } else {
+                    mIov.push_back({dst, n});
+                }
+            }
+            mBufferLen += n;
+            mPending += n;
+            data += n;
+            len -= n;
+        }
+    }
+    if (mIov.size() >= ES_MAX_IOV || mPending >= capacity) {
+        mDirect ? flushDirect(false) : flush();
+    }
+}
+
+int EsSink::writeIov(struct iovec* iov, int count) {
+    int i = 0;
+    while (i < count) {
+        int batch = std::min(count - i, IOV_MAX);
+        ssize_t n = writev(mFd, iov + i, batch);
+        mStats.syscallCount++;
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Write error on " << mPath << ": " << strerror(errno) << std::endl;
+            return -1;
+        }
+        mStats.bytesWritten += n;
+        mWritten += n;
+        // Skip what went out, trim a partially written entry
+        while (i < count && (size_t)n >= iov[i].iov_len) {
+            n -= iov[i].iov_len;
+            i++;
+        }
+        if (i < count && n > 0) {
+            iov[i].iov_base = (uint8_t*)iov[i].iov_base + n;
+            iov[i].iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+int EsSink::flush() {
+    if (mFd < 0) {
+        return -1;
+    }
+    if (mDirect) {
+        return flushDirect(false);
+    }
+    if (mIov.empty()) {
+        return 0;
+    }
+    uint64_t start = nowNs();
+    int ret = writeIov(mIov.data(), mIov.size());
+    uint64_t elapsed = nowNs() - start;
+    mStats.flushCount++;
+    mStats.flushNsTotal += elapsed;
+    mStats.flushNsMax = std::max(mStats.flushNsMax, elapsed);
+    mIov.clear();
+    mBufferLen = 0;
+    mPending = 0;
+    return ret;
+}
+
+// O_DIRECT needs aligned buffers and lengths: write the aligned part and
+// keep the tail, unless this is the last write
+int EsSink::flushDirect(bool final) {
+    size_t len = final ? mBufferLen : mBufferLen / ES_DIRECT_ALIGN * ES_DIRECT_ALIGN;
+    if (len == 0) {
+        return 0;
+    }
+    if (final) {
+        // The tail is not a multiple of the block size
+        int flags = fcntl(mFd, F_GETFL);
+        fcntl(mFd, F_SETFL, flags & ~O_DIRECT);
+    }
+    uint64_t start = nowNs();
+    struct iovec iov = {mBuffer, len};
+    int ret = writeIov(&iov, 1);
+    uint64_t elapsed = nowNs() - start;
+    mStats.flushCount++;
+    mStats.flushNsTotal += elapsed;
+    mStats.flushNsMax = std::max(mStats.flushNsMax, elapsed);
+    memmove(mBuffer, mBuffer + len, mBufferLen - len);
+    mBufferLen -= len;
+    mPending -= len;
+    return ret;
+}
+
+int EsSink::close() {
+    if (mFd < 0) {
+        return 0;
+    }
+    int ret = mDirect ? flushDirect(true) : flush();
+    if (mConfig.preallocate > 0) {
+        // Give back preallocated blocks past the real end
+        if (ftruncate(mFd, mWritten) != 0) {
+            ret = -1;
+        }
+    }
+    ::close(mFd);
+    mFd = -1;
+    free(mBuffer);
+    mBuffer = nullptr;
+    return ret;
+}
+
+int EsSink::checkpoint(vector<uint8_t>& tail) {
+    if (mFd < 0) {
+        return -1;
+    }
+    int ret = flush();
+    if (fdatasync(mFd) != 0) {
+        ret = -1;
+    }
+    // Only O_DIRECT keeps bytes back after a flush
+    tail.assign(mBuffer, mBuffer + mBufferLen);
+    return ret;
+}
+
+int EsSink::resume(uint64_t length, const vector<uint8_t>& tail) {
+    struct stat st;
+    if (mFd < 0 || fstat(mFd, &st) != 0 || (uint64_t)st.st_size < length) {
+        std::cerr << mPath << " is shorter than at the checkpoint" << std::endl;
+        return -1;
+    }
+    // What the interrupted run wrote past the checkpoint is written again
+    if (ftruncate(mFd, length) != 0 || lseek(mFd, length, SEEK_SET) < 0) {
+        std::cerr << "Cannot resume " << mPath << ": " << strerror(errno) << std::endl;
+        return -1;
+    }
+    mWritten = length;
+    append(tail.data(), tail.size(), false);
+    return 0;
+}
+
+EsWriter::EsWriter() {
+}
+
+EsWriter::~EsWriter() {
+    closeAll();
+}
+
+EsSink* EsWriter::open(const string& path) {
+    EsSink* sink = new EsSink(path, mConfig, mStats);
+    if (sink->open() != 0) {
+        std::cerr << "Cannot open output file: " << path << std::endl;
+        delete sink;
+        return nullptr;
+    }
+    mSinks.push_back(sink);
+    return sink;
+}
+
+EsSink* EsWriter::resume(const string& path, uint64_t length, const vector<uint8_t>& tail) {
+    EsSink* sink = new EsSink(path, mConfig, mStats);
+    if (sink->open(true) != 0 || sink->resume(length, tail) != 0) {
+        std::cerr << "Cannot resume output file: " << path << std::endl;
+        delete sink;
+        return nullptr;
+    }
+    mSinks.push_back(sink);
+    return sink;
+}
+
+void EsWriter::flushAll() {
+    for (auto sink : mSinks) {
+        sink->flush();
+    }
+}
+
+void EsWriter::closeAll() {
+    for (auto sink : mSinks) {
+        delete sink;
+    }
+    mSinks.clear();
+}
+
+void EsWriter::printStats(std::ostream& os) const {
+    uint64_t avg = mStats.flushCount ? mStats.flushNsTotal / mStats.flushCount : 0;
+    os << "ES output: " << mStats.bytesWritten << " bytes in " << mStats.flushCount
+       << " flushes (" << mStats.syscallCount << " write calls), flush latency avg "
+       << avg / 1000 << " us, max " << mStats.flushNsMax / 1000 << " us" << std::endl;
+}
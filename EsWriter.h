@@ -0,0 +1,100 @@
+/**
+ * File: EsWriter.h
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: EsWriter class definition, buffered ES output for -o
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _ES_WRITER_H_
+#define _ES_WRITER_H_
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+using namespace std;
+
+struct EsWriterStats {
+    uint64_t bytesWritten = 0;
+    uint64_t flushCount = 0;
+    uint64_t syscallCount = 0;
+    uint64_t flushNsTotal = 0;
+    uint64_t flushNsMax = 0;
+};
+
+struct EsWriterConfig {
+    size_t bufferSize = 4 << 20;  // per output file
+    uint64_t preallocate = 0;     // fallocate() this many bytes up front
+    bool directIo = false;        // O_DIRECT with aligned flushes
+};
+
+/*
+ * One output file. Appended fragments are gathered into an iovec list:
+ * fragments whose memory stays valid until the next flush (e.g. pointers
+ * into an mmap'ed input) are referenced in place, everything else is
+ * copied into the sink buffer. The list goes out with writev() when the
+ * buffer fills, the iovec list is full or the sink is flushed.
+ */
+class EsSink {
+    public:
+        EsSink(const string& path, const EsWriterConfig& config, EsWriterStats& stats);
+        ~EsSink();
+        // keep: open the existing file as it is, for resume()
+        int open(bool keep = false);
+        void append(const uint8_t* data, size_t len, bool stable);
+        int flush();
+        int close();
+        // Flushes and syncs: length() bytes are on disk, but with O_DIRECT
+        // the unaligned tail, which is returned in 'tail' instead
+        int checkpoint(vector<uint8_t>& tail);
+        // Continues a file from a checkpoint: cut back to 'length', then 'tail'
+        int resume(uint64_t length, const vector<uint8_t>& tail);
+        const string& path() const { return mPath; }
+        uint64_t length() const { return mWritten + mPending; }
+    private:
+        int writeIov(struct iovec* iov, int count);
+        int flushDirect(bool final);
+        string mPath;
+        const EsWriterConfig& mConfig;
+        EsWriterStats& mStats;
+        int mFd;
+        bool mDirect;
+        uint8_t* mBuffer;
+        size_t mBufferLen;
+        vector<struct iovec> mIov;
+        uint64_t mPending;  // bytes queued, not yet written
+        uint64_t mWritten;  // bytes already in the file
+};
+
+class EsWriter {
+    public:
+        EsWriter();
+        ~EsWriter();
+        EsWriterConfig& config() { return mConfig; }
+        // Returns nullptr (and reports on stderr) if the file cannot be created
+        EsSink* open(const string& path);
+        // Reopens an output left by an interrupted run, see EsSink::resume()
+        EsSink* resume(const string& path, uint64_t length, const vector<uint8_t>& tail);
+        void flushAll();
+        void closeAll();
+        const EsWriterStats& stats() const { return mStats; }
+        void printStats(std::ostream& os) const;
+    private:
+        EsWriterConfig mConfig;
+        EsWriterStats mStats;
+        vector<EsSink*> mSinks;
+};
+
+#endif /* _ES_WRITER_H_ */
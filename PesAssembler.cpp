@@ -0,0 +1,282 @@
+/**
+ * File: PesAssembler.cpp
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: Implementation of PesAssembler per-PID PES reassembly
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "PesAssembler.h"
+#include <cstring>
+#include <algorithm>
+
+static uint64_t readTimestamp(const uint8_t* p) {
+    return ((uint64_t)(p[0] & 0x0e) << 29)
+         | ((uint64_t)p[1] << 22)
+         | ((uint64_t)(p[2] & 0xfe) << 14)
+         | ((uint64_t)p[3] << 7)
+         | (p[4] >> 1);
+}
+
+PesAssembler::PesAssembler(PesListener* listener)
+    : mListener(listener),
+      mDropCorrupt(false),
+      mStreams(8192, nullptr),
+      mCcErrors(0),
+      mUnits(0) {
+}
+
+PesAssembler::~PesAssembler() {
+    for (auto s : mStreams) {
+        delete s;
+    }
+}
+
+PesStream& PesAssembler::stream(int pid) {
+    if (!mStreams[pid]) {
+        mStreams[pid] = new PesStream();
+    }
+    return *mStreams[pid];
+}
+
+void PesAssembler::reset() {
+    for (auto& s : mStreams) {
+        delete s;
+        s = nullptr;
+    }
+    mCcErrors = 0;
+    mUnits = 0;
+}
+
+void PesAssembler::startUnit(PesStream& s, uint64_t offset) {
+    s.active = true;
+    s.headerDone = false;
+    s.flags = 0;
+    s.offset = offset;
+    s.headerLength = 0;
+    s.headerNeed = 6;
+    s.bounded = false;
+    s.remaining = 0;
+    s.hasPts = false;
+    s.hasDts = false;
+    s.owned.clear();
+    s.spans.clear();
+    s.payloadLength = 0;
+}
+
+void PesAssembler::push(int pid, const uint8_t* payload, int len, int cc, bool unitStart, uint64_t offset) {
+    PesStream& s = stream(pid);
+    bool gap = false;
+    if (s.lastCc >= 0) {
+        if (cc == s.lastCc) {
+            // Duplicate packet, the payload was already taken
+            return;
+        }
+        if (cc != ((s.lastCc + 1) & 0x0F)) {
+            gap = true;
+            mCcErrors++;
+        }
+    }
+    s.lastCc = cc;
+    if (unitStart) {
+        if (s.active) {
+            // Whatever was lost belonged to the unit still open
+            if (gap) {
+                s.flags |= PES_FLAG_CC_ERROR;
+            }
+            deliver(pid, s);
+        }
+        startUnit(s, offset);
+    } else {
+        if (!s.active) {
+            // No unit start seen yet, or the unit was dropped
+            return;
+        }
+        if (gap) {
+            s.flags |= PES_FLAG_CC_ERROR;
+            if (mDropCorrupt) {
+                deliver(pid, s);
+                return;
+            }
+        }
+    }
+    append(pid, s, payload, len);
+}
+
+void PesAssembler::handOver(int pid, int cc, PesStream& next) {
+    PesStream& s = stream(pid);
+    if (s.lastCc >= 0 && cc != s.lastCc && cc != ((s.lastCc + 1) & 0x0F)) {
+        s.flags |= PES_FLAG_CC_ERROR;
+        mCcErrors++;
+    }
+    if (s.active) {
+        deliver(pid, s);
+    }
+    s = std::move(next);
+}
+
+bool PesAssembler::parseHeader(int pid, PesStream& s) {
+    const uint8_t* h = s.header;
+    if (s.headerLength == 6) {
+        if (h[0] != 0x00 || h[1] != 0x00 || h[2] != 0x01) {
+            return false;
+        }
+        s.streamId = h[3];
+        int pes_packet_length = (h[4] << 8) | h[5];
+        s.bounded = pes_packet_length != 0;
+        s.remaining = pes_packet_length;
+        if (hasOptionalHeader(s.streamId)) {
+            s.headerNeed = 9;
+            return true;
+        }
+    } else if (s.headerLength == 9) {
+        s.headerNeed = 9 + h[8];
+        if (s.headerNeed > s.headerLength) {
+            return true;
+        }
+    }
+    if (s.headerNeed > 6) {
+        int pts_dts_flag = (h[7] >> 6) & 0x03;
+        if (pts_dts_flag & 0x02 && s.headerNeed >= 14) {
+            s.hasPts = true;
+            s.pts = readTimestamp(h + 9);
+        }
+        if (pts_dts_flag == 0x03 && s.headerNeed >= 19) {
+            s.hasDts = true;
+            s.dts = readTimestamp(h + 14);
+        }
+    }
+    if (s.bounded) {
+        // PES_packet_length counts the bytes after the length field
+        if (s.remaining < (size_t)(s.headerNeed - 6)) {
+            return false;
+        }
+        s.remaining -= s.headerNeed - 6;
+    }
+    s.headerDone = true;
+    PesUnit unit;
+    fillUnit(pid, s, unit);
+    mListener->onPesHeader(unit);
+    return true;
+}
+
+void PesAssembler::append(int pid, PesStream& s, const uint8_t* data, int len) {
+    while (!s.headerDone && len > 0) {
+        int n = std::min(len, s.headerNeed - s.headerLength);
+        memcpy(s.header + s.headerLength, data, n);
+        s.headerLength += n;
+        data += n;
+        len -= n;
+        if (s.headerLength == s.headerNeed && !parseHeader(pid, s)) {
+            s.flags |= PES_FLAG_BAD_HEADER;
+            deliver(pid, s);
+            return;
+        }
+    }
+    if (len <= 0) {
+        if (s.headerDone && s.bounded && s.remaining == 0) {
+            deliver(pid, s);
+        }
+        return;
+    }
+    if (s.bounded) {
+        // Anything past PES_packet_length is stuffing
+        len = std::min((size_t)len, s.remaining);
+        s.remaining -= len;
+    }
+    PesSpan* last = s.spans.empty() ? nullptr : &s.spans.back();
+    if (last && last->data + last->len == data) {
+        last->len += len;
+    } else {
+        s.spans.push_back({data, (size_t)len});
+    }
+    s.payloadLength += len;
+    if (s.bounded && s.remaining == 0) {
+        deliver(pid, s);
+    } else if (s.spans.size() >= PES_MAX_SPANS) {
+        // No end in sight: hand out what we have and keep going
+        deliver(pid, s);
+        s.active = true;
+        s.headerDone = true;
+        s.flags = PES_FLAG_CONTINUATION;
+        s.hasPts = false;
+        s.hasDts = false;
+        s.headerLength = 0;
+    }
+}
+
+void PesAssembler::fillUnit(int pid, const PesStream& s, PesUnit& unit) const {
+    unit.pid = pid;
+    unit.streamId = s.streamId;
+    unit.hasPts = s.hasPts;
+    unit.hasDts = s.hasDts;
+    unit.pts = s.pts;
+    unit.dts = s.dts;
+    unit.offset = s.offset;
+    unit.flags = s.flags;
+    unit.header = s.header;
+    unit.headerLength = s.headerLength;
+    unit.spans = nullptr;
+    unit.spanCount = 0;
+    unit.payloadLength = s.payloadLength;
+}
+
+void PesAssembler::deliver(int pid, PesStream& s) {
+    PesUnit unit;
+    if (!s.headerDone && !(s.flags & PES_FLAG_BAD_HEADER)) {
+        // Cut off inside the header: nothing usable
+        s.flags |= PES_FLAG_TRUNCATED;
+    } else if (s.bounded && s.remaining > 0) {
+        s.flags |= PES_FLAG_TRUNCATED;
+    }
+    bool drop = (s.flags & PES_FLAG_BAD_HEADER) || (mDropCorrupt && (s.flags & PES_FLAG_CC_ERROR));
+    fillUnit(pid, s, unit);
+    mDeliver.clear();
+    if (!drop) {
+        if (!s.owned.empty()) {
+            mDeliver.push_back({s.owned.data(), s.owned.size()});
+        }
+        mDeliver.insert(mDeliver.end(), s.spans.begin(), s.spans.end());
+    } else {
+        unit.payloadLength = 0;
+    }
+    unit.spans = mDeliver.data();
+    unit.spanCount = mDeliver.size();
+    mUnits++;
+    mListener->onPesUnit(unit);
+    s.active = false;
+    s.owned.clear();
+    s.spans.clear();
+    s.payloadLength = 0;
+}
+
+void PesAssembler::flushAll() {
+    for (int pid = 0; pid < (int)mStreams.size(); pid++) {
+        PesStream* s = mStreams[pid];
+        if (s && s->active) {
+            deliver(pid, *s);
+        }
+    }
+}
+
+void PesAssembler::detach() {
+    for (auto s : mStreams) {
+        if (!s || !s->active || s->spans.empty()) {
+            continue;
+        }
+        for (const auto& span : s->spans) {
+            s->owned.insert(s->owned.end(), span.data, span.data + span.len);
+        }
+        s->spans.clear();
+    }
+}
@@ -0,0 +1,138 @@
+/**
+ * File: PesAssembler.h
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: PesAssembler class definition, per-PID PES reassembly
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _PES_ASSEMBLER_H_
+#define _PES_ASSEMBLER_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+using namespace std;
+
+#define PES_MAX_HEADER          (9 + 255)
+#define PES_MAX_SPANS           65536 // deliver early past this, keeps broken streams bounded
+
+#define PES_FLAG_CC_ERROR       0x01 // continuity counter gap while the unit was open
+#define PES_FLAG_TRUNCATED      0x02 // ended before PES_packet_length bytes arrived
+#define PES_FLAG_BAD_HEADER     0x04 // no packet_start_code_prefix, payload dropped
+#define PES_FLAG_CONTINUATION   0x08 // rest of a unit that was delivered early
+
+// Streams whose PES packets carry no optional header (13818-1 table 2-21)
+inline bool hasOptionalHeader(uint8_t stream_id) {
+    return stream_id != 0xBC && stream_id != 0xBE && stream_id != 0xBF &&
+           stream_id != 0xF0 && stream_id != 0xF1 && stream_id != 0xFF &&
+           stream_id != 0xF2 && stream_id != 0xF8;
+}
+
+struct PesSpan {
+    const uint8_t* data;
+    size_t len;
+};
+
+// A complete PES packet. The payload (after the PES header) is a list of
+// spans pointing into the input, valid only during the callback.
+struct PesUnit {
+    int pid;
+    uint8_t streamId;
+    bool hasPts;
+    bool hasDts;
+    uint64_t pts;
+    uint64_t dts;
+    uint64_t offset;            // input offset of the packet carrying the header
+    uint32_t flags;
+    const uint8_t* header;      // PES header bytes
+    int headerLength;
+    const PesSpan* spans;
+    int spanCount;
+    size_t payloadLength;
+};
+
+// Per-PID assembly state. Copyable so a unit can be handed between parsers.
+struct PesStream {
+    bool active = false;        // a unit is open
+    bool headerDone = false;
+    int lastCc = -1;
+    uint32_t flags = 0;
+    uint64_t offset = 0;
+    uint8_t header[PES_MAX_HEADER];
+    int headerLength = 0;
+    int headerNeed = 6;
+    bool bounded = false;       // PES_packet_length != 0
+    size_t remaining = 0;       // payload bytes still expected when bounded
+    uint8_t streamId = 0;
+    bool hasPts = false;
+    bool hasDts = false;
+    uint64_t pts = 0;
+    uint64_t dts = 0;
+    vector<uint8_t> owned;      // payload copied out of a window that moved
+    vector<PesSpan> spans;      // payload still in the input, after 'owned'
+    size_t payloadLength = 0;
+};
+
+class PesListener {
+    public:
+        virtual ~PesListener() {}
+        // The header (and PTS/DTS) of a new unit is complete
+        virtual void onPesHeader(const PesUnit&) {}
+        // A unit is complete, or broken (see flags)
+        virtual void onPesUnit(const PesUnit& unit) = 0;
+};
+
+class PesAssembler {
+    public:
+        PesAssembler(PesListener* listener);
+        ~PesAssembler();
+        // Drop units with a continuity error instead of flagging them
+        void setDropCorrupt(bool drop) { mDropCorrupt = drop; }
+        // Payload of one TS packet (after the adaptation field)
+        void push(int pid, const uint8_t* payload, int len, int cc, bool unitStart, uint64_t offset);
+        // End of input: deliver whatever is still open
+        void flushAll();
+        // The input window is about to move: copy pending payload out of it
+        void detach();
+        // Hand over: 'next' continues this PID from a packet with unit start
+        // and continuity counter 'cc'; the open unit is closed as push() would
+        void handOver(int pid, int cc, PesStream& next);
+        // Forget all streams and counters
+        void reset();
+        PesStream* find(int pid) const { return mStreams[pid]; }
+        uint64_t ccErrors() const { return mCcErrors; }
+        void addCcErrors(uint64_t count) { mCcErrors += count; }
+        uint64_t units() const { return mUnits; }
+        // Checkpoint resume: a stream and the counters as they were saved
+        void restore(int pid, const PesStream& s) { stream(pid) = s; }
+        void restoreCounters(uint64_t ccErrors, uint64_t units) {
+            mCcErrors = ccErrors;
+            mUnits = units;
+        }
+    private:
+        PesStream& stream(int pid);
+        void startUnit(PesStream& s, uint64_t offset);
+        void append(int pid, PesStream& s, const uint8_t* data, int len);
+        bool parseHeader(int pid, PesStream& s);
+        void deliver(int pid, PesStream& s);
+        void fillUnit(int pid, const PesStream& s, PesUnit& unit) const;
+        PesListener* mListener;
+        bool mDropCorrupt;
+        vector<PesStream*> mStreams;
+        vector<PesSpan> mDeliver;
+        uint64_t mCcErrors;
+        uint64_t mUnits;
+};
+
+#endif /* _PES_ASSEMBLER_H_ */
@@ -0,0 +1,80 @@
+/**
+ * File: SectionPool.h
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: SectionPool, fixed-size PSI section buffers indexed by PID
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _SECTION_POOL_H_
+#define _SECTION_POOL_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+using namespace std;
+
+// A private section is at most 4096 bytes (section_length <= 4093), PSI 1024
+#define TS_SECTION_BUFFER_SIZE 4096
+
+struct SectionBuffer {
+    int length = 0;
+    int expected_length = 0;
+    int last_cc = -1;
+    bool collecting = false;
+    uint8_t data[TS_SECTION_BUFFER_SIZE];
+
+    // Bytes past the buffer can only follow the end of the section
+    void append(const uint8_t* bytes, int count) {
+        count = std::min(count, TS_SECTION_BUFFER_SIZE - length);
+        memcpy(data + length, bytes, count);
+        length += count;
+    }
+    void clear() {
+        length = 0;
+        expected_length = 0;
+        collecting = false;
+    }
+};
+
+/*
+ * One SectionBuffer per PID that carries sections, created the first time
+ * the PID table gives it a PSI role and kept from then on, so collecting a
+ * section never allocates and a packet finds its buffer without a lookup.
+ */
+class SectionPool {
+    public:
+        SectionPool() : mBuffers(8192) {}
+        SectionBuffer* get(int pid) {
+            if (!mBuffers[pid]) {
+                mBuffers[pid].reset(new SectionBuffer());
+            }
+            return mBuffers[pid].get();
+        }
+        // nullptr if the PID never had a buffer
+        SectionBuffer* find(int pid) const { return mBuffers[pid].get(); }
+        // Drop the partial sections of every PID (the input jumped)
+        void reset() {
+            for (auto& buffer : mBuffers) {
+                if (buffer) {
+                    buffer->clear();
+                }
+            }
+        }
+    private:
+        vector<unique_ptr<SectionBuffer>> mBuffers;
+};
+
+#endif /* _SECTION_POOL_H_ */
@@ -0,0 +1,108 @@
+/**
+ * File: SpscRing.h
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: SpscRing, lock-free single-producer/single-consumer ring
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _SPSC_RING_H_
+#define _SPSC_RING_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+using namespace std;
+
+/*
+ * Bounded ring between exactly one producer thread and one consumer thread.
+ * Each side only writes its own index; the other index is cached so the
+ * shared cache line is read only when the cached value says full/empty.
+ * push()/pop() block with a spin, yield, sleep backoff and return the time
+ * they waited, so a full ring slows the producer down (backpressure).
+ */
+template <typename T>
+class SpscRing {
+    public:
+        explicit SpscRing(size_t capacity) {
+            size_t size = 2;
+            while (size < capacity) {
+                size <<= 1;
+            }
+            mSlots.resize(size);
+            mMask = size - 1;
+        }
+        bool tryPush(const T& value) {
+            size_t tail = mTail.load(std::memory_order_relaxed);
+            if (tail - mHeadCache > mMask) {
+                mHeadCache = mHead.load(std::memory_order_acquire);
+                if (tail - mHeadCache > mMask) {
+                    return false;
+                }
+            }
+            mSlots[tail & mMask] = value;
+            mTail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+        bool tryPop(T& value) {
+            size_t head = mHead.load(std::memory_order_relaxed);
+            if (head == mTailCache) {
+                mTailCache = mTail.load(std::memory_order_acquire);
+                if (head == mTailCache) {
+                    return false;
+                }
+            }
+            value = mSlots[head & mMask];
+            mHead.store(head + 1, std::memory_order_release);
+            return true;
+        }
+        // Blocking variants, return the nanoseconds spent waiting
+        uint64_t push(const T& value) {
+            return wait([&]() { return tryPush(value); });
+        }
+        uint64_t pop(T& value) {
+            return wait([&]() { return tryPop(value); });
+        }
+        size_t capacity() const { return mMask + 1; }
+    private:
+        template <typename F>
+        static uint64_t wait(F attempt) {
+            if (attempt()) {
+                return 0;
+            }
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; !attempt(); i++) {
+                if (i < 64) {
+#if defined(__x86_64__) || defined(__i386__)
+                    __builtin_ia32_pause();
+#endif
+                } else if (i < 256) {
+                    std::this_thread::yield();
+                } else {
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+                }
+            }
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        }
+        vector<T> mSlots;
+        size_t mMask;
+        alignas(64) std::atomic<size_t> mHead{0}; // written by the consumer
+        size_t mTailCache = 0;                    // consumer's copy of mTail
+        alignas(64) std::atomic<size_t> mTail{0}; // written by the producer
+        size_t mHeadCache = 0;                    // producer's copy of mHead
+};
+
+#endif /* _SPSC_RING_H_ */
@@ -0,0 +1,403 @@
+/**
+ * File: TsBatch.cpp
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: Implementation of TsBatch
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "TsBatch.h"
+#include "TsParser.h"
+#include "WorkStealingPool.h"
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+
+static const char* sExtensions[] = {".ts", ".m2ts", ".mts", ".tp", ".trp"};
+
+static bool hasTsExtension(const string& name) {
+    for (const char* ext : sExtensions) {
+        size_t len = strlen(ext);
+        if (name.size() > len && strcasecmp(name.c_str() + name.size() - len, ext) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Length of the UTF-8 sequence at 's', 0 if it is not valid UTF-8
+static int utf8Length(const unsigned char* s, size_t avail) {
+    int len = s[0] < 0x80 ? 1 : (s[0] >> 5) == 0x06 ? 2 : (s[0] >> 4) == 0x0e ? 3 : (s[0] >> 3) == 0x1e ? 4 : 0;
+    if (len == 0 || (size_t)len > avail) {
+        return 0;
+    }
+    for (int i = 1; i < len; i++) {
+        if ((s[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+    }
+    return len;
+}
+
+// Service names are not always UTF-8 (DVB character tables): bytes that do
+// not form UTF-8 are escaped as if they were Latin-1, so the line stays JSON
+static string jsonString(const string& value) {
+    string out = "\"";
+    const unsigned char* s = (const unsigned char*)value.data();
+    size_t i = 0;
+    while (i < value.size()) {
+        char escaped[8];
+        if (s[i] == '"' || s[i] == '\\') {
+            out += '\\';
+            out += s[i++];
+        } else if (s[i] < 0x20) {
+            snprintf(escaped, sizeof(escaped), "\\u%04x", s[i++]);
+            out += escaped;
+        } else {
+            int len = utf8Length(s + i, value.size() - i);
+            if (len == 0) {
+                snprintf(escaped, sizeof(escaped), "\\u%04x", s[i++]);
+                out += escaped;
+            } else {
+                out.append(value, i, len);
+                i += len;
+            }
+        }
+    }
+    return out + "\"";
+}
+
+TsBatch::TsBatch(const TsBatchConfig& config)
+    : mConfig(config) {
+}
+
+void TsBatch::scanDirectory(const string& dir, vector<string>& paths) {
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        std::cerr << "Cannot open directory " << dir << std::endl;
+        return;
+    }
+    while (struct dirent* entry = readdir(d)) {
+        string name = entry->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        string path = dir + "/" + name;
+        bool is_dir = entry->d_type == DT_DIR;
+        bool is_reg = entry->d_type == DT_REG;
+        if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0) {
+                continue;
+            }
+            is_dir = S_ISDIR(st.st_mode);
+            is_reg = S_ISREG(st.st_mode);
+        }
+        if (is_dir) {
+            scanDirectory(path, paths);
+        } else if (is_reg && hasTsExtension(name)) {
+            paths.push_back(path);
+        }
+    }
+    closedir(d);
+}
+
+int TsBatch::collect(const string& source, vector<string>& paths) {
+    struct stat st;
+    if (source != "-" && stat(source.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+        scanDirectory(source, paths);
+        std::sort(paths.begin(), paths.end());
+        return 0;
+    }
+    std::ifstream list;
+    if (source != "-") {
+        list.open(source);
+        if (!list) {
+            std::cerr << "Cannot open " << source << std::endl;
+            return -1;
+        }
+    }
+    std::istream& in = source == "-" ? std::cin : list;
+    string line;
+    while (std::getline(in, line)) {
+        while (!line.empty() && isspace((unsigned char)line.back())) {
+            line.pop_back();
+        }
+        if (!line.empty() && line[0] != '#') {
+            paths.push_back(line);
+        }
+    }
+    return 0;
+}
+
+bool TsBatch::isRotational(dev_t device) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/queue/rotational", major(device), minor(device));
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        // A partition: the queue belongs to its disk
+        snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/../queue/rotational", major(device), minor(device));
+        file = fopen(path, "r");
+    }
+    if (!file) {
+        return false;
+    }
+    int rotational = 0;
+    if (fscanf(file, "%d", &rotational) != 1) {
+        rotational = 0;
+    }
+    fclose(file);
+    return rotational == 1;
+}
+
+uint64_t TsBatch::physicalOffset(const string& path, uint64_t inode) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return inode;
+    }
+    alignas(struct fiemap) char buf[sizeof(struct fiemap) + sizeof(struct fiemap_extent)] = {0};
+    struct fiemap* map = (struct fiemap*)buf;
+    map->fm_length = ~0ULL;
+    map->fm_extent_count = 1;
+    uint64_t position = inode;
+    if (ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents > 0) {
+        position = map->fm_extents[0].fe_physical;
+    }
+    close(fd);
+    return position;
+}
+
+uint64_t TsBatch::fileMemory() const {
+    uint64_t memory = TS_BATCH_FILE_MEMORY;
+    if (!mConfig.allowMmap) {
+        memory += 1 << 20; // TsStdioInput buffer
+    }
+    if (mConfig.probe) {
+        memory += TS_PROBE_WINDOW;
+    }
+    return memory;
+}
+
+void TsBatch::acquire(uint64_t memory) {
+    std::unique_lock<std::mutex> guard(mBudgetLock);
+    // A file alone over a limit still runs, once nothing else does
+    mBudgetFree.wait(guard, [&]() {
+        return mOpenFiles == 0 ||
+               (mOpenFiles + TS_BATCH_FDS_PER_FILE <= mConfig.maxOpenFiles && mMemory + memory <= mConfig.maxMemory);
+    });
+    mOpenFiles += TS_BATCH_FDS_PER_FILE;
+    mMemory += memory;
+}
+
+void TsBatch::release(uint64_t memory) {
+    {
+        std::lock_guard<std::mutex> guard(mBudgetLock);
+        mOpenFiles -= TS_BATCH_FDS_PER_FILE;
+        mMemory -= memory;
+    }
+    mBudgetFree.notify_all();
+}
+
+void TsBatch::writeRecord(const string& record, bool ok) {
+    std::lock_guard<std::mutex> guard(mReportLock);
+    *mReport << record << '\n';
+    mReport->flush();
+    mFailed += ok ? 0 : 1;
+}
+
+void TsBatch::analyze(const TsBatchFile& file) {
+    const uint64_t memory = fileMemory();
+    acquire(memory);
+    TsParser parser;
+    parser.setCommand(OPTION_SET_INPUT_FILE, (void*)file.path.c_str());
+    parser.setCommand(OPTION_SHOW_STREAM_INFO);
+    if (!mConfig.allowMmap) {
+        parser.setCommand(OPTION_DISABLE_MMAP);
+    }
+    if (!mConfig.useIndex) {
+        parser.setCommand(OPTION_NO_INDEX);
+    }
+    if (mConfig.probe) {
+        parser.setCommand(OPTION_PROBE);
+        if (mConfig.probeBytes > 0) {
+            parser.setCommand(OPTION_PROBE_BYTES, (void*)&mConfig.probeBytes);
+        }
+        if (mConfig.probeMs > 0) {
+            parser.setCommand(OPTION_PROBE_MS, (void*)&mConfig.probeMs);
+        }
+    }
+    std::ostringstream out;
+    std::ostringstream err;
+    parser.mOut = &out;
+    parser.mErr = &err;
+    auto start = std::chrono::steady_clock::now();
+    int ret = parser.parse();
+    double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    release(memory);
+
+    // Not a single packet and no tables, from the input or an index: sync
+    // was never found
+    const bool not_ts = ret == 0 && parser.mPacketIndex == 0 && !parser.isHasGetPat;
+    if (not_ts) {
+        err << "No TS packet found" << std::endl;
+    }
+    std::ostringstream record;
+    record << "{\"file\": " << jsonString(file.path) << ", \"status\": \""
+           << (not_ts ? "not-ts" : ret == 0 ? "ok" : "error")
+           << "\", \"size\": " << file.size << ", \"elapsed_ms\": " << elapsed_ms;
+    if (ret == 0 && !not_ts) {
+        record << ", \"packet_size\": " << parser.mPacketSize << ", \"packets\": " << parser.mPacketIndex
+               << ", \"complete\": " << (parser.isStreamInfoComplete() ? "true" : "false");
+        if (parser.mProbeReport.done) {
+            record << ", \"probe\": {\"bytes\": " << parser.mProbeReport.bytesRead
+                   << ", \"reads\": " << parser.mProbeReport.reads << "}";
+        }
+        record << ", \"sync_losses\": " << parser.mSyncLossCount << ", \"crc_errors\": " << parser.mCrcErrors
+               << ", \"programs\": [";
+        bool first = true;
+        for (const auto& program : parser.mPat) {
+            record << (first ? "" : ", ") << "{\"program\": " << program.first << ", \"pmt_pid\": " << program.second;
+            first = false;
+            auto service = parser.mServiceInfos.find(program.first);
+            if (service != parser.mServiceInfos.end()) {
+                record << ", \"provider\": " << jsonString(service->second.provider_name)
+                       << ", \"service\": " << jsonString(service->second.service_name);
+            }
+            for (const auto& pmt : parser.mPmt) {
+                if (pmt.program_number != program.first) {
+                    continue;
+                }
+                record << ", \"pcr_pid\": " << pmt.pcr_pid << ", \"streams\": [";
+                for (size_t i = 0; i < pmt.streams.size(); i++) {
+                    const PmtStreamInfo& stream = pmt.streams[i];
+                    record << (i ? ", " : "") << "{\"pid\": " << stream.elementary_pid
+                           << ", \"stream_type\": " << (int)stream.stream_type
+                           << ", \"description\": " << jsonString(parser.mStreamInfo[stream.elementary_pid]) << "}";
+                }
+                record << "]";
+                break;
+            }
+            record << "}";
+        }
+        record << "]";
+    }
+    // What the parser reported on stderr: the reason of a failure, sync
+    // losses, CRC errors, table updates
+    std::istringstream messages(err.str());
+    string line;
+    bool first = true;
+    while (std::getline(messages, line)) {
+        record << (first ? ", \"messages\": [" : ", ") << jsonString(line);
+        first = false;
+    }
+    record << (first ? "}" : "]}");
+    writeRecord(record.str(), ret == 0 && !not_ts);
+}
+
+void TsBatch::analyzeChain(WorkStealingPool& pool, shared_ptr<vector<TsBatchFile>> files, size_t next) {
+    analyze((*files)[next]);
+    if (next + 1 < files->size()) {
+        pool.submit([this, &pool, files, next]() { analyzeChain(pool, files, next + 1); });
+    }
+}
+
+int TsBatch::run(const string& source) {
+    vector<string> paths;
+    if (collect(source, paths) != 0) {
+        return -1;
+    }
+    if (paths.empty()) {
+        std::cerr << "No TS files in " << source << std::endl;
+        return -1;
+    }
+    if (mConfig.maxOpenFiles <= 0) {
+        struct rlimit limit;
+        rlim_t open_files = getrlimit(RLIMIT_NOFILE, &limit) == 0 ? limit.rlim_cur : 1024;
+        mConfig.maxOpenFiles = std::min<rlim_t>(open_files, 1 << 20) / 2;
+    }
+    int threads = mConfig.threads > 0 ? mConfig.threads : std::max(1u, std::thread::hardware_concurrency());
+    std::ofstream report;
+    if (!mConfig.reportPath.empty()) {
+        report.open(mConfig.reportPath);
+        if (!report) {
+            std::cerr << "Cannot write " << mConfig.reportPath << std::endl;
+            return -1;
+        }
+        mReport = &report;
+    } else {
+        mReport = &std::cout;
+    }
+
+    // Spinning disks get one reader each, walking their files in on-disk
+    // order; seeking between files read in parallel would cost far more
+    map<dev_t, bool> rotational;
+    map<dev_t, vector<TsBatchFile>> disks;
+    vector<TsBatchFile> others;
+    for (const auto& path : paths) {
+        struct stat st;
+        bool found = stat(path.c_str(), &st) == 0;
+        if (!found || !S_ISREG(st.st_mode)) {
+            string reason = found ? "Not a regular file" : strerror(errno);
+            writeRecord("{\"file\": " + jsonString(path) + ", \"status\": \"error\", \"messages\": [" + jsonString(reason) + "]}", false);
+            continue;
+        }
+        TsBatchFile file;
+        file.path = path;
+        file.size = st.st_size;
+        file.device = st.st_dev;
+        auto it = rotational.find(st.st_dev);
+        if (it == rotational.end()) {
+            it = rotational.emplace(st.st_dev, isRotational(st.st_dev)).first;
+        }
+        if (it->second) {
+            file.position = physicalOffset(path, st.st_ino);
+            disks[st.st_dev].push_back(file);
+        } else {
+            others.push_back(file);
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    uint64_t steals = 0;
+    {
+        WorkStealingPool pool(threads);
+        for (auto& disk : disks) {
+            auto files = std::make_shared<vector<TsBatchFile>>(std::move(disk.second));
+            std::sort(files->begin(), files->end(),
+                      [](const TsBatchFile& a, const TsBatchFile& b) { return a.position < b.position; });
+            pool.submit([this, &pool, files]() { analyzeChain(pool, files, 0); });
+        }
+        for (const auto& file : others) {
+            pool.submit([this, file]() { analyze(file); });
+        }
+        pool.wait();
+        steals = pool.steals();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << "Batch: " << paths.size() << " files, " << mFailed << " failed, " << seconds << " s on "
+              << threads << " threads (" << disks.size() << " rotational disks, " << steals << " steals)" << std::endl;
+    return mFailed ? -1 : 0;
+}
@@ -0,0 +1,96 @@
+/**
+ * File: TsBatch.h
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: TsBatch class definition, stream info of many files at once
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _TS_BATCH_H_
+#define _TS_BATCH_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+using namespace std;
+
+// Estimated memory of one -s parse besides the input: PID table, section
+// and PES state. The stdio reader adds its buffer, see TsBatch::fileMemory().
+#ifndef TS_BATCH_FILE_MEMORY
+#define TS_BATCH_FILE_MEMORY (2 << 20)
+#endif
+
+#define TS_BATCH_FDS_PER_FILE 2 // the input, plus the index or probe descriptor
+
+class WorkStealingPool;
+
+struct TsBatchConfig {
+    int threads = 0;                // 0: one per CPU
+    int maxOpenFiles = 0;           // 0: half of RLIMIT_NOFILE
+    uint64_t maxMemory = 1ULL << 30;
+    string reportPath;              // empty: stdout
+    bool allowMmap = true;
+    bool useIndex = true;
+    bool probe = false;
+    uint64_t probeBytes = 0;        // 0: TsParser default
+    int probeMs = 0;
+};
+
+struct TsBatchFile {
+    string path;
+    uint64_t size = 0;
+    dev_t device = 0;
+    uint64_t position = 0; // physical offset of the first extent, or the inode
+};
+
+/*
+ * Runs -s on every file of a list or directory tree, one TsParser per file
+ * on a WorkStealingPool, and streams one JSON record per file (JSON Lines)
+ * as each one finishes. Files on a rotational disk are read one at a time
+ * per disk, in on-disk order; others run as parallel as the pool allows.
+ */
+class TsBatch {
+    public:
+        TsBatch(const TsBatchConfig& config);
+        // 'source': a directory, a file listing one path per line, or "-"
+        // for such a list on stdin. Returns 0 if every file was analyzed.
+        int run(const string& source);
+    private:
+        int collect(const string& source, vector<string>& paths);
+        void scanDirectory(const string& dir, vector<string>& paths);
+        void analyze(const TsBatchFile& file);
+        // Files of one rotational disk, one after the other
+        void analyzeChain(WorkStealingPool& pool, shared_ptr<vector<TsBatchFile>> files, size_t next);
+        void writeRecord(const string& record, bool ok);
+        uint64_t fileMemory() const;
+        void acquire(uint64_t memory);
+        void release(uint64_t memory);
+        static bool isRotational(dev_t device);
+        static uint64_t physicalOffset(const string& path, uint64_t inode);
+        TsBatchConfig mConfig;
+        std::ostream* mReport = nullptr;
+        std::mutex mReportLock;
+        // Budget for the files being parsed at the same time
+        std::mutex mBudgetLock;
+        std::condition_variable mBudgetFree;
+        int mOpenFiles = 0;
+        uint64_t mMemory = 0;
+        int mFailed = 0; // under mReportLock
+};
+
+#endif /* _TS_BATCH_H_ */
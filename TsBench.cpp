@@ -0,0 +1,634 @@
+/**
+ * File: TsBench.cpp
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: TsBench, parser benchmarks on a synthetic stream, results as JSON
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "TsParser.h"
+#include "TsGenerator.h"
+#include "TsCrc.h"
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <getopt.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <new>
+#define VERSION "1.2.0"
+
+// Every heap allocation of the process, for the steady state check
+static std::atomic<uint64_t> sAllocations{0};
+
+// All forms go through one out-of-line pair: inlined into the library's
+// allocators, malloc()/free() would no longer match their operator new
+__attribute__((noinline)) void* operator new(size_t size) {
+    sAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete[](void* p) noexcept {
+    operator delete(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    operator delete(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    operator delete(p);
+}
+
+// Discards everything but still runs the formatting in front of it
+class NullBuf : public std::streambuf {
+    protected:
+        int overflow(int c) override { return c; }
+        std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+struct BenchResult {
+    string name;
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    vector<double> seconds;
+    int64_t allocations = -1; // heap allocations of the measured run, -1: not counted
+};
+
+class TsBench {
+    public:
+        TsBench(const TsGeneratorConfig& config, int repeat);
+        ~TsBench();
+        int run(const string& only);
+        void printJson(std::ostream& out) const;
+        bool failed() const { return mFailed; }
+    private:
+        int splitPackets(const vector<uint8_t>& stream, vector<const uint8_t*>& packets);
+        void benchPacket();
+        void benchSection();
+        void benchPes();
+        void benchCrc();
+        void benchAlloc();
+        void benchCore(const string& name, int core, CommandOption option);
+        void benchMode(const string& name, CommandOption option, int pid, const string& auTable = "", bool blockDecode = true);
+        void benchMonitor(const string& name, bool printPts);
+        void record(const string& name, uint64_t packets, double seconds);
+        void cleanDir();
+        static double now();
+        TsGeneratorConfig mConfig;
+        int mRepeat;
+        vector<uint8_t> mStream;
+        vector<const uint8_t*> mPackets; // synced packets of mStream, junk skipped
+        vector<bool> mIsEs;              // per PID
+        uint32_t mCrcSink = 0;           // keeps the CRC loop from being optimized out
+        int mPacketSize = TS_PACKET_SIZE;
+        string mDir;                     // holds the input file and -o output
+        string mFile;
+        NullBuf mNullBuf;
+        std::ostream mNull{&mNullBuf};
+        vector<BenchResult> mResults;
+        bool mFailed = false;            // a check (alloc) did not hold
+};
+
+TsBench::TsBench(const TsGeneratorConfig& config, int repeat)
+    : mConfig(config),
+      mRepeat(std::max(1, repeat)) {
+}
+
+TsBench::~TsBench() {
+    if (!mDir.empty()) {
+        cleanDir();
+        unlink(mFile.c_str());
+        rmdir(mDir.c_str());
+    }
+}
+
+double TsBench::now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void TsBench::record(const string& name, uint64_t packets, double seconds) {
+    for (auto& result : mResults) {
+        if (result.name == name) {
+            result.seconds.push_back(seconds);
+            return;
+        }
+    }
+    BenchResult result;
+    result.name = name;
+    result.packets = packets;
+    result.bytes = packets * mPacketSize;
+    result.seconds.push_back(seconds);
+    mResults.push_back(result);
+}
+
+void TsBench::cleanDir() {
+    DIR* dir = opendir(mDir.c_str());
+    if (!dir) {
+        return;
+    }
+    while (struct dirent* entry = readdir(dir)) {
+        string name = entry->d_name;
+        if (name.compare(0, 4, "out_") == 0) {
+            unlink((mDir + "/" + name).c_str());
+        }
+    }
+    closedir(dir);
+}
+
+// Returns the packet size
+int TsBench::splitPackets(const vector<uint8_t>& stream, vector<const uint8_t*>& packets) {
+    // Let the parser's own sync logic find the packets once
+    TsParser parser;
+    TsMemoryInput input(stream.data(), stream.size());
+    parser.mInput = &input;
+    parser.mErr = &mNull;
+    const uint8_t* pkt = nullptr;
+    bool isSynced = false;
+    while (parser.readNextTsPacket(pkt, isSynced)) {
+        packets.push_back(pkt);
+    }
+    parser.mInput = nullptr;
+    return parser.mPacketSize;
+}
+
+// packet(): header decode, PID dispatch, adaptation field and PSI, no -o/-p
+void TsBench::benchPacket() {
+    for (int run = 0; run < mRepeat; run++) {
+        TsParser parser;
+        parser.mErr = &mNull;
+        double start = now();
+        for (size_t i = 0; i < mPackets.size(); i++) {
+            parser.mPacketOffset = i;
+            parser.packet(mPackets[i]);
+        }
+        record("packet", mPackets.size(), now() - start);
+    }
+}
+
+// TsParserCore::sectionData(): PMT/SDT reassembly and parsing, PAT already known
+void TsBench::benchSection() {
+    TsParser primer;
+    for (auto pkt : mPackets) {
+        if ((((pkt[1] & 0x1f) << 8) | pkt[2]) == 0) {
+            primer.packet(pkt);
+            break;
+        }
+    }
+    vector<const uint8_t*> sections;
+    for (auto pkt : mPackets) {
+        uint8_t role = primer.mPidTable[((pkt[1] & 0x1f) << 8) | pkt[2]].role;
+        if (role == PID_ROLE_PMT || role == PID_ROLE_SDT) {
+            sections.push_back(pkt);
+        }
+    }
+    for (int run = 0; run < mRepeat; run++) {
+        TsParser parser;
+        parser.mPat = primer.mPat;
+        parser.rebuildPidTable();
+        double start = now();
+        for (auto pkt : sections) {
+            int pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+            const PidEntry& entry = parser.mPidTable[pid];
+            TsPsiCore(parser.mPidTable.data(), {&parser}, {}, {}, {}).sectionData(pkt, 4, pid, pkt[3] & 0x0f, (pkt[1] >> 6) & 0x01, entry);
+        }
+        record("section", sections.size(), now() - start);
+    }
+}
+
+// PesAssembler::push() (the former parsePes()) on every ES packet
+void TsBench::benchPes() {
+    struct EsPacket {
+        int pid;
+        int offset;
+        const uint8_t* pkt;
+    };
+    vector<EsPacket> es;
+    for (auto pkt : mPackets) {
+        int pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+        if (!mIsEs[pid] || !(pkt[3] & 0x10)) {
+            continue;
+        }
+        int offset = 4 + ((pkt[3] & 0x20) ? 1 + pkt[4] : 0);
+        if (offset < 188) {
+            es.push_back({pid, offset, pkt});
+        }
+    }
+    for (int run = 0; run < mRepeat; run++) {
+        TsParser parser;
+        parser.mErr = &mNull;
+        double start = now();
+        for (size_t i = 0; i < es.size(); i++) {
+            const uint8_t* pkt = es[i].pkt;
+            parser.mPes.push(es[i].pid, pkt + es[i].offset, 188 - es[i].offset, pkt[3] & 0x0f, (pkt[1] >> 6) & 0x01, i);
+        }
+        parser.mPes.flushAll();
+        record("pes", es.size(), now() - start);
+    }
+}
+
+// tsCrc32() over the whole stream in blocks of the largest PSI section
+void TsBench::benchCrc() {
+    const size_t block = 1024;
+    for (int run = 0; run < mRepeat; run++) {
+        uint32_t sum = 0;
+        double start = now();
+        for (size_t pos = 0; pos < mStream.size(); pos += block) {
+            sum ^= tsCrc32(mStream.data() + pos, std::min(block, mStream.size() - pos));
+        }
+        double seconds = now() - start;
+        mCrcSink ^= sum;
+        record("crc", mStream.size() / mPacketSize, seconds);
+    }
+}
+
+// packet() with -p on every PID, a second time over the same stream: once
+// the tables, section buffers and PES state exist nothing may allocate,
+// PMT and SDT updates included (the stream steps their version if the
+// config does not already)
+void TsBench::benchAlloc() {
+    TsGeneratorConfig config = mConfig;
+    if (config.versionInterval == 0) {
+        config.versionInterval = 4;
+    }
+    vector<uint8_t> stream;
+    TsGenerator(config).generate(stream);
+    vector<const uint8_t*> packets;
+    splitPackets(stream, packets);
+    int all = 0x1fff;
+    TsParser parser;
+    parser.setCommand(OPTION_PRINT_PTS, (void*)&all);
+    parser.mOut = &mNull;
+    parser.mErr = &mNull;
+    for (size_t i = 0; i < packets.size(); i++) {
+        parser.mPacketOffset = i;
+        parser.packet(packets[i]);
+    }
+    uint64_t updates = parser.mPsiUpdates;
+    uint64_t before = sAllocations.load();
+    double start = now();
+    for (size_t i = 0; i < packets.size(); i++) {
+        parser.mPacketOffset = i;
+        parser.packet(packets[i]);
+    }
+    double seconds = now() - start;
+    int64_t allocations = sAllocations.load() - before;
+    record("alloc", packets.size(), seconds);
+    mResults.back().allocations = allocations;
+    if (allocations != 0) {
+        std::cerr << "Steady state: " << allocations << " heap allocations in " << packets.size()
+                  << " packets (" << parser.mPsiUpdates - updates << " table updates)" << std::endl;
+        mFailed = true;
+    }
+}
+
+// packet() through one TsParserCore configuration, 'option' set; the
+// same run with CORE_FULL is the run-time flag version it replaces
+void TsBench::benchCore(const string& name, int core, CommandOption option) {
+    int all = 0x1fff;
+    for (int run = 0; run < mRepeat; run++) {
+        TsParser parser;
+        parser.setCommand(option, (void*)&all);
+        parser.mOut = &mNull;
+        parser.mErr = &mNull;
+        parser.mCore = core;
+        double start = now();
+        for (size_t i = 0; i < mPackets.size(); i++) {
+            parser.mPacketOffset = i;
+            parser.packet(mPackets[i]);
+        }
+        parser.mPes.flushAll();
+        record(name, mPackets.size(), now() - start);
+    }
+}
+
+// A whole parse() of the input file, like the command line would run it;
+// with 'auTable' the access unit table is collected as well, without
+// 'blockDecode' the headers are decoded one packet at a time
+void TsBench::benchMode(const string& name, CommandOption option, int pid, const string& auTable, bool blockDecode) {
+    std::streambuf* out = std::cout.rdbuf(&mNullBuf);
+    std::streambuf* err = std::cerr.rdbuf(&mNullBuf);
+    for (int run = 0; run < mRepeat; run++) {
+        TsParser parser;
+        parser.setCommand(OPTION_SET_INPUT_FILE, (void*)mFile.c_str());
+        parser.setCommand(OPTION_NO_INDEX);
+        parser.setCommand(option, (void*)&pid);
+        if (!auTable.empty()) {
+            parser.setCommand(OPTION_AU_TABLE, (void*)auTable.c_str());
+        }
+        parser.mOut = &mNull;
+        parser.mErr = &mNull;
+        parser.mBlockDecode = blockDecode;
+        double start = now();
+        parser.parse();
+        double seconds = now() - start;
+        record(name, parser.mPacketIndex, seconds);
+        cleanDir();
+    }
+    std::cout.rdbuf(out);
+    std::cerr.rdbuf(err);
+}
+
+// parse() with the TR 101 290 checks, on their own or next to -p
+void TsBench::benchMonitor(const string& name, bool printPts) {
+    std::streambuf* out = std::cout.rdbuf(&mNullBuf);
+    std::streambuf* err = std::cerr.rdbuf(&mNullBuf);
+    const string path = mDir + "/out_tr101290.csv";
+    int all = 0x1fff;
+    for (int run = 0; run < mRepeat; run++) {
+        TsParser parser;
+        parser.setCommand(OPTION_SET_INPUT_FILE, (void*)mFile.c_str());
+        parser.setCommand(OPTION_NO_INDEX);
+        parser.setCommand(OPTION_TR101290, (void*)path.c_str());
+        if (printPts) {
+            parser.setCommand(OPTION_PRINT_PTS, (void*)&all);
+        }
+        parser.mOut = &mNull;
+        parser.mErr = &mNull;
+        double start = now();
+        parser.parse();
+        double seconds = now() - start;
+        record(name, parser.mPacketIndex, seconds);
+        cleanDir();
+    }
+    std::cout.rdbuf(out);
+    std::cerr.rdbuf(err);
+}
+
+int TsBench::run(const string& only) {
+    TsGenerator generator(mConfig);
+    generator.generate(mStream);
+    mIsEs.assign(8192, false);
+    for (int pid : generator.esPids()) {
+        mIsEs[pid] = true;
+    }
+    mPacketSize = splitPackets(mStream, mPackets);
+
+    const char* tmp = getenv("TMPDIR");
+    string pattern = string(tmp ? tmp : "/tmp") + "/tsbench.XXXXXX";
+    vector<char> dir(pattern.begin(), pattern.end());
+    dir.push_back('\0');
+    if (!mkdtemp(dir.data())) {
+        std::cerr << "Cannot create a directory from " << pattern << std::endl;
+        return -1;
+    }
+    mDir = dir.data();
+    mFile = mDir + "/bench.ts";
+    std::ofstream file(mFile, std::ios::binary);
+    file.write((const char*)mStream.data(), mStream.size());
+    file.close();
+    if (!file) {
+        std::cerr << "Cannot write " << mFile << std::endl;
+        return -1;
+    }
+    // -o writes out_XXXX.es into the current directory
+    char cwd[4096];
+    if (!getcwd(cwd, sizeof(cwd)) || chdir(mDir.c_str()) != 0) {
+        std::cerr << "Cannot change to " << mDir << std::endl;
+        return -1;
+    }
+
+    int all = 0x1fff;
+    auto wanted = [&](const char* name) { return only.empty() || only == name; };
+    if (wanted("packet")) benchPacket();
+    if (wanted("section")) benchSection();
+    if (wanted("pes")) benchPes();
+    if (wanted("crc")) benchCrc();
+    if (wanted("alloc")) benchAlloc();
+    if (wanted("core")) {
+        benchCore("core_s_flags", CORE_FULL, OPTION_SHOW_STREAM_INFO);
+        benchCore("core_s", CORE_PSI, OPTION_SHOW_STREAM_INFO);
+        benchCore("core_p_flags", CORE_FULL, OPTION_PRINT_PTS);
+        benchCore("core_p", CORE_PES, OPTION_PRINT_PTS);
+    }
+    if (wanted("mode_s")) benchMode("mode_s", OPTION_SHOW_STREAM_INFO, all);
+    if (wanted("mode_o")) benchMode("mode_o", OPTION_OUTPUT_PID, all);
+    if (wanted("mode_p")) benchMode("mode_p", OPTION_PRINT_PTS, all);
+    if (wanted("au")) {
+        // Against mode_o and mode_p: the cost of the NAL scan
+        benchMode("mode_o_au", OPTION_OUTPUT_PID, all, mDir + "/out_au.csv");
+        benchMode("mode_p_au", OPTION_PRINT_PTS, all, mDir + "/out_au.csv");
+    }
+    if (wanted("tr101290")) {
+        // Against mode_p: what the checks add to a parse
+        benchMonitor("mode_tr101290", false);
+        benchMonitor("mode_p_tr101290", true);
+    }
+    if (wanted("block")) {
+        // Against mode_o and mode_p: without TsBlockDecoder
+        benchMode("mode_o_packet", OPTION_OUTPUT_PID, all, "", false);
+        benchMode("mode_p_packet", OPTION_PRINT_PTS, all, "", false);
+    }
+    if (chdir(cwd) != 0) {
+        return -1;
+    }
+    if (mResults.empty()) {
+        std::cerr << "Unknown benchmark " << only << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+void TsBench::printJson(std::ostream& out) const {
+    out << "{\n";
+    out << "  \"version\": \"" << VERSION << "\",\n";
+    out << "  \"sync_scanner\": \"" << TsSyncScanner::implName() << "\",\n";
+    out << "  \"crc\": \"" << tsCrcImplName() << "\",\n";
+    out << "  \"block_decode\": \"" << TsBlockDecoder::implName() << "\",\n";
+    out << "  \"config\": {\"programs\": " << mConfig.programs
+        << ", \"pids_per_program\": " << mConfig.pidsPerProgram
+        << ", \"psi_interval\": " << mConfig.psiInterval
+        << ", \"version_interval\": " << mConfig.versionInterval
+        << ", \"pes_min\": " << mConfig.pesMin
+        << ", \"pes_max\": " << mConfig.pesMax
+        << ", \"adaptation_density\": " << mConfig.adaptationDensity
+        << ", \"sync_loss_interval\": " << mConfig.syncLossInterval
+        << ", \"packet_size\": " << mConfig.packetSize
+        << ", \"packets\": " << mConfig.packets
+        << ", \"seed\": " << mConfig.seed
+        << ", \"repeat\": " << mRepeat << "},\n";
+    out << "  \"stream_bytes\": " << mStream.size() << ",\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < mResults.size(); i++) {
+        const BenchResult& r = mResults[i];
+        vector<double> sorted = r.seconds;
+        std::sort(sorted.begin(), sorted.end());
+        double best = std::max(sorted.front(), 1e-9);
+        double median = sorted[sorted.size() / 2];
+        out << "    {\"name\": \"" << r.name << "\", \"packets\": " << r.packets << ", \"bytes\": " << r.bytes
+            << ", \"best_s\": " << best << ", \"median_s\": " << median
+            << ", \"packets_per_s\": " << (uint64_t)(r.packets / best)
+            << ", \"mb_per_s\": " << r.bytes / best / 1e6
+            << ", \"ns_per_packet\": " << (r.packets ? best * 1e9 / r.packets : 0);
+        if (r.allocations >= 0) {
+            out << ", \"allocations\": " << r.allocations;
+        }
+        out << "}"
+            << (i + 1 < mResults.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}" << std::endl;
+}
+
+enum {
+    BENCH_OPT_PROGRAMS = 256,
+    BENCH_OPT_PIDS,
+    BENCH_OPT_PSI_INTERVAL,
+    BENCH_OPT_VERSION_INTERVAL,
+    BENCH_OPT_PES_MIN,
+    BENCH_OPT_PES_MAX,
+    BENCH_OPT_AF_DENSITY,
+    BENCH_OPT_SYNC_LOSS,
+    BENCH_OPT_PACKET_SIZE,
+    BENCH_OPT_PACKETS,
+    BENCH_OPT_GOP,
+    BENCH_OPT_SEED,
+    BENCH_OPT_REPEAT,
+    BENCH_OPT_ONLY,
+    BENCH_OPT_JSON,
+};
+
+void Usage(char* argv[]) {
+    std::cout << "Usage: " << argv[0] << " [OPTIONS...]" << std::endl;
+    std::cout << "OPTIONS:" << std::endl;
+    std::cout << "      --programs <N>      Programs in the stream (default 2)" << std::endl;
+    std::cout << "      --pids <N>          ES PIDs per program (default 2)" << std::endl;
+    std::cout << "      --psi-interval <N>  Packets between PSI repetitions (default 2000)" << std::endl;
+    std::cout << "      --version-interval <N> Step the PMT/SDT version every N repetitions (default 0: never)" << std::endl;
+    std::cout << "      --pes-min <BYTES>   Smallest PES payload (default 2000)" << std::endl;
+    std::cout << "      --pes-max <BYTES>   Largest PES payload (default 60000)" << std::endl;
+    std::cout << "      --af-density <F>    Share of ES packets with an adaptation field (default 0.05)" << std::endl;
+    std::cout << "      --sync-loss <N>     Insert junk every N packets (default 0: never)" << std::endl;
+    std::cout << "      --packet-size <N>   188, 192 or 204 (default 188)" << std::endl;
+    std::cout << "      --packets <N>       Stream length in packets (default 200000)" << std::endl;
+    std::cout << "      --gop <N>           Video PES between IDR pictures (default 25, 0: no NAL units)" << std::endl;
+    std::cout << "      --seed <N>          Generator seed (default 1)" << std::endl;
+    std::cout << "      --repeat <N>        Runs per benchmark, the best one counts (default 5)" << std::endl;
+    std::cout << "      --only <NAME>       packet, section, pes, crc, alloc, core, mode_s, mode_o, mode_p, au, block or tr101290" << std::endl;
+    std::cout << "      --json <FILE>       Write the results to FILE instead of stdout" << std::endl;
+    std::cout << "  -h, --help              Show this help message" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    const struct option longOptions[] = {
+        {"help",          no_argument,       0, 'h'},
+        {"programs",      required_argument, 0, BENCH_OPT_PROGRAMS},
+        {"pids",          required_argument, 0, BENCH_OPT_PIDS},
+        {"psi-interval",  required_argument, 0, BENCH_OPT_PSI_INTERVAL},
+        {"version-interval", required_argument, 0, BENCH_OPT_VERSION_INTERVAL},
+        {"pes-min",       required_argument, 0, BENCH_OPT_PES_MIN},
+        {"pes-max",       required_argument, 0, BENCH_OPT_PES_MAX},
+        {"af-density",    required_argument, 0, BENCH_OPT_AF_DENSITY},
+        {"sync-loss",     required_argument, 0, BENCH_OPT_SYNC_LOSS},
+        {"packet-size",   required_argument, 0, BENCH_OPT_PACKET_SIZE},
+        {"packets",       required_argument, 0, BENCH_OPT_PACKETS},
+        {"gop",           required_argument, 0, BENCH_OPT_GOP},
+        {"seed",          required_argument, 0, BENCH_OPT_SEED},
+        {"repeat",        required_argument, 0, BENCH_OPT_REPEAT},
+        {"only",          required_argument, 0, BENCH_OPT_ONLY},
+        {"json",          required_argument, 0, BENCH_OPT_JSON},
+        {0, 0, 0, 0}
+    };
+    TsGeneratorConfig config;
+    int repeat = 5;
+    string only;
+    string json;
+    int optionChar = 0;
+    int optionIndex = 0;
+    while ((optionChar = getopt_long(argc, argv, "h", longOptions, &optionIndex)) != -1) {
+        switch (optionChar) {
+            case BENCH_OPT_PROGRAMS:
+                config.programs = atoi(optarg);
+                break;
+            case BENCH_OPT_PIDS:
+                config.pidsPerProgram = atoi(optarg);
+                break;
+            case BENCH_OPT_PSI_INTERVAL:
+                config.psiInterval = atoi(optarg);
+                break;
+            case BENCH_OPT_VERSION_INTERVAL:
+                config.versionInterval = atoi(optarg);
+                break;
+            case BENCH_OPT_PES_MIN:
+                config.pesMin = atoi(optarg);
+                break;
+            case BENCH_OPT_PES_MAX:
+                config.pesMax = atoi(optarg);
+                break;
+            case BENCH_OPT_AF_DENSITY:
+                config.adaptationDensity = atof(optarg);
+                break;
+            case BENCH_OPT_SYNC_LOSS:
+                config.syncLossInterval = atoi(optarg);
+                break;
+            case BENCH_OPT_PACKET_SIZE:
+                config.packetSize = atoi(optarg);
+                if (config.packetSize != TS_PACKET_SIZE && config.packetSize != M2TS_PACKET_SIZE &&
+                    config.packetSize != RS_TS_PACKET_SIZE) {
+                    std::cerr << "--packet-size must be 188, 192 or 204" << std::endl;
+                    return -1;
+                }
+                break;
+            case BENCH_OPT_PACKETS:
+                config.packets = strtoull(optarg, nullptr, 10);
+                break;
+            case BENCH_OPT_GOP:
+                config.gopLength = atoi(optarg);
+                break;
+            case BENCH_OPT_SEED:
+                config.seed = strtoul(optarg, nullptr, 10);
+                break;
+            case BENCH_OPT_REPEAT:
+                repeat = atoi(optarg);
+                break;
+            case BENCH_OPT_ONLY:
+                only = optarg;
+                break;
+            case BENCH_OPT_JSON:
+                json = optarg;
+                break;
+            case 'h':
+                Usage(argv);
+                return 0;
+            default:
+                Usage(argv);
+                return -1;
+        }
+    }
+    TsBench bench(config, repeat);
+    if (bench.run(only) != 0) {
+        return -1;
+    }
+    if (json.empty()) {
+        bench.printJson(std::cout);
+    } else {
+        std::ofstream out(json);
+        bench.printJson(out);
+        if (!out) {
+            std::cerr << "Cannot write " << json << std::endl;
+            return -1;
+        }
+    }
+    return bench.failed() ? -1 : 0;
+}
@@ -0,0 +1,147 @@
+/**
+ * File: TsBlock.cpp
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: Implementation of TsBlockDecoder
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "TsBlock.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TS_BLOCK_X86 1
+#endif
+
+typedef void (*BlockDecodeFunc)(const uint8_t* data, size_t stride, int count, TsPacketBlock& block);
+
+static void decodeScalar(const uint8_t* data, size_t stride, int count, TsPacketBlock& block) {
+    block.count = count;
+    block.synced = 0;
+    block.null = 0;
+    block.tei = 0;
+    block.scrambled = 0;
+    for (int i = 0; i < count; i++) {
+        const uint8_t* pkt = data + i * stride;
+        const uint64_t bit = 1ULL << i;
+        const int pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+        const int afc = (pkt[3] >> 4) & 0x03;
+        block.synced |= pkt[0] == 0x47 ? bit : 0;
+        block.null |= pid == 0x1fff ? bit : 0;
+        block.tei |= (pkt[1] & 0x80) ? bit : 0;
+        block.scrambled |= (pkt[3] & 0xc0) ? bit : 0;
+        block.pid[i] = pid;
+        block.cc[i] = pkt[3] & 0x0f;
+        block.flags[i] = ((pkt[1] >> 6) & 0x01) | ((afc & 0x02) ? TS_BLOCK_AF : 0) | ((afc & 0x01) ? TS_BLOCK_PAYLOAD : 0);
+        block.payload[i] = (afc & 0x02) ? 5 + pkt[4] : 4;
+    }
+}
+
+#ifdef TS_BLOCK_X86
+// 32-bit lanes of four vectors (32 packets) to bytes, in packet order
+__attribute__((target("avx2")))
+static inline void storeBytes(uint8_t* out, __m256i a, __m256i b, __m256i c, __m256i d) {
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    __m256i bytes = _mm256_packus_epi16(_mm256_packus_epi32(a, b), _mm256_packus_epi32(c, d));
+    _mm256_storeu_si256((__m256i*)out, _mm256_permutevar8x32_epi32(bytes, order));
+}
+
+// ... of two vectors (16 packets) to 16-bit words
+__attribute__((target("avx2")))
+static inline void storeWords(uint16_t* out, __m256i a, __m256i b) {
+    _mm256_storeu_si256((__m256i*)out, _mm256_permute4x64_epi64(_mm256_packus_epi32(a, b), 0xd8));
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t laneMask(__m256i v) {
+    return (uint64_t)(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(v));
+}
+
+// A full block: the header of packet i is the 32-bit word at i * stride,
+// little-endian, so byte 1 of the packet is bits 8..15
+__attribute__((target("avx2")))
+static void decodeAvx2(const uint8_t* data, size_t stride, int count, TsPacketBlock& block) {
+    if (count != TS_BLOCK_PACKETS) {
+        decodeScalar(data, stride, count, block);
+        return;
+    }
+    const int s = (int)stride;
+    const __m256i step = _mm256_setr_epi32(0, s, 2 * s, 3 * s, 4 * s, 5 * s, 6 * s, 7 * s);
+    const __m256i byte = _mm256_set1_epi32(0xff);
+    const __m256i sync = _mm256_set1_epi32(0x47);
+    const __m256i nullPid = _mm256_set1_epi32(0x1fff);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i zero = _mm256_setzero_si256();
+    uint64_t synced = 0;
+    uint64_t null = 0;
+    uint64_t tei = 0;
+    uint64_t scrambled = 0;
+    __m256i pid[8], payload[8], flags[8], cc[8];
+    for (int g = 0; g < 8; g++) {
+        const uint8_t* base = data + (size_t)g * 8 * stride;
+        const __m256i h = _mm256_i32gather_epi32((const int*)base, step, 1);
+        const __m256i af = _mm256_and_si256(_mm256_i32gather_epi32((const int*)(base + 4), step, 1), byte);
+        const int shift = g * 8;
+        synced |= laneMask(_mm256_cmpeq_epi32(_mm256_and_si256(h, byte), sync)) << shift;
+        tei |= laneMask(_mm256_slli_epi32(h, 16)) << shift;                   // bit 15 to the sign
+        scrambled |= laneMask(_mm256_or_si256(h, _mm256_slli_epi32(h, 1))) << shift; // bits 31, 30
+        pid[g] = _mm256_or_si256(_mm256_and_si256(h, _mm256_set1_epi32(0x1f00)),
+                                 _mm256_and_si256(_mm256_srli_epi32(h, 16), byte));
+        null |= laneMask(_mm256_cmpeq_epi32(pid[g], nullPid)) << shift;
+        cc[g] = _mm256_and_si256(_mm256_srli_epi32(h, 24), _mm256_set1_epi32(0x0f));
+        const __m256i hasAf = _mm256_and_si256(_mm256_srli_epi32(h, 29), one);
+        // PUSI bit 14 -> 0, AF bit 29 -> 1, payload bit 28 -> 2
+        flags[g] = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(h, 14), one),
+                                                   _mm256_slli_epi32(hasAf, 1)),
+                                   _mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(h, 28), one), 2));
+        // 4, or 5 + adaptation_field_length
+        payload[g] = _mm256_add_epi32(_mm256_set1_epi32(4),
+                                      _mm256_and_si256(_mm256_cmpgt_epi32(hasAf, zero), _mm256_add_epi32(af, one)));
+    }
+    for (int g = 0; g < 8; g += 2) {
+        storeWords(block.pid + g * 8, pid[g], pid[g + 1]);
+        storeWords(block.payload + g * 8, payload[g], payload[g + 1]);
+    }
+    for (int g = 0; g < 8; g += 4) {
+        storeBytes(block.flags + g * 8, flags[g], flags[g + 1], flags[g + 2], flags[g + 3]);
+        storeBytes(block.cc + g * 8, cc[g], cc[g + 1], cc[g + 2], cc[g + 3]);
+    }
+    block.count = count;
+    block.synced = synced;
+    block.null = null;
+    block.tei = tei;
+    block.scrambled = scrambled;
+}
+#endif
+
+static BlockDecodeFunc selectDecodeFunc(const char** name) {
+#ifdef TS_BLOCK_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return decodeAvx2;
+    }
+#endif
+    *name = "scalar";
+    return decodeScalar;
+}
+
+static const char* gDecodeName = "scalar";
+static BlockDecodeFunc gDecodeFunc = selectDecodeFunc(&gDecodeName);
+
+void TsBlockDecoder::decode(const uint8_t* data, size_t stride, int count, TsPacketBlock& block) {
+    gDecodeFunc(data, stride, count, block);
+}
+
+const char* TsBlockDecoder::implName() {
+    return gDecodeName;
+}
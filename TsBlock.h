@@ -0,0 +1,64 @@
+/**
+ * File: TsBlock.h
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: TsPacketBlock, TS headers of a run of packets decoded at once
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _TS_BLOCK_H_
+#define _TS_BLOCK_H_
+
+#include <cstddef>
+#include <cstdint>
+using namespace std;
+
+// Packets per block, at most 64 (one bit each in the masks)
+#define TS_BLOCK_PACKETS 64
+
+#define TS_BLOCK_PUSI       0x01 // payload_unit_start_indicator
+#define TS_BLOCK_AF         0x02 // adaptation_field_control: adaptation field
+#define TS_BLOCK_PAYLOAD    0x04 // adaptation_field_control: payload
+
+/*
+ * The 4-byte headers of up to 64 packets laid out 'stride' bytes apart,
+ * decoded into one array per field. With AVX2 the headers, and the
+ * adaptation_field_length bytes, are fetched eight packets per gather and
+ * split with shifts and masks; packing the 32-bit lanes down to the arrays
+ * takes two or three instructions per 16 or 32 packets. Null, TEI and
+ * scrambled packets come out as bit masks, so the caller can drop them
+ * without looking at the packets again.
+ */
+struct TsPacketBlock {
+    int count = 0;
+    uint64_t synced = 0;        // bit i: packet i starts with 0x47
+    uint64_t null = 0;          // PID 0x1fff
+    uint64_t tei = 0;           // transport_error_indicator
+    uint64_t scrambled = 0;     // transport_scrambling_control != 0
+    uint16_t pid[TS_BLOCK_PACKETS];
+    uint16_t payload[TS_BLOCK_PACKETS]; // payload offset: 4, or past the adaptation field
+    uint8_t flags[TS_BLOCK_PACKETS];    // TS_BLOCK_*
+    uint8_t cc[TS_BLOCK_PACKETS];
+    // All 'count' packets are in sync
+    bool allSynced() const { return synced == (count == 64 ? ~0ULL : (1ULL << count) - 1); }
+};
+
+class TsBlockDecoder {
+    public:
+        // 'count' packets from 'data', 'stride' (188/192/204) bytes apart
+        static void decode(const uint8_t* data, size_t stride, int count, TsPacketBlock& block);
+        // "avx2" or "scalar", chosen once at startup
+        static const char* implName();
+};
+
+#endif /* _TS_BLOCK_H_ */
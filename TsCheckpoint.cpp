@@ -0,0 +1,112 @@
+/**
+ * File: TsCheckpoint.cpp
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: Implementation of TsCheckpointWriter and TsCheckpointReader
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "TsCheckpoint.h"
+#include "TsCrc.h"
+#include <cerrno>
+#include <cstdio>
+#include <ostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static bool writeAll(int fd, const void* data, size_t len) {
+    const uint8_t* p = (const uint8_t*)data;
+    while (len > 0) {
+        ssize_t n = ::write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+int TsCheckpointWriter::write(const string& path, TsCheckpointHeader& header, std::ostream* err) const {
+    memcpy(header.magic, TS_CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = TS_CHECKPOINT_VERSION;
+    header.bodyLength = mBody.size();
+    header.bodyCrc = tsCrc32(mBody.data(), mBody.size());
+    string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        *err << "Cannot create checkpoint " << tmp << std::endl;
+        return -1;
+    }
+    bool ok = writeAll(fd, &header, sizeof(header)) && writeAll(fd, mBody.data(), mBody.size());
+    ok = fsync(fd) == 0 && ok;
+    ok = ::close(fd) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        *err << "Cannot write checkpoint " << path << std::endl;
+        unlink(tmp.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+int TsCheckpointReader::open(const string& path, std::ostream* err) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    bool valid = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(mHeader) &&
+                 pread(fd, &mHeader, sizeof(mHeader), 0) == (ssize_t)sizeof(mHeader) &&
+                 memcmp(mHeader.magic, TS_CHECKPOINT_MAGIC, sizeof(mHeader.magic)) == 0 &&
+                 mHeader.version == TS_CHECKPOINT_VERSION &&
+                 mHeader.bodyLength == (uint64_t)st.st_size - sizeof(mHeader);
+    if (valid) {
+        mBody.resize(mHeader.bodyLength);
+        valid = pread(fd, mBody.data(), mBody.size(), sizeof(mHeader)) == (ssize_t)mBody.size() &&
+                tsCrc32(mBody.data(), mBody.size()) == mHeader.bodyCrc;
+    }
+    ::close(fd);
+    if (!valid) {
+        *err << "Ignoring damaged checkpoint " << path << std::endl;
+        mBody.clear();
+        return -2;
+    }
+    mPos = 0;
+    mFailed = false;
+    return 0;
+}
+
+bool TsCheckpointReader::getBytes(vector<uint8_t>& out) {
+    uint64_t len = 0;
+    if (!get(len) || mBody.size() - mPos < len) {
+        mFailed = true;
+        return false;
+    }
+    out.assign(mBody.data() + mPos, mBody.data() + mPos + len);
+    mPos += len;
+    return true;
+}
+
+bool TsCheckpointReader::getBytes(uint8_t* out, size_t capacity, size_t& len) {
+    uint64_t n = 0;
+    if (!get(n) || n > capacity) {
+        mFailed = true;
+        return false;
+    }
+    len = n;
+    return take(out, n);
+}
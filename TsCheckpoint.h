@@ -0,0 +1,101 @@
+/**
+ * File: TsCheckpoint.h
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: Checkpoint file of an interrupted parse, writer and reader
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _TS_CHECKPOINT_H_
+#define _TS_CHECKPOINT_H_
+
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+#define TS_CHECKPOINT_MAGIC     "TSCKPT\r\n"
+#define TS_CHECKPOINT_VERSION   1
+
+// --checkpoint-interval default, seconds
+#ifndef TS_CHECKPOINT_INTERVAL
+#define TS_CHECKPOINT_INTERVAL 30
+#endif
+
+/*
+ * File layout, native byte order: the header, then the body the parser put
+ * together with TsCheckpointWriter and reads back in the same order with
+ * TsCheckpointReader. The body is covered by a CRC, a checkpoint that does
+ * not match is ignored as a whole.
+ */
+struct TsCheckpointHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t packetSize;
+    uint64_t fileSize;          // input fingerprint, see TsIndex::fingerprint()
+    int64_t fileMtime;
+    uint64_t checksum;
+    uint64_t options;           // what the run writes, see TsParser::checkpointOptions()
+    uint64_t offset;            // input offset of the next packet to parse
+    uint64_t bodyLength;
+    uint32_t bodyCrc;           // tsCrc32() of the body
+    uint32_t reserved;
+};
+
+class TsCheckpointWriter {
+    public:
+        template <class T> void put(const T& value) { append(&value, sizeof(value)); }
+        // Length, then the bytes
+        void putBytes(const void* data, size_t len) {
+            put<uint64_t>(len);
+            append(data, len);
+        }
+        // Written aside, synced and renamed over 'path': a crash leaves
+        // either the previous checkpoint or this one
+        int write(const string& path, TsCheckpointHeader& header, std::ostream* err) const;
+    private:
+        void append(const void* data, size_t len) {
+            const uint8_t* p = (const uint8_t*)data;
+            mBody.insert(mBody.end(), p, p + len);
+        }
+        vector<uint8_t> mBody;
+};
+
+class TsCheckpointReader {
+    public:
+        // 0: read, -1: no checkpoint, -2: damaged (reported on 'err')
+        int open(const string& path, std::ostream* err);
+        const TsCheckpointHeader& header() const { return mHeader; }
+        // False once the body runs out, every later get fails as well
+        template <class T> bool get(T& value) { return take(&value, sizeof(value)); }
+        bool getBytes(vector<uint8_t>& out);
+        bool getBytes(uint8_t* out, size_t capacity, size_t& len);
+    private:
+        bool take(void* out, size_t len) {
+            if (mFailed || mBody.size() - mPos < len) {
+                mFailed = true;
+                return false;
+            }
+            memcpy(out, mBody.data() + mPos, len);
+            mPos += len;
+            return true;
+        }
+        TsCheckpointHeader mHeader = {};
+        vector<uint8_t> mBody;
+        size_t mPos = 0;
+        bool mFailed = false;
+};
+
+#endif /* _TS_CHECKPOINT_H_ */
@@ -0,0 +1,141 @@
+/**
+ * File: TsCrc.cpp
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: CRC32/MPEG-2 with slice-by-8 tables and PCLMULQDQ folding
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "TsCrc.h"
+#include <cstring>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define TS_CRC_X86 1
+#endif
+
+#define CRC_POLY 0x04c11db7
+
+typedef uint32_t (*CrcFunc)(uint32_t crc, const uint8_t* data, size_t len);
+
+// sTable[k][b]: CRC register after byte b followed by k zero bytes
+static uint32_t sTable[8][256];
+
+static void initTables() {
+    for (int b = 0; b < 256; b++) {
+        uint32_t crc = (uint32_t)b << 24;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ CRC_POLY : crc << 1;
+        }
+        sTable[0][b] = crc;
+    }
+    for (int k = 1; k < 8; k++) {
+        for (int b = 0; b < 256; b++) {
+            uint32_t prev = sTable[k - 1][b];
+            sTable[k][b] = (prev << 8) ^ sTable[0][prev >> 24];
+        }
+    }
+}
+
+static inline uint32_t load32be(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static uint32_t crcSlice8(uint32_t crc, const uint8_t* data, size_t len) {
+    while (len >= 8) {
+        uint32_t one = crc ^ load32be(data);
+        uint32_t two = load32be(data + 4);
+        crc = sTable[7][one >> 24] ^ sTable[6][(one >> 16) & 0xff] ^
+              sTable[5][(one >> 8) & 0xff] ^ sTable[4][one & 0xff] ^
+              sTable[3][two >> 24] ^ sTable[2][(two >> 16) & 0xff] ^
+              sTable[1][(two >> 8) & 0xff] ^ sTable[0][two & 0xff];
+        data += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = (crc << 8) ^ sTable[0][(crc >> 24) ^ *data++];
+    }
+    return crc;
+}
+
+#ifdef TS_CRC_X86
+// x^n mod P, the folding constants
+static uint64_t xPowMod(int n) {
+    uint32_t r = 1;
+    for (int i = 0; i < n; i++) {
+        r = (r & 0x80000000) ? (r << 1) ^ CRC_POLY : r << 1;
+    }
+    return r;
+}
+
+static uint64_t sFold128; // x^128 mod P
+static uint64_t sFold192; // x^192 mod P
+
+/*
+ * Loaded byte-reversed, a 16-byte block is a polynomial X = H*x^64 + L
+ * with bit i of the register the coefficient of x^i. Appending a block B
+ * gives X*x^128 + B = H*x^192 + L*x^128 + B, which is congruent modulo P
+ * to H*(x^192 mod P) + L*(x^128 mod P) + B: two carry-less multiplies per
+ * block and the value stays 128 bits wide. The last value (and the bytes
+ * that did not fill a block) are reduced with the tables.
+ */
+__attribute__((target("pclmul,ssse3")))
+static uint32_t crcPclmul(uint32_t crc, const uint8_t* data, size_t len) {
+    if (len < 32) {
+        return crcSlice8(crc, data, len);
+    }
+    const __m128i reverse = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i k = _mm_set_epi64x(sFold192, sFold128);
+    __m128i x = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), reverse);
+    // The running CRC goes into the top 32 bits of the first block
+    x = _mm_xor_si128(x, _mm_set_epi32(crc, 0, 0, 0));
+    data += 16;
+    len -= 16;
+    while (len >= 16) {
+        __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), reverse);
+        __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+        __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+        x = _mm_xor_si128(_mm_xor_si128(hi, lo), b);
+        data += 16;
+        len -= 16;
+    }
+    uint8_t block[16];
+    _mm_storeu_si128((__m128i*)block, _mm_shuffle_epi8(x, reverse));
+    return crcSlice8(crcSlice8(0, block, 16), data, len);
+}
+#endif
+
+static CrcFunc selectCrcFunc(const char** name) {
+    initTables();
+#ifdef TS_CRC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3")) {
+        sFold128 = xPowMod(128);
+        sFold192 = xPowMod(192);
+        *name = "pclmul";
+        return crcPclmul;
+    }
+#endif
+    *name = "slice-by-8";
+    return crcSlice8;
+}
+
+static const char* gCrcName = "slice-by-8";
+static CrcFunc gCrcFunc = selectCrcFunc(&gCrcName);
+
+uint32_t tsCrc32(const uint8_t* data, size_t len) {
+    return gCrcFunc(0xffffffff, data, len);
+}
+
+const char* tsCrcImplName() {
+    return gCrcName;
+}
@@ -0,0 +1,37 @@
+/**
+ * File: TsCrc.h
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: CRC32/MPEG-2 of PSI sections
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _TS_CRC_H_
+#define _TS_CRC_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32/MPEG-2: polynomial 0x04C11DB7, initial value 0xFFFFFFFF, MSB first,
+// no final XOR. A section followed by its CRC_32 field gives 0.
+uint32_t tsCrc32(const uint8_t* data, size_t len);
+
+// Sections with section_syntax_indicator set end in a CRC_32 field
+static inline bool tsSectionCrcValid(const uint8_t* section, size_t len) {
+    return !(section[1] & 0x80) || (len >= 4 && tsCrc32(section, len) == 0);
+}
+
+// "pclmul" or "slice-by-8", chosen once at startup
+const char* tsCrcImplName();
+
+#endif /* _TS_CRC_H_ */
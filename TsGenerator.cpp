@@ -0,0 +1,309 @@
+/**
+ * File: TsGenerator.cpp
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: Implementation of TsGenerator synthetic TS streams
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "TsGenerator.h"
+#include <cstring>
+#include <algorithm>
+
+#define GEN_TICKS_PER_PACKET    2030 // 27 MHz ticks of one packet at ~20 Mbit/s
+#define GEN_MAX_SECTION         1021 // section_length limit of PAT/PMT/SDT
+
+static uint32_t crc32Mpeg(const uint8_t* data, size_t len) {
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint32_t)data[i] << 24;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static void putTimestamp(vector<uint8_t>& out, int marker, uint64_t ts) {
+    out.push_back((marker << 4) | ((ts >> 29) & 0x0e) | 0x01);
+    out.push_back(ts >> 22);
+    out.push_back(((ts >> 14) & 0xfe) | 0x01);
+    out.push_back(ts >> 7);
+    out.push_back(((ts << 1) & 0xfe) | 0x01);
+}
+
+TsGenerator::TsGenerator(const TsGeneratorConfig& config)
+    : mConfig(config),
+      mRandom(config.seed ? config.seed : 1),
+      mPacketCount(0),
+      mPsiCount(0),
+      mClock(0) {
+    mConfig.programs = std::max(1, std::min(mConfig.programs, 200));
+    mConfig.pidsPerProgram = std::max(1, std::min(mConfig.pidsPerProgram, 7000 / mConfig.programs - 1));
+    mConfig.pesMin = std::max(1, mConfig.pesMin);
+    mConfig.pesMax = std::max(mConfig.pesMin, mConfig.pesMax);
+    mConfig.psiInterval = std::max(1, mConfig.psiInterval);
+    for (int p = 0; p < mConfig.programs; p++) {
+        for (int i = 0; i < mConfig.pidsPerProgram; i++) {
+            EsState es;
+            es.pid = esPid(p, i);
+            es.program = p;
+            es.video = i == 0;
+            es.cc = 0;
+            es.sent = 0;
+            es.pts = 90000;
+            es.units = 0;
+            mEs.push_back(es);
+            mEsPids.push_back(es.pid);
+        }
+    }
+    mPsiCc.assign(mConfig.programs + 2, 0);
+}
+
+uint32_t TsGenerator::random() {
+    // xorshift32: fast and the same on every platform
+    mRandom ^= mRandom << 13;
+    mRandom ^= mRandom >> 17;
+    mRandom ^= mRandom << 5;
+    return mRandom;
+}
+
+vector<uint8_t> TsGenerator::makeSection(int tableId, int extension, const vector<uint8_t>& body, int version) {
+    int section_length = 5 + body.size() + 4;
+    vector<uint8_t> s(8 + body.size());
+    s[0] = tableId;
+    s[1] = 0xb0 | (section_length >> 8);
+    s[2] = section_length;
+    s[3] = extension >> 8;
+    s[4] = extension;
+    s[5] = 0xc1 | ((version & 0x1f) << 1); // current
+    s[6] = 0x00;
+    s[7] = 0x00;
+    std::copy(body.begin(), body.end(), s.begin() + 8);
+    uint32_t crc = crc32Mpeg(s.data(), s.size());
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        s.push_back(crc >> shift);
+    }
+    return s;
+}
+
+void TsGenerator::putSection(vector<uint8_t>& out, int pid, const vector<uint8_t>& section) {
+    uint8_t& cc = pid == 0 ? mPsiCc[mConfig.programs] : pid == 0x11 ? mPsiCc[mConfig.programs + 1]
+                           : mPsiCc[(pid - pmtPid(0)) / (mConfig.pidsPerProgram + 1)];
+    size_t sent = 0;
+    while (sent < section.size() || sent == 0) {
+        uint8_t ts[188];
+        memset(ts, 0xff, sizeof(ts));
+        ts[0] = 0x47;
+        ts[1] = (sent == 0 ? 0x40 : 0x00) | (pid >> 8);
+        ts[2] = pid;
+        ts[3] = 0x10 | cc;
+        cc = (cc + 1) & 0x0f;
+        int pos = 4;
+        if (sent == 0) {
+            ts[pos++] = 0; // pointer_field
+        }
+        size_t n = std::min(section.size() - sent, (size_t)(188 - pos));
+        memcpy(ts + pos, section.data() + sent, n);
+        sent += n;
+        putPacket(out, ts);
+    }
+}
+
+void TsGenerator::putPsi(vector<uint8_t>& out) {
+    vector<uint8_t> body;
+    for (int p = 0; p < mConfig.programs; p++) {
+        int program_number = p + 1;
+        body.insert(body.end(), {(uint8_t)(program_number >> 8), (uint8_t)program_number,
+                                 (uint8_t)(0xe0 | (pmtPid(p) >> 8)), (uint8_t)pmtPid(p)});
+    }
+    putSection(out, 0x0000, makeSection(0x00, 1, body));
+    int version = mConfig.versionInterval > 0 ? mPsiCount / mConfig.versionInterval : 0;
+    mPsiCount++;
+
+    static const uint8_t other_types[] = {0x0f, 0x81, 0x03, 0x06};
+    for (int p = 0; p < mConfig.programs; p++) {
+        int pcr_pid = esPid(p, 0);
+        body = {(uint8_t)(0xe0 | (pcr_pid >> 8)), (uint8_t)pcr_pid, 0xf0, 0x00};
+        for (int i = 0; i < mConfig.pidsPerProgram; i++) {
+            uint8_t stream_type = i == 0 ? 0x1b : other_types[(i - 1) % sizeof(other_types)];
+            int pid = esPid(p, i);
+            if (body.size() + 5 + 9 > GEN_MAX_SECTION) {
+                break;
+            }
+            body.insert(body.end(), {stream_type, (uint8_t)(0xe0 | (pid >> 8)), (uint8_t)pid, 0xf0, 0x00});
+        }
+        putSection(out, pmtPid(p), makeSection(0x02, p + 1, body, version));
+    }
+
+    body = {0x00, 0x01, 0xff}; // original_network_id, reserved
+    for (int p = 0; p < mConfig.programs; p++) {
+        string provider = "Provider " + to_string(p + 1);
+        string name = "Service " + to_string(p + 1);
+        vector<uint8_t> desc = {0x48, (uint8_t)(3 + provider.size() + name.size()), 0x01, (uint8_t)provider.size()};
+        desc.insert(desc.end(), provider.begin(), provider.end());
+        desc.push_back(name.size());
+        desc.insert(desc.end(), name.begin(), name.end());
+        if (body.size() + 5 + desc.size() + 9 > GEN_MAX_SECTION) {
+            break;
+        }
+        int service_id = p + 1;
+        body.insert(body.end(), {(uint8_t)(service_id >> 8), (uint8_t)service_id, 0xfc,
+                                 (uint8_t)(0x80 | (desc.size() >> 8)), (uint8_t)desc.size()});
+        body.insert(body.end(), desc.begin(), desc.end());
+    }
+    putSection(out, 0x0011, makeSection(0x42, 1, body, version));
+}
+
+void TsGenerator::startUnit(EsState& es) {
+    int range = mConfig.pesMax - mConfig.pesMin + 1;
+    size_t payload = mConfig.pesMin + random() % range;
+    bool has_dts = es.video;
+    int header_data = has_dts ? 10 : 5;
+    if (!es.video) {
+        // Audio PES packets are always bounded
+        payload = std::min(payload, (size_t)(65535 - 3 - header_data));
+    }
+    size_t pes_packet_length = 3 + header_data + payload;
+    es.unit.clear();
+    es.unit.insert(es.unit.end(), {0x00, 0x00, 0x01, (uint8_t)(es.video ? 0xe0 : 0xc0)});
+    if (pes_packet_length > 65535) {
+        pes_packet_length = 0;
+    }
+    es.unit.push_back(pes_packet_length >> 8);
+    es.unit.push_back(pes_packet_length);
+    es.unit.push_back(0x80);
+    es.unit.push_back(has_dts ? 0xc0 : 0x80);
+    es.unit.push_back(header_data);
+    if (has_dts) {
+        putTimestamp(es.unit, 0x3, es.pts + 3600);
+        putTimestamp(es.unit, 0x1, es.pts);
+    } else {
+        putTimestamp(es.unit, 0x2, es.pts);
+    }
+    size_t start = es.unit.size();
+    es.unit.resize(start + payload);
+    for (size_t i = start; i < es.unit.size(); i += 4) {
+        uint32_t value = random();
+        memcpy(es.unit.data() + i, &value, std::min((size_t)4, es.unit.size() - i));
+    }
+    if (es.video && mConfig.gopLength > 0) {
+        putNalUnits(es, start);
+    }
+    es.units++;
+    es.sent = 0;
+    es.pts = (es.pts + (es.video ? 3600 : 1920)) & 0x1ffffffffULL;
+}
+
+// Overwrites the start of the video payload with the NAL units of an
+// access unit; the SEI length moves the slice start code around the packets
+void TsGenerator::putNalUnits(EsState& es, size_t start) {
+    static const uint8_t aud[] = {0x00, 0x00, 0x00, 0x01, 0x09, 0xf0};
+    static const uint8_t sps[] = {0x00, 0x00, 0x00, 0x01, 0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40, 0x78};
+    static const uint8_t pps[] = {0x00, 0x00, 0x00, 0x01, 0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0};
+    const bool idr = es.units % mConfig.gopLength == 0;
+    vector<uint8_t> nal(aud, aud + sizeof(aud));
+    if (idr) {
+        nal.insert(nal.end(), sps, sps + sizeof(sps));
+        nal.insert(nal.end(), pps, pps + sizeof(pps));
+    }
+    nal.insert(nal.end(), {0x00, 0x00, 0x01, 0x06});
+    nal.resize(nal.size() + random() % 400, 0xff);
+    nal.insert(nal.end(), {0x00, 0x00, 0x01, (uint8_t)(idr ? 0x65 : 0x41)});
+    if (nal.size() <= es.unit.size() - start) {
+        memcpy(es.unit.data() + start, nal.data(), nal.size());
+    }
+}
+
+void TsGenerator::putEsPacket(vector<uint8_t>& out, EsState& es) {
+    if (es.sent >= es.unit.size()) {
+        startUnit(es);
+    }
+    bool unit_start = es.sent == 0;
+    bool af = (random() % 10000) < mConfig.adaptationDensity * 10000;
+    bool pcr = af && es.video;
+    bool random_access = af && es.video && unit_start;
+    size_t remaining = es.unit.size() - es.sent;
+    int af_size = af ? 2 + (pcr ? 6 : 0) : 0;
+    if (remaining < (size_t)(184 - af_size)) {
+        af_size = 184 - remaining; // stuffing
+    }
+    uint8_t ts[188];
+    ts[0] = 0x47;
+    ts[1] = (unit_start ? 0x40 : 0x00) | (es.pid >> 8);
+    ts[2] = es.pid;
+    ts[3] = (af_size ? 0x30 : 0x10) | es.cc;
+    es.cc = (es.cc + 1) & 0x0f;
+    int pos = 4;
+    if (af_size) {
+        ts[pos] = af_size - 1;
+        if (af_size > 1) {
+            pcr = pcr && af_size >= 8;
+            ts[pos + 1] = (random_access ? 0x40 : 0) | (pcr ? 0x10 : 0);
+            memset(ts + pos + 2, 0xff, af_size - 2);
+            if (pcr) {
+                uint64_t base = mClock / 300;
+                uint64_t ext = mClock % 300;
+                ts[pos + 2] = base >> 25;
+                ts[pos + 3] = base >> 17;
+                ts[pos + 4] = base >> 9;
+                ts[pos + 5] = base >> 1;
+                ts[pos + 6] = ((base & 1) << 7) | 0x7e | (ext >> 8);
+                ts[pos + 7] = ext;
+            }
+        }
+        pos += af_size;
+    }
+    size_t n = 188 - pos;
+    memcpy(ts + pos, es.unit.data() + es.sent, n);
+    es.sent += n;
+    putPacket(out, ts);
+}
+
+void TsGenerator::putPacket(vector<uint8_t>& out, const uint8_t* ts) {
+    if (mConfig.syncLossInterval > 0 && mPacketCount > 0 && mPacketCount % mConfig.syncLossInterval == 0) {
+        int junk = 1 + random() % (mConfig.packetSize - 1);
+        for (int i = 0; i < junk; i++) {
+            uint8_t b = random();
+            out.push_back(b == 0x47 ? 0x46 : b);
+        }
+    }
+    if (mConfig.packetSize == 192) {
+        uint32_t stamp = mClock & 0x3fffffff;
+        out.insert(out.end(), {(uint8_t)(stamp >> 24), (uint8_t)(stamp >> 16), (uint8_t)(stamp >> 8), (uint8_t)stamp});
+    }
+    out.insert(out.end(), ts, ts + 188);
+    if (mConfig.packetSize == 204) {
+        out.insert(out.end(), 16, 0x00);
+    }
+    mPacketCount++;
+    mClock += GEN_TICKS_PER_PACKET;
+}
+
+void TsGenerator::generate(vector<uint8_t>& out) {
+    out.reserve(out.size() + mConfig.packets * (mConfig.packetSize + 1));
+    // Video gets four times the packets of each other ES
+    vector<int> slots;
+    for (int i = 0; i < (int)mEs.size(); i++) {
+        slots.insert(slots.end(), mEs[i].video ? 4 : 1, i);
+    }
+    uint64_t next_psi = 0;
+    while (mPacketCount < mConfig.packets) {
+        if (mPacketCount >= next_psi) {
+            putPsi(out);
+            next_psi = mPacketCount + mConfig.psiInterval;
+            continue;
+        }
+        putEsPacket(out, mEs[slots[random() % slots.size()]]);
+    }
+}
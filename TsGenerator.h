@@ -0,0 +1,88 @@
+/**
+ * File: TsGenerator.h
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: TsGenerator class definition, deterministic synthetic TS for benchmarks
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _TS_GENERATOR_H_
+#define _TS_GENERATOR_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+using namespace std;
+
+struct TsGeneratorConfig {
+    int programs = 2;
+    int pidsPerProgram = 2;         // ES PIDs per program, the first one is video
+    int psiInterval = 2000;         // packets between PAT/PMT/SDT repetitions
+    int versionInterval = 0;        // PMT/SDT version_number steps every N repetitions, 0: never
+    int pesMin = 2000;              // PES payload size range in bytes
+    int pesMax = 60000;
+    double adaptationDensity = 0.05; // share of ES packets carrying an adaptation field
+    int syncLossInterval = 0;       // junk bytes every N packets, 0: never
+    int gopLength = 25;             // video PES between IDR pictures, 0: video payload without NAL start codes
+    int packetSize = 188;           // 188, 192 (M2TS) or 204
+    uint64_t packets = 200000;
+    uint32_t seed = 1;
+};
+
+/*
+ * Builds a multi-program transport stream: PAT, one PMT per program and an
+ * SDT repeated every psiInterval packets, and ES PIDs interleaved packet by
+ * packet, each carrying PES packets with PTS (and DTS on video). A video
+ * PES is one H.264 access unit: AUD, SPS/PPS before an IDR, an SEI of random
+ * length and one slice NAL, the rest random bytes. The PCR is sent in the
+ * adaptation field of each program's video PID. The same config and seed
+ * always give the same bytes.
+ */
+class TsGenerator {
+    public:
+        TsGenerator(const TsGeneratorConfig& config);
+        void generate(vector<uint8_t>& out);
+        // ES PIDs in program order
+        const vector<int>& esPids() const { return mEsPids; }
+        int pmtPid(int program) const { return 0x100 + program * (mConfig.pidsPerProgram + 1); }
+        int esPid(int program, int index) const { return pmtPid(program) + 1 + index; }
+    private:
+        struct EsState {
+            int pid;
+            int program;
+            bool video;
+            uint8_t cc;
+            vector<uint8_t> unit;   // PES packet being sent
+            size_t sent;
+            uint64_t pts;
+            uint64_t units;         // PES packets started
+        };
+        uint32_t random();
+        void startUnit(EsState& es);
+        void putNalUnits(EsState& es, size_t start);
+        void putPsi(vector<uint8_t>& out);
+        void putSection(vector<uint8_t>& out, int pid, const vector<uint8_t>& section);
+        void putEsPacket(vector<uint8_t>& out, EsState& es);
+        void putPacket(vector<uint8_t>& out, const uint8_t* ts);
+        static vector<uint8_t> makeSection(int tableId, int extension, const vector<uint8_t>& body, int version = 0);
+        TsGeneratorConfig mConfig;
+        uint32_t mRandom;
+        vector<int> mEsPids;
+        vector<EsState> mEs;
+        vector<uint8_t> mPsiCc; // per program PMT, then PAT and SDT
+        uint64_t mPacketCount;
+        uint64_t mPsiCount;     // PSI repetitions sent
+        uint64_t mClock;        // 27 MHz, advances per packet
+};
+
+#endif /* _TS_GENERATOR_H_ */
@@ -0,0 +1,315 @@
+/**
+ * File: TsIndex.cpp
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: Implementation of the TsIndex sidecar index
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "TsIndex.h"
+#include <cstdio>
+#include <cstring>
+#include <ostream>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define FINGERPRINT_BYTES   (1 << 20)
+
+static size_t align8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+TsIndexBuilder::TsIndexBuilder()
+    : mUnwrap(8192, {UINT64_MAX, 0}) {
+}
+
+void TsIndexBuilder::addSection(int pid, const uint8_t* data, int len, uint64_t offset) {
+    // Tables repeat every few hundred ms, keep each version once
+    for (const auto& section : mSections) {
+        if (section.pid == pid && section.length == len &&
+            memcmp(mSectionData.data() + section.data, data, len) == 0) {
+            return;
+        }
+    }
+    TsIndexSection section = {};
+    section.offset = offset;
+    section.data = mSectionData.size();
+    section.pid = pid;
+    section.length = len;
+    mSections.push_back(section);
+    mSectionData.insert(mSectionData.end(), data, data + len);
+}
+
+void TsIndexBuilder::addPcr(int pid, uint64_t pcr, uint64_t offset) {
+    TsIndexPcr sample = {};
+    sample.offset = offset;
+    sample.pcr = pcr;
+    sample.pid = pid;
+    mPcr.push_back(sample);
+}
+
+void TsIndexBuilder::addPts(int pid, uint64_t offset, uint8_t flags, uint64_t pts, uint64_t dts) {
+    TsIndexPts entry = {};
+    entry.offset = offset;
+    entry.pts = pts;
+    entry.dts = dts;
+    entry.pid = pid;
+    entry.flags = flags;
+    uint64_t raw = (flags & TS_INDEX_DTS) ? dts : pts;
+    auto& unwrap = mUnwrap[pid];
+    if (unwrap.first != UINT64_MAX && raw + (1ULL << 32) < unwrap.first) {
+        unwrap.second += 1ULL << 33;
+    }
+    unwrap.first = raw;
+    entry.time = raw + unwrap.second;
+    mPts.push_back(entry);
+}
+
+int TsIndexBuilder::write(const string& path, const string& inputPath, int packetSize, std::ostream* err) {
+    TsIndexFingerprint fp;
+    if (TsIndex::fingerprint(inputPath, fp) != 0) {
+        return -1;
+    }
+    // Group entry positions by PID, each group keeps input order
+    vector<uint32_t> order(mPts.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return mPts[a].pid < mPts[b].pid;
+    });
+    vector<TsIndexPid> pids;
+    uint64_t base_time = UINT64_MAX;
+    for (size_t i = 0; i < order.size(); i++) {
+        const TsIndexPts& entry = mPts[order[i]];
+        if (pids.empty() || pids.back().pid != entry.pid) {
+            pids.push_back({entry.pid, 0, i});
+            base_time = std::min(base_time, entry.time);
+        }
+        pids.back().count++;
+    }
+
+    TsIndexHeader header = {};
+    memcpy(header.magic, TS_INDEX_MAGIC, sizeof(header.magic));
+    header.version = TS_INDEX_VERSION;
+    header.packetSize = packetSize;
+    header.fileSize = fp.size;
+    header.fileMtime = fp.mtime;
+    header.checksum = fp.checksum;
+    header.baseTime = base_time == UINT64_MAX ? 0 : base_time;
+    size_t pos = sizeof(header);
+    header.sectionCount = mSections.size();
+    header.sectionTable = pos;
+    pos += mSections.size() * sizeof(TsIndexSection);
+    size_t section_data = pos;
+    pos = align8(pos + mSectionData.size());
+    header.pcrCount = mPcr.size();
+    header.pcrTable = pos;
+    pos += mPcr.size() * sizeof(TsIndexPcr);
+    header.ptsCount = mPts.size();
+    header.ptsTable = pos;
+    pos += mPts.size() * sizeof(TsIndexPts);
+    header.pidCount = pids.size();
+    header.pidTable = pos;
+    pos += pids.size() * sizeof(TsIndexPid);
+    header.pidEntries = pos;
+    pos += order.size() * sizeof(uint32_t);
+
+    vector<uint8_t> out(pos, 0);
+    vector<TsIndexSection> sections = mSections;
+    for (auto& section : sections) {
+        section.data += section_data;
+    }
+    memcpy(out.data(), &header, sizeof(header));
+    memcpy(out.data() + header.sectionTable, sections.data(), sections.size() * sizeof(TsIndexSection));
+    memcpy(out.data() + section_data, mSectionData.data(), mSectionData.size());
+    memcpy(out.data() + header.pcrTable, mPcr.data(), mPcr.size() * sizeof(TsIndexPcr));
+    memcpy(out.data() + header.ptsTable, mPts.data(), mPts.size() * sizeof(TsIndexPts));
+    memcpy(out.data() + header.pidTable, pids.data(), pids.size() * sizeof(TsIndexPid));
+    memcpy(out.data() + header.pidEntries, order.data(), order.size() * sizeof(uint32_t));
+
+    // Write aside and rename, a reader never sees half an index
+    string tmp = path + ".tmp";
+    FILE* fp_out = fopen(tmp.c_str(), "wb");
+    if (!fp_out) {
+        *err << "Cannot create index " << tmp << std::endl;
+        return -1;
+    }
+    bool ok = fwrite(out.data(), 1, out.size(), fp_out) == out.size();
+    ok = fclose(fp_out) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        *err << "Cannot write index " << path << std::endl;
+        unlink(tmp.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+TsIndex::TsIndex()
+    : mData(nullptr),
+      mSize(0),
+      mHeader(nullptr) {
+}
+
+TsIndex::~TsIndex() {
+    close();
+}
+
+int TsIndex::fingerprint(const string& path, TsIndexFingerprint& fp) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return -1;
+    }
+    fp.size = st.st_size;
+    fp.mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    // FNV-1a over the head and the tail: cheap enough to check on every run
+    vector<uint8_t> buf(FINGERPRINT_BYTES);
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    uint64_t offsets[2] = {0, fp.size > FINGERPRINT_BYTES ? fp.size - FINGERPRINT_BYTES : 0};
+    for (int i = 0; i < (fp.size > FINGERPRINT_BYTES ? 2 : 1); i++) {
+        ssize_t n = pread(fd, buf.data(), buf.size(), offsets[i]);
+        for (ssize_t j = 0; j < n; j++) {
+            hash = (hash ^ buf[j]) * 0x100000001b3ULL;
+        }
+    }
+    ::close(fd);
+    fp.checksum = hash ^ fp.size;
+    return 0;
+}
+
+int TsIndex::open(const string& path, const string& inputPath, std::ostream* err) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(TsIndexHeader)) {
+        ::close(fd);
+        return -1;
+    }
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    mData = (const uint8_t*)map;
+    mSize = st.st_size;
+    mHeader = (const TsIndexHeader*)mData;
+    const TsIndexHeader& h = *mHeader;
+    if (!validate()) {
+        *err << "Ignoring damaged index " << path << std::endl;
+        close();
+        return -1;
+    }
+    TsIndexFingerprint fp;
+    if (fingerprint(inputPath, fp) != 0 || fp.size != h.fileSize ||
+        fp.mtime != h.fileMtime || fp.checksum != h.checksum) {
+        *err << "Ignoring stale index " << path << std::endl;
+        close();
+        return -1;
+    }
+    return 0;
+}
+
+// 'count' records of 'size' bytes at 'offset', aligned and inside the map
+bool TsIndex::fits(uint64_t offset, uint64_t count, size_t size) const {
+    return offset % 8 == 0 && offset <= mSize && count <= (mSize - offset) / size;
+}
+
+// Every table, list and section must lie inside the file: a truncated or
+// damaged index is refused here, the readers below trust it
+bool TsIndex::validate() const {
+    const TsIndexHeader& h = *mHeader;
+    if (memcmp(h.magic, TS_INDEX_MAGIC, sizeof(h.magic)) != 0 || h.version != TS_INDEX_VERSION ||
+        !fits(h.sectionTable, h.sectionCount, sizeof(TsIndexSection)) ||
+        !fits(h.pcrTable, h.pcrCount, sizeof(TsIndexPcr)) ||
+        !fits(h.ptsTable, h.ptsCount, sizeof(TsIndexPts)) ||
+        !fits(h.pidTable, h.pidCount, sizeof(TsIndexPid)) ||
+        !fits(h.pidEntries, h.ptsCount, sizeof(uint32_t))) {
+        return false;
+    }
+    const TsIndexSection* sections = this->sections();
+    for (uint64_t i = 0; i < h.sectionCount; i++) {
+        const TsIndexSection& section = sections[i];
+        if (section.pid >= 8192 || section.length < 3 || section.data > mSize ||
+            section.length > mSize - section.data) {
+            return false;
+        }
+    }
+    const TsIndexPts* pts = entries();
+    for (uint64_t i = 0; i < h.ptsCount; i++) {
+        if (pts[i].pid >= 8192) {
+            return false;
+        }
+    }
+    const TsIndexPid* pids = (const TsIndexPid*)(mData + h.pidTable);
+    uint64_t listed = 0;
+    for (uint64_t i = 0; i < h.pidCount; i++) {
+        if (pids[i].pid >= 8192 || (i > 0 && pids[i].pid <= pids[i - 1].pid) ||
+            pids[i].first > h.ptsCount || pids[i].count > h.ptsCount - pids[i].first) {
+            return false;
+        }
+        listed += pids[i].count;
+    }
+    const uint32_t* positions = (const uint32_t*)(mData + h.pidEntries);
+    for (uint64_t i = 0; i < h.ptsCount; i++) {
+        if (positions[i] >= h.ptsCount) {
+            return false;
+        }
+    }
+    return listed <= h.ptsCount;
+}
+
+void TsIndex::close() {
+    if (mData) {
+        munmap((void*)mData, mSize);
+    }
+    mData = nullptr;
+    mSize = 0;
+    mHeader = nullptr;
+}
+
+const uint32_t* TsIndex::pidEntries(int pid, uint64_t& count) const {
+    const TsIndexPid* pids = (const TsIndexPid*)(mData + mHeader->pidTable);
+    const TsIndexPid* end = pids + mHeader->pidCount;
+    const TsIndexPid* it = std::lower_bound(pids, end, (uint32_t)pid, [](const TsIndexPid& p, uint32_t value) {
+        return p.pid < value;
+    });
+    if (it == end || it->pid != (uint32_t)pid) {
+        count = 0;
+        return nullptr;
+    }
+    count = it->count;
+    return (const uint32_t*)(mData + mHeader->pidEntries) + it->first;
+}
+
+uint64_t TsIndex::lowerBound(int pid, uint64_t time) const {
+    uint64_t count = 0;
+    const uint32_t* list = pidEntries(pid, count);
+    if (!list) {
+        return 0;
+    }
+    const TsIndexPts* all = entries();
+    return std::lower_bound(list, list + count, time, [all](uint32_t pos, uint64_t value) {
+        return all[pos].time < value;
+    }) - list;
+}
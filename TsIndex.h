@@ -0,0 +1,146 @@
+/**
+ * File: TsIndex.h
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: TsIndex class definition, sidecar index (.tsidx) of a TS file
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _TS_INDEX_H_
+#define _TS_INDEX_H_
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+#define TS_INDEX_MAGIC      "TSIDX\r\n\x1a"
+#define TS_INDEX_VERSION    1
+#define TS_INDEX_SUFFIX     ".tsidx"
+
+#define TS_INDEX_PTS        0x01
+#define TS_INDEX_DTS        0x02
+#define TS_INDEX_KEYFRAME   0x04 // random_access_indicator on the unit start
+
+/*
+ * File layout, native byte order, every table 8-byte aligned:
+ *   TsIndexHeader
+ *   TsIndexSection[sectionCount] followed by the section bytes
+ *   TsIndexPcr[pcrCount]
+ *   TsIndexPts[ptsCount]         in input order
+ *   TsIndexPid[pidCount]         sorted by PID
+ *   uint32_t[ptsCount]           TsIndexPts positions grouped by PID
+ */
+struct TsIndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t packetSize;
+    uint64_t fileSize;
+    int64_t fileMtime;
+    uint64_t checksum;          // see TsIndex::fingerprint()
+    uint64_t baseTime;          // first timestamp, --from/--to count from here
+    uint64_t sectionCount;
+    uint64_t sectionTable;      // file offsets of the tables below
+    uint64_t pcrCount;
+    uint64_t pcrTable;
+    uint64_t ptsCount;
+    uint64_t ptsTable;
+    uint64_t pidCount;
+    uint64_t pidTable;
+    uint64_t pidEntries;
+};
+
+struct TsIndexSection {
+    uint64_t offset;            // input offset of the packet completing it
+    uint32_t data;              // file offset of the section bytes
+    uint16_t pid;
+    uint16_t length;
+};
+
+struct TsIndexPcr {
+    uint64_t offset;
+    uint64_t pcr;               // 27 MHz
+    uint32_t pid;
+    uint32_t reserved;
+};
+
+struct TsIndexPts {
+    uint64_t offset;            // input offset of the PES packet start
+    uint64_t pts;
+    uint64_t dts;
+    uint64_t time;              // DTS (else PTS), unwrapped past 2^33, 90 kHz
+    uint16_t pid;
+    uint8_t flags;
+    uint8_t reserved[5];
+};
+
+struct TsIndexPid {
+    uint32_t pid;
+    uint32_t count;
+    uint64_t first;             // position in the per-PID entry list
+};
+
+struct TsIndexFingerprint {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t checksum = 0;
+};
+
+// Collects index records during a parse and writes the sidecar file
+class TsIndexBuilder {
+    public:
+        TsIndexBuilder();
+        void addSection(int pid, const uint8_t* data, int len, uint64_t offset);
+        void addPcr(int pid, uint64_t pcr, uint64_t offset);
+        void addPts(int pid, uint64_t offset, uint8_t flags, uint64_t pts, uint64_t dts);
+        int write(const string& path, const string& inputPath, int packetSize, std::ostream* err);
+        uint64_t entries() const { return mPts.size(); }
+    private:
+        vector<TsIndexSection> mSections;
+        vector<uint8_t> mSectionData;
+        vector<TsIndexPcr> mPcr;
+        vector<TsIndexPts> mPts;
+        vector<pair<uint64_t, uint64_t>> mUnwrap; // per PID: last raw time, wrap offset
+};
+
+// A memory-mapped sidecar index
+class TsIndex {
+    public:
+        TsIndex();
+        ~TsIndex();
+        // Fails (returns -1) if the file is missing, damaged or stale; why
+        // goes to 'err'
+        int open(const string& path, const string& inputPath, std::ostream* err);
+        void close();
+        const TsIndexHeader& header() const { return *mHeader; }
+        const TsIndexSection* sections() const { return (const TsIndexSection*)(mData + mHeader->sectionTable); }
+        const uint8_t* sectionData(const TsIndexSection& section) const { return mData + section.data; }
+        const TsIndexPcr* pcrs() const { return (const TsIndexPcr*)(mData + mHeader->pcrTable); }
+        const TsIndexPts* entries() const { return (const TsIndexPts*)(mData + mHeader->ptsTable); }
+        // Entries of one PID, in input order
+        const uint32_t* pidEntries(int pid, uint64_t& count) const;
+        // First entry of 'pid' with time >= 'time' (count if none)
+        uint64_t lowerBound(int pid, uint64_t time) const;
+        // Size, mtime and FNV-1a of the first and last MB of the input
+        static int fingerprint(const string& path, TsIndexFingerprint& fp);
+        static string pathFor(const string& inputPath) { return inputPath + TS_INDEX_SUFFIX; }
+    private:
+        bool fits(uint64_t offset, uint64_t count, size_t size) const;
+        bool validate() const;
+        const uint8_t* mData;
+        size_t mSize;
+        const TsIndexHeader* mHeader;
+};
+
+#endif /* _TS_INDEX_H_ */
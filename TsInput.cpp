@@ -0,0 +1,791 @@
+/**
+ * File: TsInput.cpp
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: Implementation of TsInput byte sources (mmap and stdio)
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "TsInput.h"
+#include <iostream>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <chrono>
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#if defined(__linux__) && !defined(TS_NO_URING) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define TS_HAVE_URING 1
+#endif
+
+#define UDP_BATCH           64
+#define UDP_SLOT_SIZE       2048 // > 7 * 188 + RTP header
+
+volatile sig_atomic_t TsInput::sStop = 0;
+
+TsInput::TsInput()
+    : mBase(nullptr),
+      mCur(nullptr),
+      mEnd(nullptr),
+      mBaseOffset(0) {
+}
+
+TsInput::~TsInput() {
+}
+
+TsInput* TsInput::create(const string& path, const TsInputConfig& config) {
+    if (path.compare(0, 6, "udp://") == 0 || path.compare(0, 6, "rtp://") == 0) {
+        TsInput* input = new TsUdpInput(config);
+        if (input->open(path) == 0) {
+            return input;
+        }
+        delete input;
+        return nullptr;
+    }
+    if (config.uringDepth > 0 && path != "-") {
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && (S_ISREG(st.st_mode) || S_ISBLK(st.st_mode))) {
+            TsInput* input = new TsUringInput(config);
+            if (input->open(path) == 0) {
+                return input;
+            }
+            // No io_uring here: the buffered reader does the same job
+            delete input;
+            TsInput* fallback = new TsStdioInput();
+            if (fallback->open(path) == 0) {
+                return fallback;
+            }
+            delete fallback;
+            return nullptr;
+        }
+    }
+    if (config.allowMmap && path != "-") {
+        struct stat st;
+        if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            TsInput* input = new TsMmapInput();
+            if (input->open(path) == 0) {
+                return input;
+            }
+            delete input;
+        }
+    }
+    TsInput* input = new TsStdioInput();
+    if (input->open(path) == 0) {
+        return input;
+    }
+    delete input;
+    return nullptr;
+}
+
+uint64_t TsInput::nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void TsInput::noteArrival(uint64_t endOffset, uint64_t ns) {
+    mArrivals.emplace_back(endOffset, ns);
+}
+
+uint64_t TsInput::arrivalNs(uint64_t offset) {
+    while (!mArrivals.empty() && mArrivals.front().first <= offset) {
+        mArrivals.pop_front();
+    }
+    return mArrivals.empty() ? 0 : mArrivals.front().second;
+}
+
+TsMmapInput::TsMmapInput()
+    : mFd(-1),
+      mMap(MAP_FAILED),
+      mMapSize(0) {
+}
+
+TsMmapInput::~TsMmapInput() {
+    close();
+}
+
+int TsMmapInput::open(const string& path) {
+    mFd = ::open(path.c_str(), O_RDONLY);
+    if (mFd < 0) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(mFd, &st) != 0 || st.st_size <= 0) {
+        close();
+        return -1;
+    }
+    mMapSize = st.st_size;
+    mMap = mmap(nullptr, mMapSize, PROT_READ, MAP_PRIVATE, mFd, 0);
+    if (mMap == MAP_FAILED) {
+        close();
+        return -1;
+    }
+    // Hints only, failures are harmless
+    madvise(mMap, mMapSize, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(mMap, mMapSize, MADV_HUGEPAGE);
+#endif
+    mBase = (const uint8_t*)mMap;
+    mCur = mBase;
+    mEnd = mBase + mMapSize;
+    mBaseOffset = 0;
+    return 0;
+}
+
+void TsMmapInput::close() {
+    if (mMap != MAP_FAILED) {
+        munmap(mMap, mMapSize);
+        mMap = MAP_FAILED;
+    }
+    if (mFd >= 0) {
+        ::close(mFd);
+        mFd = -1;
+    }
+    mBase = mCur = mEnd = nullptr;
+    mMapSize = 0;
+}
+
+size_t TsMmapInput::fill(size_t) {
+    return mEnd - mCur;
+}
+
+TsStdioInput::TsStdioInput(size_t bufferSize)
+    : mFd(-1),
+      mOwnFd(false),
+      mEof(false),
+      mLive(false),
+      mBuffer(bufferSize) {
+}
+
+TsStdioInput::~TsStdioInput() {
+    close();
+}
+
+int TsStdioInput::open(const string& path) {
+    if (path == "-") {
+        mFd = STDIN_FILENO;
+        mOwnFd = false;
+    } else {
+        mFd = ::open(path.c_str(), O_RDONLY);
+        mOwnFd = true;
+    }
+    if (mFd < 0) {
+        return -1;
+    }
+    struct stat st;
+    mLive = fstat(mFd, &st) == 0 && !S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode);
+    mBase = mBuffer.data();
+    mCur = mEnd = mBase;
+    mBaseOffset = 0;
+    mEof = false;
+    return 0;
+}
+
+void TsStdioInput::close() {
+    if (mFd >= 0 && mOwnFd) {
+        ::close(mFd);
+    }
+    mFd = -1;
+    mBase = mCur = mEnd = nullptr;
+}
+
+size_t TsStdioInput::fill(size_t want) {
+    size_t remain = mEnd - mCur;
+    if (remain >= want || mEof || mFd < 0) {
+        return remain;
+    }
+    if (want > mBuffer.size()) {
+        want = mBuffer.size();
+    }
+    // Move the unconsumed tail to the front and top the buffer up
+    uint8_t* buf = mBuffer.data();
+    mBaseOffset += mCur - mBase;
+    memmove(buf, mCur, remain);
+    mBase = buf;
+    mCur = buf;
+    mEnd = buf + remain;
+    while ((size_t)(mEnd - mCur) < want && !mEof) {
+        if (mLive && (size_t)(mEnd - mCur) >= LIVE_MIN_FILL) {
+            break;
+        }
+        ssize_t n = read(mFd, buf + (mEnd - mBase), mBuffer.size() - (mEnd - mBase));
+        if (n < 0 && errno == EINTR && !sStop) {
+            continue;
+        }
+        if (n <= 0) {
+            mEof = true;
+            break;
+        }
+        mEnd += n;
+        if (mLive) {
+            noteArrival(offset() + (mEnd - mCur), nowNs());
+        }
+    }
+    return mEnd - mCur;
+}
+
+#ifdef TS_HAVE_URING
+// The two rings and the SQE array, mapped from the ring fd
+struct TsUringRing {
+    int fd = -1;
+    void* sqMap = MAP_FAILED;
+    size_t sqMapSize = 0;
+    void* cqMap = MAP_FAILED;
+    size_t cqMapSize = 0;
+    struct io_uring_sqe* sqes = (struct io_uring_sqe*)MAP_FAILED;
+    size_t sqesSize = 0;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+};
+#else
+struct TsUringRing {};
+#endif
+
+TsUringInput::TsUringInput(const TsInputConfig& config)
+    : mConfig(config),
+      mFd(-1),
+      mDepth(std::max(1, std::min(config.uringDepth, TS_URING_MAX_DEPTH))),
+      mRing(nullptr),
+      mArena((uint8_t*)MAP_FAILED),
+      mArenaSize(0),
+      mFixed(false),
+      mDirect(false),
+      mSubmitSlot(0),
+      mReadOffset(0),
+      mReadEnd(false),
+      mLast(-1),
+      mPending(0),
+      mEof(false) {
+}
+
+TsUringInput::~TsUringInput() {
+    close();
+}
+
+#ifdef TS_HAVE_URING
+int TsUringInput::setupRing() {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int)syscall(__NR_io_uring_setup, mDepth, &params);
+    if (fd < 0) {
+        return -1;
+    }
+    mRing = new TsUringRing();
+    TsUringRing& r = *mRing;
+    r.fd = fd;
+    r.sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    r.cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        r.sqMapSize = r.cqMapSize = std::max(r.sqMapSize, r.cqMapSize);
+    }
+    r.sqMap = mmap(nullptr, r.sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (r.sqMap == MAP_FAILED) {
+        return -1;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        r.cqMap = r.sqMap;
+    } else {
+        r.cqMap = mmap(nullptr, r.cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (r.cqMap == MAP_FAILED) {
+            return -1;
+        }
+    }
+    r.sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    r.sqes = (struct io_uring_sqe*)mmap(nullptr, r.sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (r.sqes == MAP_FAILED) {
+        return -1;
+    }
+    uint8_t* sq = (uint8_t*)r.sqMap;
+    r.sqHead = (unsigned*)(sq + params.sq_off.head);
+    r.sqTail = (unsigned*)(sq + params.sq_off.tail);
+    r.sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    r.sqArray = (unsigned*)(sq + params.sq_off.array);
+    uint8_t* cq = (uint8_t*)r.cqMap;
+    r.cqHead = (unsigned*)(cq + params.cq_off.head);
+    r.cqTail = (unsigned*)(cq + params.cq_off.tail);
+    r.cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    r.cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return 0;
+}
+#else
+int TsUringInput::setupRing() {
+    errno = ENOSYS;
+    return -1;
+}
+#endif
+
+int TsUringInput::open(const string& path) {
+    if (setupRing() != 0) {
+        std::cerr << "io_uring is not available (" << strerror(errno) << "), reading with stdio" << std::endl;
+        close();
+        return -1;
+    }
+    if (mConfig.directIo) {
+        mFd = ::open(path.c_str(), O_RDONLY | O_DIRECT);
+        mDirect = mFd >= 0;
+        if (mFd < 0) {
+            std::cerr << "O_DIRECT refused for " << path << " (" << strerror(errno) << "), reading through the page cache" << std::endl;
+        }
+    }
+    if (mFd < 0) {
+        mFd = ::open(path.c_str(), O_RDONLY);
+    }
+    if (mFd < 0) {
+        close();
+        return -1;
+    }
+    if (!mDirect) {
+        posix_fadvise(mFd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    // Page aligned, as O_DIRECT wants it
+    mArenaSize = (size_t)mDepth * (TS_URING_PAD + TS_URING_BLOCK);
+    mArena = (uint8_t*)mmap(nullptr, mArenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mArena == MAP_FAILED) {
+        close();
+        return -1;
+    }
+    mSlots.assign(mDepth, Slot());
+    mIov.resize(mDepth);
+    for (int i = 0; i < mDepth; i++) {
+        mIov[i].iov_base = slotData(i);
+        mIov[i].iov_len = TS_URING_BLOCK;
+    }
+#ifdef TS_HAVE_URING
+    // Pinned pages count against RLIMIT_MEMLOCK, without them plain reads do
+    struct iovec whole = {mArena, mArenaSize};
+    mFixed = syscall(__NR_io_uring_register, mRing->fd, IORING_REGISTER_BUFFERS, &whole, 1) == 0;
+#endif
+    mBase = mCur = mEnd = slotData(0);
+    mBaseOffset = 0;
+    mSubmitSlot = 0;
+    mReadOffset = 0;
+    mReadEnd = false;
+    mLast = -1;
+    mEof = false;
+    recycle();
+    enter(0);
+    return 0;
+}
+
+void TsUringInput::close() {
+#ifdef TS_HAVE_URING
+    if (mRing) {
+        // The kernel may still be writing into the blocks
+        for (int i = 0; i < (int)mSlots.size(); i++) {
+            while (mSlots[i].state == SLOT_READING && enter(1) == 0) {
+                reap();
+            }
+        }
+        TsUringRing& r = *mRing;
+        if (r.sqes != MAP_FAILED) {
+            munmap(r.sqes, r.sqesSize);
+        }
+        if (r.cqMap != MAP_FAILED && r.cqMap != r.sqMap) {
+            munmap(r.cqMap, r.cqMapSize);
+        }
+        if (r.sqMap != MAP_FAILED) {
+            munmap(r.sqMap, r.sqMapSize);
+        }
+        if (r.fd >= 0) {
+            ::close(r.fd);
+        }
+    }
+#endif
+    delete mRing;
+    mRing = nullptr;
+    if (mArena != MAP_FAILED) {
+        munmap(mArena, mArenaSize);
+        mArena = (uint8_t*)MAP_FAILED;
+    }
+    if (mFd >= 0) {
+        ::close(mFd);
+        mFd = -1;
+    }
+    mSlots.clear();
+    mBase = mCur = mEnd = nullptr;
+}
+
+#ifdef TS_HAVE_URING
+void TsUringInput::queueRead(int slot) {
+    TsUringRing& r = *mRing;
+    Slot& s = mSlots[slot];
+    unsigned tail = *r.sqTail;
+    unsigned index = tail & *r.sqMask;
+    struct io_uring_sqe* sqe = &r.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->fd = mFd;
+    sqe->off = s.fileOffset + s.len;
+    if (mFixed) {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->addr = (uint64_t)(uintptr_t)(slotData(slot) + s.len);
+        sqe->len = TS_URING_BLOCK - s.len;
+        sqe->buf_index = 0;
+    } else {
+        // IORING_OP_READV, unlike IORING_OP_READ, is in every io_uring kernel
+        mIov[slot].iov_base = slotData(slot) + s.len;
+        mIov[slot].iov_len = TS_URING_BLOCK - s.len;
+        sqe->opcode = IORING_OP_READV;
+        sqe->addr = (uint64_t)(uintptr_t)&mIov[slot];
+        sqe->len = 1;
+    }
+    sqe->user_data = slot;
+    r.sqArray[index] = index;
+    __atomic_store_n(r.sqTail, tail + 1, __ATOMIC_RELEASE);
+    s.state = SLOT_READING;
+    mPending++;
+}
+
+// Submits what is queued; with 'minComplete', waits for that many completions
+int TsUringInput::enter(unsigned minComplete) {
+    for (;;) {
+        int ret = (int)syscall(__NR_io_uring_enter, mRing->fd, mPending, minComplete,
+                               minComplete ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        if (ret >= 0) {
+            mPending -= std::min((unsigned)ret, mPending);
+            if (mPending == 0 || minComplete) {
+                return 0;
+            }
+            continue;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            return -1;
+        }
+        if (errno == EINTR && sStop) {
+            return -1;
+        }
+    }
+}
+
+void TsUringInput::reap() {
+    TsUringRing& r = *mRing;
+    unsigned head = *r.cqHead;
+    unsigned tail = __atomic_load_n(r.cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        const struct io_uring_cqe& cqe = r.cqes[head & *r.cqMask];
+        int slot = (int)cqe.user_data;
+        Slot& s = mSlots[slot];
+        if (cqe.res == -EINVAL && mDirect) {
+            // The file system takes O_DIRECT at open() but not for reads
+            std::cerr << "O_DIRECT reads refused, reading through the page cache" << std::endl;
+            fcntl(mFd, F_SETFL, fcntl(mFd, F_GETFL) & ~O_DIRECT);
+            mDirect = false;
+            queueRead(slot);
+            continue;
+        }
+        if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+            queueRead(slot);
+            continue;
+        }
+        if (cqe.res < 0) {
+            std::cerr << "io_uring read at offset " << s.fileOffset + s.len << " failed: " << strerror(-cqe.res) << std::endl;
+        } else {
+            s.len += cqe.res;
+            if (cqe.res > 0 && s.len < TS_URING_BLOCK && !mDirect) {
+                // Short, not necessarily the end: read the rest of the block
+                queueRead(slot);
+                continue;
+            }
+        }
+        s.state = SLOT_READY;
+        if (s.len < TS_URING_BLOCK) {
+            mReadEnd = true;
+        }
+    }
+    __atomic_store_n(r.cqHead, head, __ATOMIC_RELEASE);
+}
+#else
+void TsUringInput::queueRead(int) {
+}
+
+int TsUringInput::enter(unsigned) {
+    return -1;
+}
+
+void TsUringInput::reap() {
+}
+#endif
+
+// Reads into the free blocks, in file order. All blocks but the window's are
+// reading or ready, so the one freed is always the next in turn.
+void TsUringInput::recycle() {
+    while (!mReadEnd && mSlots[mSubmitSlot].state == SLOT_FREE) {
+        Slot& s = mSlots[mSubmitSlot];
+        s.fileOffset = mReadOffset;
+        s.len = 0;
+        queueRead(mSubmitSlot);
+        mReadOffset += TS_URING_BLOCK;
+        mSubmitSlot = (mSubmitSlot + 1) % mDepth;
+    }
+}
+
+bool TsUringInput::waitSlot(int slot) {
+    while (mSlots[slot].state == SLOT_READING) {
+        reap();
+        if (mSlots[slot].state != SLOT_READING) {
+            break;
+        }
+        if (enter(1) != 0) {
+            return false;
+        }
+    }
+    return mSlots[slot].state == SLOT_READY;
+}
+
+size_t TsUringInput::fill(size_t want) {
+    size_t remain = mEnd - mCur;
+    if (remain >= want || mEof || mFd < 0) {
+        return remain;
+    }
+    want = std::min(want, (size_t)TS_URING_PAD);
+    mBaseOffset += mCur - mBase;
+    mBase = mCur;
+    reap();
+    while (remain < want) {
+        if (mLast >= 0 && mSlots[mLast].len < TS_URING_BLOCK) {
+            mEof = true; // the window's block was the last one
+            break;
+        }
+        // The rest of the window moves to the pad in front of the next
+        // block, its own block is free to be read into again
+        int next = (mLast + 1) % mDepth;
+        uint8_t* pad = slotData(next) - remain;
+        memmove(pad, mCur, remain);
+        mBase = mCur = pad;
+        mEnd = slotData(next);
+        if (mLast >= 0) {
+            mSlots[mLast].state = SLOT_FREE;
+        }
+        recycle();
+        if (!waitSlot(next) || mSlots[next].len == 0) {
+            mEof = true;
+            break;
+        }
+        mEnd += mSlots[next].len;
+        remain = mEnd - mCur;
+        mLast = next;
+    }
+    if (mPending > 0) {
+        enter(0);
+    }
+    return remain;
+}
+
+TsUdpInput::TsUdpInput(const TsInputConfig& config)
+    : mConfig(config),
+      mFd(-1),
+      mRtp(false),
+      mEof(false),
+      mDatagrams(0),
+      mLastDataNs(0),
+      mBuffer(4 << 20),
+      mSlots(UDP_BATCH * UDP_SLOT_SIZE) {
+}
+
+TsUdpInput::~TsUdpInput() {
+    close();
+}
+
+int TsUdpInput::open(const string& path) {
+    // udp://[@][host]:port[?localaddr=ip]
+    mRtp = path.compare(0, 6, "rtp://") == 0;
+    string spec = path.substr(6);
+    string local_addr;
+    size_t query = spec.find('?');
+    if (query != string::npos) {
+        string options = spec.substr(query + 1);
+        spec = spec.substr(0, query);
+        if (options.compare(0, 10, "localaddr=") == 0) {
+            local_addr = options.substr(10);
+        }
+    }
+    if (!spec.empty() && spec[0] == '@') {
+        spec = spec.substr(1);
+    }
+    size_t colon = spec.rfind(':');
+    if (colon == string::npos) {
+        std::cerr << "Missing port in " << path << std::endl;
+        return -1;
+    }
+    string host = spec.substr(0, colon);
+    int port = atoi(spec.c_str() + colon + 1);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (!host.empty() && inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+        std::cerr << "Invalid address in " << path << std::endl;
+        return -1;
+    }
+    bool multicast = IN_MULTICAST(ntohl(addr.sin_addr.s_addr));
+
+    mFd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (mFd < 0) {
+        return -1;
+    }
+    int on = 1;
+    setsockopt(mFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(mFd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    if (mConfig.rcvBufBytes > 0) {
+        int size = mConfig.rcvBufBytes;
+        setsockopt(mFd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+    // Wake up regularly to honour requestStop() and the idle timeout
+    struct timeval tv = {0, 200 * 1000};
+    setsockopt(mFd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (bind(mFd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        std::cerr << "Cannot bind " << path << ": " << strerror(errno) << std::endl;
+        close();
+        return -1;
+    }
+    if (multicast) {
+        struct ip_mreq mreq;
+        mreq.imr_multiaddr = addr.sin_addr;
+        mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+        if (!local_addr.empty()) {
+            inet_pton(AF_INET, local_addr.c_str(), &mreq.imr_interface);
+        }
+        if (setsockopt(mFd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != 0) {
+            std::cerr << "Cannot join " << host << ": " << strerror(errno) << std::endl;
+            close();
+            return -1;
+        }
+    }
+    mBase = mBuffer.data();
+    mCur = mEnd = mBase;
+    mBaseOffset = 0;
+    mEof = false;
+    mLastDataNs = nowNs();
+    return 0;
+}
+
+void TsUdpInput::close() {
+    if (mFd >= 0) {
+        ::close(mFd);
+        mFd = -1;
+    }
+    mBase = mCur = mEnd = nullptr;
+}
+
+// Returns the number of datagrams received, 0 on timeout, -1 at end
+int TsUdpInput::receiveBatch() {
+    struct mmsghdr msgs[UDP_BATCH];
+    struct iovec iovs[UDP_BATCH];
+    char control[UDP_BATCH][CMSG_SPACE(sizeof(struct timespec))];
+    size_t room = mBuffer.size() - (mEnd - mBuffer.data());
+    int batch = std::min<size_t>(UDP_BATCH, room / UDP_SLOT_SIZE);
+    if (batch == 0) {
+        return 0;
+    }
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < batch; i++) {
+        iovs[i].iov_base = mSlots.data() + i * UDP_SLOT_SIZE;
+        iovs[i].iov_len = UDP_SLOT_SIZE;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = control[i];
+        msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+    }
+    int n = recvmmsg(mFd, msgs, batch, MSG_WAITFORONE, nullptr);
+    if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || (errno == EINTR && !sStop)) {
+            return 0;
+        }
+        return -1;
+    }
+    uint64_t now = nowNs();
+    uint8_t* end = (uint8_t*)mEnd;
+    for (int i = 0; i < n; i++) {
+        const uint8_t* payload = mSlots.data() + i * UDP_SLOT_SIZE;
+        size_t len = msgs[i].msg_len;
+        // RTP: strip the fixed header, CSRCs, extension and padding
+        if (len >= 12 && payload[0] != 0x47 && (payload[0] & 0xC0) == 0x80) {
+            mRtp = true;
+            size_t header = 12 + 4 * (payload[0] & 0x0F);
+            if ((payload[0] & 0x10) && len >= header + 4) {
+                header += 4 + 4 * ((payload[header + 2] << 8) | payload[header + 3]);
+            }
+            size_t padding = (payload[0] & 0x20) ? payload[len - 1] : 0;
+            if (header + padding > len) {
+                continue;
+            }
+            payload += header;
+            len -= header + padding;
+        }
+        memcpy(end, payload, len);
+        end += len;
+        uint64_t arrival = now;
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg; cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPNS) {
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                arrival = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+            }
+        }
+        mEnd = end;
+        noteArrival(offset() + (mEnd - mCur), arrival);
+    }
+    mDatagrams += n;
+    mLastDataNs = now;
+    return n;
+}
+
+size_t TsUdpInput::fill(size_t want) {
+    size_t remain = mEnd - mCur;
+    if (remain >= want || mEof || mFd < 0) {
+        return remain;
+    }
+    want = std::min(want, mBuffer.size() / 2);
+    uint8_t* buf = mBuffer.data();
+    mBaseOffset += mCur - mBase;
+    memmove(buf, mCur, remain);
+    mBase = buf;
+    mCur = buf;
+    mEnd = buf + remain;
+    while ((size_t)(mEnd - mCur) < want && (size_t)(mEnd - mCur) < LIVE_MIN_FILL) {
+        if (sStop) {
+            mEof = true;
+            break;
+        }
+        int n = receiveBatch();
+        if (n < 0) {
+            mEof = true;
+            break;
+        }
+        if (n == 0 && mConfig.idleTimeoutMs > 0 &&
+            nowNs() - mLastDataNs > (uint64_t)mConfig.idleTimeoutMs * 1000000ULL) {
+            mEof = true;
+            break;
+        }
+    }
+    return mEnd - mCur;
+}
+
+TsMemoryInput::TsMemoryInput(const uint8_t* data, size_t size, uint64_t baseOffset) {
+    mBase = data;
+    mCur = data;
+    mEnd = data + size;
+    mBaseOffset = baseOffset;
+}
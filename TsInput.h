@@ -0,0 +1,233 @@
+/**
+ * File: TsInput.h
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: TsInput class definition, byte sources feeding TsParser
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _TS_INPUT_H_
+#define _TS_INPUT_H_
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <csignal>
+#include <sys/uio.h>
+using namespace std;
+
+struct TsInputConfig {
+    bool allowMmap = true;
+    int rcvBufBytes = 0;      // SO_RCVBUF for udp/rtp, 0 keeps the system default
+    int idleTimeoutMs = 0;    // live inputs end after this long without data, 0 waits forever
+    int uringDepth = 0;       // files: reads kept in flight through io_uring, 0: mmap/stdio
+    bool directIo = false;    // io_uring reads with O_DIRECT, past the page cache
+};
+
+// io_uring read size
+#ifndef TS_URING_BLOCK
+#define TS_URING_BLOCK (1 << 20)
+#endif
+
+// Room in front of each block for the window carried over from the previous
+// one; also the most fill() waits for
+#define TS_URING_PAD (64 << 10)
+
+#define TS_URING_MAX_DEPTH 256
+
+/*
+ * A TsInput exposes the input as a window of contiguous bytes:
+ * fill() makes bytes available at data(), consume() advances past them.
+ * Packets are handed to the parser as pointers into that window, so no
+ * per-packet copy is made.
+ *
+ * Paths: "udp://[@][group]:port[?localaddr=ip]" and "rtp://..." receive
+ * from a socket, "-" is stdin, anything else is a file or FIFO.
+ */
+struct TsUringRing;
+class TsInput {
+    public:
+        TsInput();
+        virtual ~TsInput();
+        // mmap for regular files, stdio for pipes/stdin ("-") or when disabled;
+        // io_uring for files and block devices when config.uringDepth is set
+        static TsInput* create(const string& path, const TsInputConfig& config = TsInputConfig());
+        // Makes blocking live inputs return and report end of input
+        static void requestStop() { sStop = 1; }
+        // File inputs do not end on their own, the parser polls this
+        static bool stopRequested() { return sStop != 0; }
+        virtual int open(const string& path) = 0;
+        virtual void close() = 0;
+        // Make at least 'want' bytes available, returns the available count
+        // (less than 'want' only at end of input, or for live inputs once
+        // LIVE_MIN_FILL bytes have arrived, so they never wait for a full window)
+        virtual size_t fill(size_t want) = 0;
+        // True once the window holds everything left in the input
+        virtual bool atEnd() const = 0;
+        // True if pointers returned by data() stay valid until close()
+        virtual bool isStable() const { return false; }
+        // Sockets, pipes and terminals: data arrives while we parse
+        virtual bool isLive() const { return false; }
+        virtual const char* name() const = 0;
+        // Arrival time (CLOCK_REALTIME ns) of the byte at 'offset', 0 if not
+        // tracked. Offsets must be queried in increasing order.
+        uint64_t arrivalNs(uint64_t offset);
+        const uint8_t* data() const { return mCur; }
+        size_t avail() const { return mEnd - mCur; }
+        void consume(size_t n) { mCur += n; }
+        // Input offset of data()
+        uint64_t offset() const { return mBaseOffset + (mCur - mBase); }
+        static const size_t LIVE_MIN_FILL = 2048;
+    protected:
+        // Live inputs record when the bytes up to 'endOffset' arrived
+        void noteArrival(uint64_t endOffset, uint64_t ns);
+        static uint64_t nowNs();
+        const uint8_t* mBase;
+        const uint8_t* mCur;
+        const uint8_t* mEnd;
+        uint64_t mBaseOffset;
+        deque<pair<uint64_t, uint64_t>> mArrivals; // (end offset, ns)
+        static volatile sig_atomic_t sStop;
+};
+
+class TsMmapInput : public TsInput {
+    public:
+        TsMmapInput();
+        ~TsMmapInput();
+        int open(const string& path) override;
+        void close() override;
+        size_t fill(size_t want) override;
+        bool atEnd() const override { return true; }
+        bool isStable() const override { return true; }
+        const char* name() const override { return "mmap"; }
+    private:
+        int mFd;
+        void* mMap;
+        size_t mMapSize;
+};
+
+class TsStdioInput : public TsInput {
+    public:
+        TsStdioInput(size_t bufferSize = 1 << 20);
+        ~TsStdioInput();
+        int open(const string& path) override;
+        void close() override;
+        size_t fill(size_t want) override;
+        bool atEnd() const override { return mEof; }
+        bool isLive() const override { return mLive; }
+        const char* name() const override { return "stdio"; }
+    private:
+        int mFd;
+        bool mOwnFd;
+        bool mEof;
+        bool mLive;
+        vector<uint8_t> mBuffer;
+};
+
+/*
+ * Files through io_uring, without liburing. The buffer is 'depth' blocks of
+ * TS_URING_BLOCK bytes, read in file order, each one's read in flight until
+ * the window gets to it, so the next reads are queued while packets are
+ * parsed. The window lies in one block: when it needs the next, its
+ * unconsumed tail (less than a packet once synced) is copied to the pad in
+ * front of that block, and its old block is read into again at once. The
+ * blocks are registered with the ring when the memlock limit allows it
+ * (fixed reads), and with directIo the file is read with O_DIRECT.
+ */
+class TsUringInput : public TsInput {
+    public:
+        TsUringInput(const TsInputConfig& config);
+        ~TsUringInput();
+        // Fails when io_uring cannot be set up, the caller falls back to stdio
+        int open(const string& path) override;
+        void close() override;
+        size_t fill(size_t want) override;
+        bool atEnd() const override { return mEof; }
+        const char* name() const override { return "io_uring"; }
+    private:
+        enum {
+            SLOT_FREE = 0,
+            SLOT_READING,
+            SLOT_READY,
+        };
+        struct Slot {
+            int state = SLOT_FREE;
+            uint64_t fileOffset = 0;
+            size_t len = 0;
+        };
+        uint8_t* slotData(int slot) const { return mArena + (size_t)slot * (TS_URING_PAD + TS_URING_BLOCK) + TS_URING_PAD; }
+        int setupRing();
+        void queueRead(int slot);
+        void recycle();
+        void reap();
+        int enter(unsigned minComplete);
+        bool waitSlot(int slot);
+        TsInputConfig mConfig;
+        int mFd;
+        int mDepth;
+        TsUringRing* mRing;
+        uint8_t* mArena;      // per block: pad, then the block
+        size_t mArenaSize;
+        bool mFixed;          // blocks registered, IORING_OP_READ_FIXED
+        bool mDirect;
+        vector<Slot> mSlots;
+        vector<struct iovec> mIov; // per slot, for IORING_OP_READV
+        int mSubmitSlot;      // next slot to read into
+        uint64_t mReadOffset; // file offset of the next read
+        bool mReadEnd;        // a read came back short: no more reads
+        int mLast;            // slot the window is in, -1: none yet
+        unsigned mPending;    // queued, not yet submitted
+        bool mEof;
+};
+
+// UDP datagrams (7 TS packets each), optionally RTP, unicast or multicast.
+// Datagrams are fetched in batches with recvmmsg() and their payloads are
+// appended to the window.
+class TsUdpInput : public TsInput {
+    public:
+        TsUdpInput(const TsInputConfig& config);
+        ~TsUdpInput();
+        int open(const string& path) override;
+        void close() override;
+        size_t fill(size_t want) override;
+        bool atEnd() const override { return mEof; }
+        bool isLive() const override { return true; }
+        const char* name() const override { return mRtp ? "rtp" : "udp"; }
+        uint64_t datagrams() const { return mDatagrams; }
+    private:
+        int receiveBatch();
+        TsInputConfig mConfig;
+        int mFd;
+        bool mRtp;
+        bool mEof;
+        uint64_t mDatagrams;
+        uint64_t mLastDataNs;
+        vector<uint8_t> mBuffer;
+        vector<uint8_t> mSlots; // one receive slot per datagram of a batch
+};
+
+// Window over memory owned by someone else (e.g. a slice of a mapping)
+class TsMemoryInput : public TsInput {
+    public:
+        TsMemoryInput(const uint8_t* data, size_t size, uint64_t baseOffset = 0);
+        int open(const string&) override { return 0; }
+        void close() override {}
+        size_t fill(size_t) override { return mEnd - mCur; }
+        bool atEnd() const override { return true; }
+        bool isStable() const override { return true; }
+        const char* name() const override { return "memory"; }
+};
+
+#endif /* _TS_INPUT_H_ */
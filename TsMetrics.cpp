@@ -0,0 +1,207 @@
+/**
+ * File: TsMetrics.cpp
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: Implementation of TsMetrics and its JSON/Prometheus output
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "TsMetrics.h"
+#include <cstdio>
+#include <fstream>
+#include <ostream>
+#include <algorithm>
+#include <unistd.h>
+
+static const char* sStageNames[METRIC_STAGE_COUNT] = {"read", "dispatch", "section", "write"};
+
+TsMetrics::TsMetrics()
+    : mPids(8192),
+      mLastCc(8192, -1),
+      mStartNs(nowNs()),
+      mLastSnapshotNs(mStartNs) {
+}
+
+void TsMetrics::addSample(int stage, uint64_t ns) {
+    MetricHistogram& h = mStages[stage];
+    h.count++;
+    h.sumNs += ns;
+    h.maxNs = std::max(h.maxNs, ns);
+    int bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+    h.buckets[std::min(bucket, TS_METRICS_BUCKETS - 1)]++;
+}
+
+void TsMetrics::merge(const TsMetrics& other) {
+    for (size_t i = 0; i < mPids.size(); i++) {
+        PidMetrics& m = mPids[i];
+        const PidMetrics& o = other.mPids[i];
+        m.packets += o.packets;
+        m.bytes += o.bytes;
+        m.ccErrors += o.ccErrors;
+        m.teiPackets += o.teiPackets;
+        m.scrambledPackets += o.scrambledPackets;
+        m.sections += o.sections;
+        m.sectionErrors += o.sectionErrors;
+        m.crcErrors += o.crcErrors;
+        m.tableUpdates += o.tableUpdates;
+        m.pesUnits += o.pesUnits;
+        m.pesErrors += o.pesErrors;
+    }
+    for (int s = 0; s < METRIC_STAGE_COUNT; s++) {
+        MetricHistogram& h = mStages[s];
+        const MetricHistogram& o = other.mStages[s];
+        h.count += o.count;
+        h.sumNs += o.sumNs;
+        h.maxNs = std::max(h.maxNs, o.maxNs);
+        for (int b = 0; b < TS_METRICS_BUCKETS; b++) {
+            h.buckets[b] += o.buckets[b];
+        }
+    }
+}
+
+bool TsMetrics::snapshotDue(int intervalMs) {
+    uint64_t now = nowNs();
+    if (now - mLastSnapshotNs < (uint64_t)intervalMs * 1000000) {
+        return false;
+    }
+    mLastSnapshotNs = now;
+    return true;
+}
+
+uint64_t TsMetrics::percentile(const MetricHistogram& h, double q) const {
+    // Upper bound of the bucket holding the q-th sample
+    uint64_t target = (uint64_t)(h.count * q);
+    uint64_t seen = 0;
+    for (int b = 0; b < TS_METRICS_BUCKETS; b++) {
+        seen += h.buckets[b];
+        if (seen > target) {
+            return std::min<uint64_t>(h.maxNs, (2ULL << b) - 1);
+        }
+    }
+    return h.maxNs;
+}
+
+void TsMetrics::writeJson(std::ostream& out) const {
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    for (const auto& m : mPids) {
+        packets += m.packets;
+        bytes += m.bytes;
+    }
+    out << "{\n";
+    out << "  \"elapsed_s\": " << (nowNs() - mStartNs) / 1e9 << ",\n";
+    out << "  \"packets\": " << packets << ",\n";
+    out << "  \"bytes\": " << bytes << ",\n";
+    out << "  \"pids\": [";
+    bool first = true;
+    for (int pid = 0; pid < (int)mPids.size(); pid++) {
+        const PidMetrics& m = mPids[pid];
+        if (m.packets == 0) {
+            continue;
+        }
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "    {\"pid\": " << pid << ", \"packets\": " << m.packets << ", \"bytes\": " << m.bytes
+            << ", \"cc_errors\": " << m.ccErrors << ", \"tei_packets\": " << m.teiPackets
+            << ", \"scrambled_packets\": " << m.scrambledPackets << ", \"sections\": " << m.sections
+            << ", \"section_errors\": " << m.sectionErrors << ", \"crc_errors\": " << m.crcErrors
+            << ", \"table_updates\": " << m.tableUpdates
+            << ", \"pes_units\": " << m.pesUnits
+            << ", \"pes_errors\": " << m.pesErrors << "}";
+    }
+    out << "\n  ],\n";
+    out << "  \"stages\": {";
+    for (int s = 0; s < METRIC_STAGE_COUNT; s++) {
+        const MetricHistogram& h = mStages[s];
+        out << (s ? ",\n" : "\n");
+        out << "    \"" << sStageNames[s] << "\": {\"samples\": " << h.count << ", \"sum_ns\": " << h.sumNs
+            << ", \"avg_ns\": " << (h.count ? h.sumNs / h.count : 0) << ", \"p50_ns\": " << percentile(h, 0.5)
+            << ", \"p99_ns\": " << percentile(h, 0.99) << ", \"max_ns\": " << h.maxNs << "}";
+    }
+    out << "\n  }\n}" << std::endl;
+}
+
+void TsMetrics::writePrometheus(std::ostream& out) const {
+    struct Counter {
+        const char* name;
+        const char* help;
+        uint64_t PidMetrics::*field;
+    };
+    static const Counter counters[] = {
+        {"tsparser_pid_packets_total", "TS packets per PID", &PidMetrics::packets},
+        {"tsparser_pid_bytes_total", "Bytes per PID", &PidMetrics::bytes},
+        {"tsparser_pid_cc_errors_total", "Continuity counter gaps per PID", &PidMetrics::ccErrors},
+        {"tsparser_pid_tei_packets_total", "Packets with transport_error_indicator set", &PidMetrics::teiPackets},
+        {"tsparser_pid_scrambled_packets_total", "Packets with transport_scrambling_control set", &PidMetrics::scrambledPackets},
+        {"tsparser_pid_sections_total", "PSI sections completed", &PidMetrics::sections},
+        {"tsparser_pid_section_errors_total", "PSI sections dropped on a continuity gap", &PidMetrics::sectionErrors},
+        {"tsparser_pid_crc_errors_total", "PSI sections rejected on a CRC_32 mismatch", &PidMetrics::crcErrors},
+        {"tsparser_pid_table_updates_total", "PSI sections replacing an older version", &PidMetrics::tableUpdates},
+        {"tsparser_pid_pes_units_total", "PES packets reassembled", &PidMetrics::pesUnits},
+        {"tsparser_pid_pes_errors_total", "PES packets flagged corrupt", &PidMetrics::pesErrors},
+    };
+    char label[32];
+    for (const auto& counter : counters) {
+        out << "# HELP " << counter.name << " " << counter.help << "\n";
+        out << "# TYPE " << counter.name << " counter\n";
+        for (int pid = 0; pid < (int)mPids.size(); pid++) {
+            const PidMetrics& m = mPids[pid];
+            if (m.packets == 0) {
+                continue;
+            }
+            snprintf(label, sizeof(label), "{pid=\"0x%04x\"}", pid);
+            out << counter.name << label << " " << m.*counter.field << "\n";
+        }
+    }
+    out << "# HELP tsparser_stage_seconds Time spent per stage (dispatch sampled 1/" << TS_METRICS_SAMPLE << ")\n";
+    out << "# TYPE tsparser_stage_seconds histogram\n";
+    for (int s = 0; s < METRIC_STAGE_COUNT; s++) {
+        const MetricHistogram& h = mStages[s];
+        uint64_t cumulative = 0;
+        for (int b = 0; b < TS_METRICS_BUCKETS; b++) {
+            cumulative += h.buckets[b];
+            out << "tsparser_stage_seconds_bucket{stage=\"" << sStageNames[s] << "\",le=\""
+                << (double)(2ULL << b) / 1e9 << "\"} " << cumulative << "\n";
+        }
+        out << "tsparser_stage_seconds_bucket{stage=\"" << sStageNames[s] << "\",le=\"+Inf\"} " << h.count << "\n";
+        out << "tsparser_stage_seconds_sum{stage=\"" << sStageNames[s] << "\"} " << h.sumNs / 1e9 << "\n";
+        out << "tsparser_stage_seconds_count{stage=\"" << sStageNames[s] << "\"} " << h.count << "\n";
+    }
+    out.flush();
+}
+
+int TsMetrics::write(const string& path, std::ostream* err) {
+    const string suffix = ".prom";
+    bool prometheus = path.size() >= suffix.size() &&
+                      path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0;
+    string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp);
+        if (prometheus) {
+            writePrometheus(out);
+        } else {
+            writeJson(out);
+        }
+        if (!out) {
+            *err << "Cannot write metrics to " << tmp << std::endl;
+            unlink(tmp.c_str());
+            return -1;
+        }
+    }
+    if (rename(tmp.c_str(), path.c_str()) != 0) {
+        *err << "Cannot write metrics to " << path << std::endl;
+        unlink(tmp.c_str());
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,138 @@
+/**
+ * File: TsMetrics.h
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: TsMetrics class definition, per-PID counters and stage timings
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _TS_METRICS_H_
+#define _TS_METRICS_H_
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Every TS_METRICS_SAMPLE-th packet has its dispatch timed
+#ifndef TS_METRICS_SAMPLE
+#define TS_METRICS_SAMPLE 64
+#endif
+
+#define TS_METRICS_BUCKETS 40 // bucket i: [2^i, 2^(i+1)) ns
+
+/*
+ * Hooks in the parser go through these macros. Building with
+ * -DTS_NO_METRICS removes them, so nothing is counted or timed at all;
+ * otherwise a disabled run costs one null pointer test per hook.
+ */
+#ifndef TS_NO_METRICS
+#define TS_METRIC(metrics, ...) do { if (metrics) { __VA_ARGS__; } } while (0)
+#define TS_METRIC_TIMER(metrics, stage, sampled) \
+    TsMetricTimer metricTimer_##stage((metrics) && (sampled) ? (metrics) : nullptr, stage)
+#else
+#define TS_METRIC(metrics, ...) do {} while (0)
+#define TS_METRIC_TIMER(metrics, stage, sampled) do {} while (0)
+#endif
+
+enum {
+    METRIC_STAGE_READ = 0, // refilling the input window
+    METRIC_STAGE_DISPATCH, // packet(), sampled
+    METRIC_STAGE_SECTION,  // PSI section assembly and parsing
+    METRIC_STAGE_WRITE,    // handing ES data to the sinks
+    METRIC_STAGE_COUNT,
+};
+
+struct PidMetrics {
+    uint64_t packets = 0;
+    uint64_t bytes = 0;
+    uint64_t ccErrors = 0;
+    uint64_t teiPackets = 0;       // transport_error_indicator set
+    uint64_t scrambledPackets = 0; // transport_scrambling_control != 0
+    uint64_t sections = 0;         // completed PSI sections
+    uint64_t sectionErrors = 0;    // sections dropped on a continuity gap
+    uint64_t crcErrors = 0;        // sections rejected on a CRC_32 mismatch
+    uint64_t tableUpdates = 0;     // sections replacing an older version
+    uint64_t pesUnits = 0;
+    uint64_t pesErrors = 0;        // units flagged CC error, truncated or bad header
+};
+
+struct MetricHistogram {
+    uint64_t count = 0;
+    uint64_t sumNs = 0;
+    uint64_t maxNs = 0;
+    uint64_t buckets[TS_METRICS_BUCKETS] = {0};
+};
+
+class TsMetrics {
+    public:
+        TsMetrics();
+        void countPacket(int pid, const uint8_t* pkt, int packetSize) {
+            PidMetrics& m = mPids[pid];
+            m.packets++;
+            m.bytes += packetSize;
+            m.teiPackets += pkt[1] >> 7;
+            m.scrambledPackets += (pkt[3] >> 6) != 0;
+            if (pkt[3] & 0x10) {
+                // Only packets with payload advance the counter; one repeat is allowed
+                int cc = pkt[3] & 0x0f;
+                int last = mLastCc[pid];
+                if (last >= 0 && cc != last && cc != ((last + 1) & 0x0f)) {
+                    m.ccErrors++;
+                }
+                mLastCc[pid] = cc;
+            }
+        }
+        PidMetrics& pid(int pid) { return mPids[pid]; }
+        void addSample(int stage, uint64_t ns);
+        void merge(const TsMetrics& other);
+        // Periodic snapshots: true when 'intervalMs' passed since the last one
+        bool snapshotDue(int intervalMs);
+        // Format from the suffix: ".prom" is Prometheus text, anything else JSON.
+        // Written aside and renamed, a collector never reads half a file.
+        int write(const string& path, std::ostream* err);
+        void writeJson(std::ostream& out) const;
+        void writePrometheus(std::ostream& out) const;
+        static uint64_t nowNs() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+    private:
+        uint64_t percentile(const MetricHistogram& h, double q) const;
+        vector<PidMetrics> mPids;
+        vector<int8_t> mLastCc;
+        MetricHistogram mStages[METRIC_STAGE_COUNT];
+        uint64_t mStartNs;
+        uint64_t mLastSnapshotNs;
+};
+
+// Adds the lifetime of the object to a stage histogram, if 'metrics' is set
+class TsMetricTimer {
+    public:
+        TsMetricTimer(TsMetrics* metrics, int stage)
+            : mMetrics(metrics), mStage(stage), mStart(metrics ? TsMetrics::nowNs() : 0) {
+        }
+        ~TsMetricTimer() {
+            if (mMetrics) {
+                mMetrics->addSample(mStage, TsMetrics::nowNs() - mStart);
+            }
+        }
+    private:
+        TsMetrics* mMetrics;
+        int mStage;
+        uint64_t mStart;
+};
+
+#endif /* _TS_METRICS_H_ */
@@ -0,0 +1,326 @@
+/**
+ * File: TsMonitor.cpp
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: Implementation of TsMonitor
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "TsMonitor.h"
+#include "PesAssembler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+static const struct {
+    const char* number;
+    const char* name;
+} kIndicators[TR_COUNT] = {
+    {"1.1", "TS_sync_loss"},
+    {"1.2", "Sync_byte_error"},
+    {"1.3", "PAT_error"},
+    {"1.4", "Continuity_count_error"},
+    {"1.5", "PMT_error"},
+    {"1.6", "PID_error"},
+    {"2.1", "Transport_error"},
+    {"2.2", "CRC_error"},
+    {"2.3a", "PCR_repetition_error"},
+    {"2.3b", "PCR_discontinuity_indicator_error"},
+    {"2.4", "PCR_accuracy_error"},
+    {"2.5", "PTS_error"},
+    {"2.6", "CAT_error"},
+};
+
+static inline double ticksToMs(uint64_t ticks) {
+    return ticks * 1000.0 / PCR_CLOCK_HZ;
+}
+
+TsMonitor::TsMonitor(std::ostream* err)
+    : mPids(8192), mTableSeen(8192, 0), mPcrSeen(8192, 0), mPtsSeen(8192, UINT64_MAX), mErr(err) {
+    mPids[0x0000].watch = TR_WATCH_PSI;
+    mPids[0x0001].watch = TR_WATCH_CAT;
+}
+
+int TsMonitor::open(const string& path) {
+    mPath = path;
+    mLog.open(path);
+    if (!mLog) {
+        *mErr << "Cannot create " << path << std::endl;
+        return -1;
+    }
+    mLog << "offset,time,indicator,name,pid,detail\n";
+    return 0;
+}
+
+void TsMonitor::report(int indicator, int pid, uint64_t offset, const char* detail) {
+    mCounts[indicator]++;
+    if (!mLog.is_open()) {
+        return;
+    }
+    char line[256];
+    int n = snprintf(line, sizeof(line), "%llu,", (unsigned long long)offset);
+    if (mTimed) {
+        n += snprintf(line + n, sizeof(line) - n, "%.6f", mNow / (double)PCR_CLOCK_HZ);
+    }
+    n += snprintf(line + n, sizeof(line) - n, ",%s,%s,", kIndicators[indicator].number, kIndicators[indicator].name);
+    if (pid >= 0) {
+        n += snprintf(line + n, sizeof(line) - n, "0x%04x", pid);
+    }
+    snprintf(line + n, sizeof(line) - n, ",%s\n", detail);
+    mLog << line;
+}
+
+// TEI, scrambling, and the unit starts of PID 1 and of elementary streams
+void TsMonitor::special(int pid, const uint8_t* pkt, uint64_t offset) {
+    const TrPid& p = mPids[pid];
+    if (pkt[1] & 0x80) {
+        report(TR_TRANSPORT, pid, offset, "transport_error_indicator set");
+        return;
+    }
+    if (pkt[3] & 0xc0) {
+        if (p.watch & TR_WATCH_PSI) {
+            report(pid == 0 ? TR_PAT : TR_PMT, pid, offset, "scrambled");
+        }
+        if (!mCatSeen && !mCatReported) {
+            report(TR_CAT, pid, offset, "scrambled packet without CAT");
+            mCatReported = true;
+        }
+        return;
+    }
+    if (!(pkt[3] & 0x10)) {
+        return;
+    }
+    const int start = (pkt[3] & 0x20) ? 5 + pkt[4] : 4;
+    if (p.watch & TR_WATCH_CAT) {
+        const int at = start < 188 ? start + 1 + pkt[start] : 188; // past pointer_field
+        if (at >= 188 || pkt[at] == 0xff) {
+            return;
+        }
+        if (pkt[at] == 0x01) {
+            mCatSeen = true;
+        } else {
+            char detail[64];
+            snprintf(detail, sizeof(detail), "table_id 0x%02x on PID 1", pkt[at]);
+            report(TR_CAT, pid, offset, detail);
+        }
+        return;
+    }
+    const uint8_t* h = pkt + start;
+    if (start + 14 <= 188 && h[0] == 0x00 && h[1] == 0x00 && h[2] == 0x01 && hasOptionalHeader(h[3]) && (h[7] & 0x80)) {
+        if (mPtsSeen[pid] == UINT64_MAX) {
+            mPtsPids.push_back(pid);
+        }
+        mPtsSeen[pid] = mNow;
+    }
+}
+
+void TsMonitor::continuityError(int pid, int last, int cc, uint64_t offset) {
+    char detail[64];
+    snprintf(detail, sizeof(detail), "continuity_counter %d after %d", cc, last);
+    report(TR_CC, pid, offset, detail);
+}
+
+void TsMonitor::pcr(int pid, uint64_t pcr, bool discontinuity, uint64_t offset) {
+    TrClock& c = mClocks[pid];
+    if (!c.started) {
+        c.started = true;
+        mTimed = true;
+    } else if (discontinuity) {
+        c.ticksPerPacket = 0;
+    } else {
+        char detail[64];
+        const uint64_t step = (pcr + PCR_WRAP - c.lastRaw) % PCR_WRAP;
+        if (step > PCR_MAX_INTERVAL) {
+            const double ms = step > PCR_WRAP / 2 ? -ticksToMs(PCR_WRAP - step) : ticksToMs(step);
+            snprintf(detail, sizeof(detail), "PCR step %.3f ms", ms);
+            report(TR_PCR_DISCONTINUITY, pid, offset, detail);
+        }
+        if (step <= PCR_MAX_JUMP) {
+            // Against the transport rate of the previous interval
+            const uint64_t packets = mPackets - c.lastPacket;
+            if (c.ticksPerPacket > 0) {
+                const double off = step - packets * c.ticksPerPacket;
+                const double ns = off * 1e9 / PCR_CLOCK_HZ;
+                if (std::fabs(off) > step * TR_PCR_VBR_RATIO) {
+                    mVariableIntervals++;
+                } else if (std::fabs(ns) > TR_PCR_ACCURACY_NS) {
+                    snprintf(detail, sizeof(detail), "PCR off by %.0f ns", ns);
+                    report(TR_PCR_ACCURACY, pid, offset, detail);
+                }
+            }
+            c.ticksPerPacket = packets > 0 ? (double)step / packets : 0;
+            advance(c.lastNow + step, offset);
+        } else {
+            c.ticksPerPacket = 0;
+        }
+    }
+    c.lastRaw = pcr;
+    c.lastPacket = mPackets;
+    c.lastNow = mNow;
+    mPcrSeen[pid] = mNow;
+}
+
+// Several clocks may run the multiplex time, it only moves forward
+void TsMonitor::advance(uint64_t now, uint64_t offset) {
+    if (now > mNow) {
+        mNow = now;
+        checkTimers(offset);
+    }
+}
+
+// Each limit reports once per period it is exceeded by
+void TsMonitor::checkTimers(uint64_t offset) {
+    const uint64_t ms = PCR_CLOCK_HZ / 1000;
+    char detail[64];
+    auto due = [&](uint64_t& last, uint64_t limit, int indicator, int pid, const char* what) {
+        if (mNow - last > limit) {
+            snprintf(detail, sizeof(detail), "no %s for %.0f ms", what, ticksToMs(mNow - last));
+            report(indicator, pid, offset, detail);
+            last = mNow;
+        }
+    };
+    due(mTableSeen[0], TR_PAT_INTERVAL_MS * ms, TR_PAT, 0, "PAT");
+    for (int pid : mPmtPids) {
+        due(mTableSeen[pid], TR_PMT_INTERVAL_MS * ms, TR_PMT, pid, "PMT");
+    }
+    for (int pid : mEsPids) {
+        due(mPids[pid].lastSeen, TR_PID_TIMEOUT_MS * ms, TR_PID, pid, "packet");
+    }
+    for (int pid : mPcrPids) {
+        due(mPcrSeen[pid], PCR_MAX_INTERVAL, TR_PCR_REPETITION, pid, "PCR");
+    }
+    for (int pid : mPtsPids) {
+        due(mPtsSeen[pid], TR_PTS_INTERVAL_MS * ms, TR_PTS, pid, "PTS");
+    }
+}
+
+void TsMonitor::section(int pid, int tableId, bool crcValid, uint64_t offset) {
+    char detail[64];
+    if (!crcValid) {
+        snprintf(detail, sizeof(detail), "table_id 0x%02x", tableId);
+        report(TR_CRC, pid, offset, detail);
+        return;
+    }
+    if (pid == 0x0000) {
+        if (tableId == 0x00) {
+            mTableSeen[0] = mNow;
+        } else {
+            snprintf(detail, sizeof(detail), "table_id 0x%02x on PID 0", tableId);
+            report(TR_PAT, pid, offset, detail);
+        }
+    } else if ((mPids[pid].watch & TR_WATCH_PSI) && tableId == 0x02) {
+        mTableSeen[pid] = mNow;
+    }
+}
+
+void TsMonitor::syncByteError(uint64_t offset, int byte) {
+    char detail[64];
+    snprintf(detail, sizeof(detail), "sync byte 0x%02x", byte);
+    report(TR_SYNC_BYTE, -1, offset, detail);
+}
+
+// TS_sync_loss only once TR_SYNC_LOSS_BYTES corrupted sync bytes came in a
+// row, and not again before TR_SYNC_ACQUIRE_BYTES correct ones
+void TsMonitor::syncLoss(uint64_t offset, uint64_t skipped, int packetSize) {
+    mSyncBad += std::max<uint64_t>(1, (skipped + packetSize - 1) / packetSize);
+    mSyncGood = 0;
+    if (mSyncLost || mSyncBad < TR_SYNC_LOSS_BYTES) {
+        return;
+    }
+    mSyncLost = true;
+    char detail[96];
+    snprintf(detail, sizeof(detail), "%llu corrupted sync bytes, re-locked after %llu bytes",
+             (unsigned long long)mSyncBad, (unsigned long long)skipped);
+    report(TR_SYNC_LOSS, -1, offset, detail);
+}
+
+// A packet with a correct sync byte
+void TsMonitor::syncByte() {
+    mSyncBad = 0;
+    if (mSyncLost && ++mSyncGood >= TR_SYNC_ACQUIRE_BYTES) {
+        mSyncLost = false;
+        mSyncGood = 0;
+    }
+}
+
+// Replaces 'list' with 'pids'; a PID new to it starts its timer now
+void TsMonitor::watch(vector<int>& list, const vector<int>& pids, vector<uint64_t>* since, int bit) {
+    for (int pid : list) {
+        mPids[pid].watch &= ~bit;
+    }
+    for (int pid : pids) {
+        if (std::find(list.begin(), list.end(), pid) == list.end()) {
+            if (since) {
+                (*since)[pid] = mNow;
+            } else {
+                mPids[pid].lastSeen = mNow;
+            }
+        }
+        mPids[pid].watch |= bit;
+    }
+    list = pids;
+}
+
+void TsMonitor::setPids(const vector<int>& pmtPids, const vector<int>& esPids, const vector<int>& pcrPids) {
+    watch(mPmtPids, pmtPids, &mTableSeen, TR_WATCH_PSI);
+    watch(mEsPids, esPids, nullptr, TR_WATCH_PES);
+    watch(mPcrPids, pcrPids, &mPcrSeen, 0);
+    // A stream that left its PMT has no PTS to wait for
+    for (auto it = mPtsPids.begin(); it != mPtsPids.end();) {
+        if (!(mPids[*it].watch & TR_WATCH_PES)) {
+            mPtsSeen[*it] = UINT64_MAX;
+            it = mPtsPids.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+uint64_t TsMonitor::errors() const {
+    uint64_t total = 0;
+    for (int i = 0; i < TR_COUNT; i++) {
+        total += mCounts[i];
+    }
+    return total;
+}
+
+void TsMonitor::printReport(std::ostream& out) const {
+    char line[128];
+    snprintf(line, sizeof(line), "TR 101 290: %llu errors", (unsigned long long)errors());
+    out << line << (mPath.empty() ? "" : ", listed in " + mPath) << std::endl;
+    if (!mTimed) {
+        out << "  no PCR found, repetition checks skipped" << std::endl;
+    }
+    if (mVariableIntervals > 0) {
+        snprintf(line, sizeof(line), "  %llu PCR intervals at a variable rate, accuracy not checked",
+                 (unsigned long long)mVariableIntervals);
+        out << line << std::endl;
+    }
+    for (int i = 0; i < TR_COUNT; i++) {
+        snprintf(line, sizeof(line), "  %-5s %-34s %llu", kIndicators[i].number, kIndicators[i].name,
+                 (unsigned long long)mCounts[i]);
+        out << line << std::endl;
+    }
+}
+
+int TsMonitor::close() {
+    if (!mLog.is_open()) {
+        return 0;
+    }
+    mLog.close();
+    if (!mLog) {
+        *mErr << "Cannot write " << mPath << std::endl;
+        return -1;
+    }
+    return 0;
+}
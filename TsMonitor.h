@@ -0,0 +1,185 @@
+/**
+ * File: TsMonitor.h
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: TsMonitor, ETSI TR 101 290 priority 1 and 2 checks in the parsing pass
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _TS_MONITOR_H_
+#define _TS_MONITOR_H_
+
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "TsPcrTimeline.h"
+using namespace std;
+
+// Repetition limits of TR 101 290, milliseconds of multiplex time
+#ifndef TR_PAT_INTERVAL_MS
+#define TR_PAT_INTERVAL_MS  500
+#endif
+#ifndef TR_PMT_INTERVAL_MS
+#define TR_PMT_INTERVAL_MS  500
+#endif
+#ifndef TR_PID_TIMEOUT_MS
+#define TR_PID_TIMEOUT_MS   5000 // "user specified period" of PID_error
+#endif
+#ifndef TR_PTS_INTERVAL_MS
+#define TR_PTS_INTERVAL_MS  700
+#endif
+#define TR_PCR_ACCURACY_NS  500
+// Hysteresis of TS_sync_loss: consecutive corrupted sync bytes before sync
+// counts as lost, consecutive correct ones before it counts as regained
+#ifndef TR_SYNC_LOSS_BYTES
+#define TR_SYNC_LOSS_BYTES      5
+#endif
+#ifndef TR_SYNC_ACQUIRE_BYTES
+#define TR_SYNC_ACQUIRE_BYTES   5
+#endif
+// PCR accuracy holds against a constant transport rate: an interval whose
+// rate differs by more than this from the one before is variable, not checked
+#define TR_PCR_VBR_RATIO    0.01
+
+enum {
+    TR_SYNC_LOSS = 0,       // 1.1
+    TR_SYNC_BYTE,           // 1.2
+    TR_PAT,                 // 1.3
+    TR_CC,                  // 1.4
+    TR_PMT,                 // 1.5
+    TR_PID,                 // 1.6
+    TR_TRANSPORT,           // 2.1
+    TR_CRC,                 // 2.2
+    TR_PCR_REPETITION,      // 2.3a
+    TR_PCR_DISCONTINUITY,   // 2.3b
+    TR_PCR_ACCURACY,        // 2.4
+    TR_PTS,                 // 2.5
+    TR_CAT,                 // 2.6
+    TR_COUNT,
+};
+
+#define TR_WATCH_PSI    0x01 // PAT/PMT PID: must not be scrambled
+#define TR_WATCH_PES    0x02 // elementary stream: PTS taken from unit starts
+#define TR_WATCH_CAT    0x04 // PID 1
+
+// Touched by every packet, kept to 16 bytes
+struct TrPid {
+    uint64_t lastSeen = 0;  // multiplex time of its last packet
+    int8_t lastCc = -1;
+    uint8_t repeats = 0;    // packets in a row with the same continuity_counter
+    uint8_t watch = 0;      // TR_WATCH_*
+};
+
+struct TrClock {
+    bool started = false;
+    uint64_t lastRaw = 0;
+    uint64_t lastPacket = 0;
+    uint64_t lastNow = 0;       // multiplex time at its last PCR
+    double ticksPerPacket = 0;  // over its previous PCR interval, 0: none
+};
+
+/*
+ * The checks run on the packets, PCRs and sections the parser hands over;
+ * the per packet part is a PID slot update and the continuity check, the
+ * rest runs on the few packets that need it. Repetition limits are measured
+ * on the multiplex time the PCRs give: it starts at the first PCR, advances
+ * with every PCR PID and leaves out jumps of the clock, so a file is timed
+ * as it was sent. A stream without PCR gets no repetition checks.
+ *
+ * Each error becomes a CSV line: offset of the packet where it was found,
+ * multiplex time in seconds, indicator number and name, PID, detail.
+ */
+class TsMonitor {
+    public:
+        TsMonitor(std::ostream* err);
+        int open(const string& path);
+        void packet(int pid, const uint8_t* pkt, uint64_t offset) {
+            mPackets++;
+            if (mSyncBad | mSyncLost) {
+                syncByte();
+            }
+            TrPid& p = mPids[pid];
+            p.lastSeen = mNow;
+            const int pusi = (pkt[1] & 0x40) ? TR_WATCH_PES | TR_WATCH_CAT : 0;
+            if ((pkt[1] & 0x80) || (pkt[3] & 0xc0) || (p.watch & pusi)) {
+                special(pid, pkt, offset);
+            }
+            if ((pkt[3] & 0x10) && pid != 0x1fff) {
+                const int cc = pkt[3] & 0x0f;
+                if (cc == p.lastCc) {
+                    if (++p.repeats > 1) {
+                        report(TR_CC, pid, offset, "packet repeated more than twice");
+                    }
+                } else {
+                    if (p.lastCc >= 0 && cc != ((p.lastCc + 1) & 0x0f) && !discontinuity(pkt)) {
+                        continuityError(pid, p.lastCc, cc, offset);
+                    }
+                    p.lastCc = cc;
+                    p.repeats = 0;
+                }
+            }
+        }
+        void pcr(int pid, uint64_t pcr, bool discontinuity, uint64_t offset);
+        // A complete PAT/PMT/SDT section; 'crcValid' false: it failed its CRC
+        void section(int pid, int tableId, bool crcValid, uint64_t offset);
+        // 'byte', where a packet should have started, is not 0x47
+        void syncByteError(uint64_t offset, int byte);
+        // Sync found again at 'offset' after 'skipped' bytes on a grid of
+        // 'packetSize': each packet slot in them had a corrupted sync byte
+        void syncLoss(uint64_t offset, uint64_t skipped, int packetSize);
+        // What PAT and the PMTs refer to, after every table change
+        void setPids(const vector<int>& pmtPids, const vector<int>& esPids, const vector<int>& pcrPids);
+        uint64_t errors() const;
+        void printReport(std::ostream& out) const;
+        // -1 if the CSV could not be written completely
+        int close();
+    private:
+        static bool discontinuity(const uint8_t* pkt) {
+            return (pkt[3] & 0x20) && pkt[4] > 0 && (pkt[5] & 0x80);
+        }
+        void special(int pid, const uint8_t* pkt, uint64_t offset);
+        void syncByte();
+        void continuityError(int pid, int last, int cc, uint64_t offset);
+        void advance(uint64_t now, uint64_t offset);
+        void checkTimers(uint64_t offset);
+        void report(int indicator, int pid, uint64_t offset, const char* detail);
+        void watch(vector<int>& list, const vector<int>& pids, vector<uint64_t>* since, int bit);
+        vector<TrPid> mPids;
+        uint64_t mPackets = 0;
+        uint64_t mNow = 0;      // multiplex time, 27 MHz
+        bool mTimed = false;    // a PCR has been seen
+        // Last occurrence in multiplex time, per PID
+        vector<uint64_t> mTableSeen; // PAT (PID 0) or PMT section
+        vector<uint64_t> mPcrSeen;
+        vector<uint64_t> mPtsSeen;
+        vector<int> mPmtPids;
+        vector<int> mEsPids;
+        vector<int> mPcrPids;
+        vector<int> mPtsPids;   // elementary streams that carried a PTS
+        map<int, TrClock> mClocks;
+        uint64_t mSyncBad = 0;  // corrupted sync bytes in a row
+        uint64_t mSyncGood = 0; // correct ones in a row while sync is lost
+        bool mSyncLost = false;
+        bool mCatSeen = false;
+        bool mCatReported = false;
+        uint64_t mVariableIntervals = 0; // PCR intervals left out of the accuracy check
+        uint64_t mCounts[TR_COUNT] = {};
+        std::ostream* mErr;
+        string mPath;
+        std::ofstream mLog;
+};
+
+#endif /* _TS_MONITOR_H_ */
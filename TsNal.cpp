@@ -0,0 +1,305 @@
+/**
+ * File: TsNal.cpp
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: Implementation of TsNalScanner and TsAuTable
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "TsNal.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TS_NAL_X86 1
+#endif
+
+typedef long (*NalFindFunc)(const uint8_t* buf, size_t len);
+
+// 0x01 is the rarer byte of the three, look for it and check the zeros
+static long findScalar(const uint8_t* buf, size_t len) {
+    size_t pos = 2;
+    while (pos < len) {
+        const uint8_t* hit = (const uint8_t*)memchr(buf + pos, 0x01, len - pos);
+        if (!hit) {
+            break;
+        }
+        pos = hit - buf;
+        if (buf[pos - 1] == 0 && buf[pos - 2] == 0) {
+            return pos - 2;
+        }
+        pos++;
+    }
+    return -1;
+}
+
+#ifdef TS_NAL_X86
+// Three loads one byte apart: bit i survives when buf[i..i+2] is 00 00 01
+static long findSse2(const uint8_t* buf, size_t len) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(0x01);
+    size_t i = 0;
+    for (; i + 18 <= len; i += 16) {
+        __m128i c = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(buf + i + 2)), one);
+        if (!_mm_movemask_epi8(c)) {
+            continue;
+        }
+        __m128i a = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(buf + i)), zero);
+        __m128i b = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(buf + i + 1)), zero);
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(a, b), c));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    long pos = findScalar(buf + i, len - i);
+    return pos < 0 ? -1 : (long)(i + pos);
+}
+
+__attribute__((target("avx2")))
+static long findAvx2(const uint8_t* buf, size_t len) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(0x01);
+    size_t i = 0;
+    for (; i + 34 <= len; i += 32) {
+        __m256i c = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(buf + i + 2)), one);
+        if (!_mm256_movemask_epi8(c)) {
+            continue;
+        }
+        __m256i a = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(buf + i)), zero);
+        __m256i b = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(buf + i + 1)), zero);
+        unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(a, b), c));
+        if (mask) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    long pos = findSse2(buf + i, len - i);
+    return pos < 0 ? -1 : (long)(i + pos);
+}
+#endif
+
+static NalFindFunc selectFindFunc(const char** name) {
+#ifdef TS_NAL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return findAvx2;
+    }
+    *name = "sse2";
+    return findSse2;
+#else
+    *name = "scalar";
+    return findScalar;
+#endif
+}
+
+static const char* gFindName = "scalar";
+static NalFindFunc gFindFunc = selectFindFunc(&gFindName);
+
+long TsNalScanner::find(const uint8_t* buf, size_t len) {
+    return gFindFunc(buf, len);
+}
+
+const char* TsNalScanner::implName() {
+    return gFindName;
+}
+
+int TsAuTable::codecFor(uint8_t streamType) {
+    switch (streamType) {
+        case 0x1B:
+            return NAL_CODEC_H264;
+        case 0x24:
+            return NAL_CODEC_H265;
+        case 0x33:
+            return NAL_CODEC_VVC;
+        default:
+            return NAL_CODEC_NONE;
+    }
+}
+
+const char* TsAuTable::codecName(int codec) {
+    switch (codec) {
+        case NAL_CODEC_H264:
+            return "H.264";
+        case NAL_CODEC_H265:
+            return "H.265";
+        case NAL_CODEC_VVC:
+            return "VVC";
+        default:
+            return "none";
+    }
+}
+
+void TsAuTable::setCodec(int pid, int codec) {
+    if (codec != NAL_CODEC_NONE) {
+        mStreams[pid].codec = codec;
+    }
+}
+
+// Trailing zero bytes of 'data', added to 'carry' when it is all zeros
+static inline int trailingZeros(int carry, const uint8_t* data, size_t len) {
+    size_t z = 0;
+    while (z < 2 && z < len && data[len - 1 - z] == 0) {
+        z++;
+    }
+    return z == len ? std::min(2, carry + (int)z) : (int)z;
+}
+
+void TsAuTable::unit(const PesUnit& unit) {
+    auto it = mStreams.find(unit.pid);
+    if (it == mStreams.end()) {
+        return;
+    }
+    Stream& s = it->second;
+    if (unit.hasPts || s.units.empty()) {
+        TsAccessUnit au = {unit.offset, unit.hasPts ? unit.pts : 0, 0, unit.hasPts ? (uint32_t)TS_AU_PTS : 0};
+        s.units.push_back(au);
+        s.decided = false;
+    }
+    s.units.back().size += unit.payloadLength;
+    for (int i = 0; i < unit.spanCount && !s.decided; i++) {
+        span(s, unit.spans[i].data, unit.spans[i].len);
+    }
+    if (s.decided && unit.spanCount > 0) {
+        // The rest was skipped, a start code may still begin at its end
+        const PesSpan& last = unit.spans[unit.spanCount - 1];
+        s.zeros = trailingZeros(0, last.data, last.len);
+    }
+}
+
+void TsAuTable::span(Stream& s, const uint8_t* data, size_t len) {
+    size_t pos = 0;
+    if (s.headerNeed > 0) {
+        // The previous span ended inside a start code's NAL header
+        pos = startCode(s, data, len, 0);
+        if (s.decided || s.headerNeed > 0) {
+            return;
+        }
+    } else if (s.zeros > 0 && len > 0) {
+        // ... or with the first zeros of a start code
+        size_t at = 0;
+        if (s.zeros == 2 && data[0] == 0x01) {
+            at = 1;
+        } else if (len >= 2 && data[0] == 0x00 && data[1] == 0x01) {
+            at = 2;
+        }
+        if (at) {
+            pos = startCode(s, data, len, at);
+            if (s.decided || s.headerNeed > 0) {
+                s.zeros = 0;
+                return;
+            }
+        }
+    }
+    while (pos < len) {
+        long hit = TsNalScanner::find(data + pos, len - pos);
+        if (hit < 0) {
+            break;
+        }
+        pos = startCode(s, data, len, pos + hit + 3);
+        if (s.decided || s.headerNeed > 0) {
+            s.zeros = 0;
+            return;
+        }
+    }
+    s.zeros = trailingZeros(s.zeros, data, len);
+}
+
+// 'pos': the NAL header follows, in this span or the next; returns the
+// position past what was taken of it
+size_t TsAuTable::startCode(Stream& s, const uint8_t* data, size_t len, size_t pos) {
+    if (s.headerNeed == 0) {
+        s.headerNeed = s.codec == NAL_CODEC_VVC ? 2 : 1;
+        s.headerHave = 0;
+    }
+    while (s.headerNeed > 0 && pos < len) {
+        s.header[s.headerHave++] = data[pos++];
+        s.headerNeed--;
+    }
+    if (s.headerNeed == 0) {
+        nal(s);
+    }
+    return pos;
+}
+
+void TsAuTable::nal(Stream& s) {
+    const uint8_t* h = s.header;
+    if (h[0] & 0x80) {
+        return; // forbidden_zero_bit: payload bytes, not a NAL
+    }
+    s.nals++;
+    int type = 0;
+    bool vcl = false;
+    bool key = false;
+    switch (s.codec) {
+        case NAL_CODEC_H264:
+            type = h[0] & 0x1f;
+            vcl = type >= 1 && type <= 5;
+            key = type == 5;
+            break;
+        case NAL_CODEC_H265:
+            type = (h[0] >> 1) & 0x3f;
+            vcl = type <= 31;
+            key = type >= 16 && type <= 23;
+            break;
+        case NAL_CODEC_VVC:
+            type = h[1] >> 3;
+            vcl = type <= 11;
+            key = type >= 7 && type <= 9;
+            break;
+        default:
+            break;
+    }
+    if (!vcl) {
+        return;
+    }
+    s.decided = true;
+    if (key) {
+        s.units.back().flags |= TS_AU_KEYFRAME;
+        s.keyframes++;
+    }
+}
+
+int TsAuTable::write(const string& path) const {
+    std::ofstream out(path);
+    out << "pid,offset,size,keyframe,pts\n";
+    char line[128];
+    for (const auto& it : mStreams) {
+        for (const TsAccessUnit& au : it.second.units) {
+            int n = snprintf(line, sizeof(line), "%d,%llu,%u,%d,", it.first, (unsigned long long)au.offset,
+                             au.size, (au.flags & TS_AU_KEYFRAME) ? 1 : 0);
+            if (au.flags & TS_AU_PTS) {
+                snprintf(line + n, sizeof(line) - n, "%llu", (unsigned long long)au.pts);
+            }
+            out << line << '\n';
+        }
+    }
+    if (!out) {
+        std::cerr << "Cannot write the access unit table to " << path << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+void TsAuTable::printSummary(std::ostream& out) const {
+    char line[128];
+    for (const auto& it : mStreams) {
+        const Stream& s = it.second;
+        snprintf(line, sizeof(line), "PID 0x%04x %s: %zu access units, %llu keyframes, %llu NALs classified",
+                 it.first, codecName(s.codec), s.units.size(), (unsigned long long)s.keyframes,
+                 (unsigned long long)s.nals);
+        out << line << " (" << TsNalScanner::implName() << " scanner)" << std::endl;
+    }
+}
@@ -0,0 +1,92 @@
+/**
+ * File: TsNal.h
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: NAL start code scanner and per-PID access unit table
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _TS_NAL_H_
+#define _TS_NAL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "PesAssembler.h"
+using namespace std;
+
+typedef enum nal_codec {
+    NAL_CODEC_NONE = 0,
+    NAL_CODEC_H264,  // stream_type 0x1B
+    NAL_CODEC_H265,  // stream_type 0x24
+    NAL_CODEC_VVC,   // stream_type 0x33
+} NalCodec;
+
+#define TS_AU_KEYFRAME  0x01 // H.264 IDR, H.265 IRAP (16..23), VVC IDR/CRA (7..9)
+#define TS_AU_PTS       0x02 // the unit started with a PES header carrying a PTS
+
+class TsNalScanner {
+    public:
+        // Offset of the first 00 00 01 in buf, or -1
+        static long find(const uint8_t* buf, size_t len);
+        static const char* implName();
+};
+
+// One row of the table: a PES with a PTS and the PES packets without one
+// that follow it
+struct TsAccessUnit {
+    uint64_t offset; // input offset of the packet carrying the PES header
+    uint64_t pts;    // with TS_AU_PTS
+    uint32_t size;   // ES bytes
+    uint32_t flags;
+};
+
+/*
+ * Access units of the H.264/H.265/VVC PIDs, fed the assembled PES units.
+ * The NAL start codes of each unit are looked up with TsNalScanner, one
+ * PES span at a time; a start code or NAL header cut by a packet boundary
+ * is finished from the next span. Within an access unit all VCL NALs are
+ * of the same kind, so scanning stops at the first one: most of the bytes
+ * are slice data and are never read.
+ */
+class TsAuTable {
+    public:
+        static int codecFor(uint8_t streamType);
+        static const char* codecName(int codec);
+        void setCodec(int pid, int codec);
+        void unit(const PesUnit& unit);
+        // CSV: pid,offset,size,keyframe,pts
+        int write(const string& path) const;
+        void printSummary(std::ostream& out) const;
+    private:
+        struct Stream {
+            int codec = NAL_CODEC_NONE;
+            vector<TsAccessUnit> units;
+            bool decided = false;   // the first VCL NAL of the unit was seen
+            int zeros = 0;          // trailing zero bytes of the last span, up to 2
+            int headerNeed = 0;     // NAL header bytes still to come
+            int headerHave = 0;
+            uint8_t header[2];
+            uint64_t nals = 0;
+            uint64_t keyframes = 0;
+        };
+        void span(Stream& s, const uint8_t* data, size_t len);
+        size_t startCode(Stream& s, const uint8_t* data, size_t len, size_t pos);
+        void nal(Stream& s);
+        map<int, Stream> mStreams;
+};
+
+#endif /* _TS_NAL_H_ */
@@ -17,371 +17,2206 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 #include "TsParser.h"
+#include "TsCrc.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifndef TS_PARSE_CHUNK_BYTES
+#define TS_PARSE_CHUNK_BYTES (16 << 20) // per worker task in multi-threaded mode
+#endif
+
+#ifndef TS_PIPELINE_BATCH
+#define TS_PIPELINE_BATCH 512           // packets per reader -> parser batch
+#endif
+#ifndef TS_PIPELINE_DEPTH
+#define TS_PIPELINE_DEPTH 8             // batches in flight between two stages
+#endif
+#define TS_PROBE_HEAD (1 << 20)         // read contiguously before striding
+#define TS_PIPELINE_ES_ITEMS 1024       // parser -> writer batch limits
+#define TS_PIPELINE_ES_ARENA (1 << 20)
+
+static uint64_t steadyNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void pinThread(int cpu, const char* stage) {
+    if (cpu < 0) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err != 0) {
+        std::cerr << "Cannot pin " << stage << " thread to CPU " << cpu << ": " << strerror(err) << std::endl;
+    }
+}
+
+// The configurations packet() chooses from, see selectCore()
+template class TsParserCore<TsParserPsi, NoPesSink, NoPcrSink, NoMetricsSink>;
+template class TsParserCore<TsParserPsi, TsParserPes, NoPcrSink, NoMetricsSink>;
+template class TsParserCore<TsParserPsi, TsParserPes, TsParserPcr, TsParserMetrics>;
 
 TsParser::TsParser(const std::string& file_path)
     : mFilePath(file_path),
-      mInFp(nullptr),
-      mLastPcr(0x1fff),
+      mInput(nullptr),
+      mLastPcr(8192, UINT64_MAX),
       mVideoPid(0x1fff),
       mAudioPid(0x1fff),
       mTextPid(0x1fff),
       mPrintPid(0x1fff) {
-    mOutPidsFp.clear();
     mOutPids.clear();
+    rebuildPidTable();
+}
+
+TsParser::~TsParser() {
+    if (mInput) {
+        delete mInput;
+    }
+    mEsWriter.closeAll();
+    delete mMetrics;
+    delete mPcr;
+    delete mMonitor;
+    delete mRemux;
+    delete mAuTable;
+}
+
+void TsParser::setCommand(CommandOption option, void* param) {
+    switch (option) {
+        case OPTION_SET_INPUT_FILE:
+            mFilePath = string((char*)param);
+            break;
+        case OPTION_OUTPUT_PID:
+        {
+            int pid = *(int*)param;
+            if (pid == 0x1fff) {
+                mDumpAllPids = true;
+            } else {
+                mOutPids[pid] = nullptr;
+            }
+            break;
+        }
+        case OPTION_PRINT_PTS:
+        {
+            int pid = *(int*)param;
+            if (pid == 0x1fff) {
+                mPrintAllPids = true;
+            } else {
+                mPrintPid = pid;
+            }
+            mPrintPts = true;
+            rebuildPidTable();
+            break;
+        }
+        case OPTION_SHOW_STREAM_INFO:
+            mShowStreamInfo = true;
+            break;
+        case OPTION_DISABLE_MMAP:
+            mInputConfig.allowMmap = false;
+            break;
+        case OPTION_THREADS:
+            mThreads = *(int*)param;
+            break;
+        case OPTION_ES_BUFFER_SIZE:
+            mEsWriter.config().bufferSize = *(size_t*)param;
+            break;
+        case OPTION_ES_PREALLOCATE:
+            mEsWriter.config().preallocate = *(uint64_t*)param;
+            break;
+        case OPTION_ES_DIRECT_IO:
+            mEsWriter.config().directIo = true;
+            break;
+        case OPTION_ES_STATS:
+            mShowEsStats = true;
+            break;
+        case OPTION_RCVBUF:
+            mInputConfig.rcvBufBytes = *(int*)param;
+            break;
+        case OPTION_URING_DEPTH:
+            mInputConfig.uringDepth = *(int*)param;
+            break;
+        case OPTION_DIRECT_INPUT:
+            mInputConfig.directIo = true;
+            break;
+        case OPTION_IDLE_TIMEOUT:
+            mInputConfig.idleTimeoutMs = *(int*)param;
+            break;
+        case OPTION_DROP_CORRUPT_PES:
+            mDropCorruptPes = true;
+            mPes.setDropCorrupt(true);
+            break;
+        case OPTION_PIPELINE:
+            mPipeline = true;
+            break;
+        case OPTION_BUILD_INDEX:
+            mBuildIndex = true;
+            break;
+        case OPTION_NO_INDEX:
+            mUseIndex = false;
+            break;
+        case OPTION_TIME_FROM:
+            mTimeFrom = *(double*)param;
+            break;
+        case OPTION_TIME_TO:
+            mTimeTo = *(double*)param;
+            break;
+        case OPTION_PROBE:
+            mProbe = true;
+            mShowStreamInfo = true;
+            break;
+        case OPTION_PROBE_BYTES:
+            mProbeBytes = *(uint64_t*)param;
+            break;
+        case OPTION_PROBE_MS:
+            mProbeMs = *(int*)param;
+            break;
+#ifndef TS_NO_METRICS
+        case OPTION_METRICS_FILE:
+            mMetricsPath = string((char*)param);
+            break;
+        case OPTION_METRICS_INTERVAL:
+            mMetricsIntervalMs = *(int*)param;
+            break;
+#else
+        case OPTION_METRICS_FILE:
+        case OPTION_METRICS_INTERVAL:
+            std::cerr << "Metrics are not available in this build (TS_NO_METRICS)" << std::endl;
+            break;
+#endif
+        case OPTION_PCR_REPORT:
+            mPcrReport = true;
+            break;
+        case OPTION_PCR_TIMELINE:
+            mPcrReport = true;
+            mPcrTimelinePath = string((char*)param);
+            break;
+        case OPTION_PCR_WINDOW:
+            mPcrWindowMs = std::max(1, *(int*)param);
+            break;
+        case OPTION_REMOVE_OTHER_PIDS:
+            mRemuxPath = string((char*)param);
+            break;
+        case OPTION_REMUX_KEEP:
+            mRemuxKeep.push_back(*(int*)param);
+            break;
+        case OPTION_PTS_FORMAT:
+            mTimestamps.setFormat(*(int*)param);
+            break;
+        case OPTION_AU_TABLE:
+            mAuTablePath = string((char*)param);
+            break;
+        case OPTION_CHECKPOINT:
+            mCheckpointPath = string((char*)param);
+            break;
+        case OPTION_CHECKPOINT_INTERVAL:
+            mCheckpointIntervalSec = std::max(1, *(int*)param);
+            break;
+        case OPTION_TR101290:
+            mMonitorPath = string((char*)param);
+            break;
+        case OPTION_CHECKPOINT_FORCE:
+            mCheckpointForce = true;
+            break;
+        case OPTION_PIN_CPUS:
+        {
+            const int* cpus = (const int*)param;
+            for (int i = 0; i < STAGE_COUNT; i++) {
+                mPinCpus[i] = cpus[i];
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+size_t TsParser::fillInput(size_t want) {
+    if (mInput->avail() < want && !mInput->isStable() && !mPipelineRunning) {
+        // The window may move: PES payload still waiting for the rest of
+        // its unit has to be copied out first
+        mPes.detach();
+    }
+    TS_METRIC_TIMER(mMetrics, METRIC_STAGE_READ, mInput->avail() < want);
+    return mInput->fill(want);
+}
+
+bool TsParser::readNextTsPacket(const uint8_t*& pkt, bool& isSynced) {
+    bool lost = false;
+    if (isSynced) {
+        size_t n = fillInput(mPacketSize);
+        if (n < TS_PACKET_SIZE) return false;
+        if (mInput->data()[0] == 0x47) {
+            pkt = mInput->data();
+            mReadOffset = mInput->offset();
+            // The last M2TS/RS packet may come without its trailing bytes
+            mInput->consume(n < (size_t)mPacketSize ? n : mPacketSize);
+            return true;
+        }
+        if (mMonitor) {
+            mMonitor->syncByteError(mInput->offset(), mInput->data()[0]);
+        }
+        isSynced = false;
+        lost = true;
+        mSyncLossCount++;
+    }
+
+    const size_t window = 64 * 1024;
+    uint64_t start = mInput->offset();
+    for (;;) {
+        size_t n = fillInput(window);
+        if (n < TS_PACKET_SIZE) return false;
+        size_t scanned = 0;
+        int packet_size = 0;
+        long pos = mSync.scan(mInput->data(), n, mInput->atEnd(), scanned, packet_size);
+        mInput->consume(scanned);
+        if (pos < 0) {
+            if (mInput->atEnd()) {
+                mSkippedBytes += mInput->offset() - start;
+                return false;
+            }
+            continue;
+        }
+        uint64_t skipped = mInput->offset() - start;
+        mSkippedBytes += skipped;
+        if (mSyncLossCount > 0) {
+            *mErr << "Sync lost at offset " << start << ", re-locked after skipping "
+                      << skipped << " bytes (packet size " << packet_size << ")" << std::endl;
+        }
+        if (lost && mMonitor) {
+            mMonitor->syncLoss(mInput->offset(), skipped, mPacketSize);
+        }
+        mPacketSize = packet_size;
+        isSynced = true;
+        pkt = mInput->data();
+        mReadOffset = mInput->offset();
+        n = mInput->avail();
+        mInput->consume(n < (size_t)mPacketSize ? n : mPacketSize);
+        return true;
+    }
+}
+
+int TsParser::parse() {
+    const bool ranged = mTimeFrom >= 0 || mTimeTo >= 0;
+    // The PCR report, -r and the access unit table need every packet,
+    // neither the index nor a probe has them
+    const bool everyPacket = mPcrReport || !mRemuxPath.empty() || !mAuTablePath.empty() || !mMonitorPath.empty();
+    // A checkpointed scan reads the input itself, from where the last run
+    // stopped if its checkpoint is there
+    TsCheckpointReader checkpoint;
+    mCheckpointing = !mCheckpointPath.empty() && checkpointUsable(everyPacket);
+    const int loaded = mCheckpointing ? loadCheckpoint(checkpoint) : 0;
+    if (loaded < 0) {
+        return -1;
+    }
+    const bool resumed = loaded > 0;
+    if (mPrintPts && !resumed) {
+        mTimestamps.begin(*mOut);
+    }
+    if (!mBuildIndex && !everyPacket && !mCheckpointing && (mUseIndex || ranged)) {
+        int ret = 0;
+        if (parseWithIndex(ret)) {
+            mTimestamps.flush(*mOut);
+            return ret;
+        }
+    }
+    if (mProbe && !mBuildIndex && !everyPacket && probe()) {
+        return 0;
+    }
+    mInput = TsInput::create(mFilePath, mInputConfig);
+    if (!mInput) {
+        *mErr << "Cannot open " << mFilePath << std::endl;
+        return -1;
+    }
+    if (mBuildIndex) {
+        TsIndexFingerprint fp;
+        if (TsIndex::fingerprint(mFilePath, fp) == 0) {
+            mIndexBuilder = new TsIndexBuilder();
+            mUnitRandomAccess.assign(8192, 0);
+        } else {
+            *mErr << "An index can only be built for a regular file" << std::endl;
+        }
+    }
+
+    if (!mMetricsPath.empty()) {
+        mMetrics = new TsMetrics();
+    }
+    if (mPcrReport) {
+        mPcr = new TsPcrTimeline(mPcrWindowMs);
+        setPcrPrograms();
+    }
+    if (!mRemuxPath.empty()) {
+        // Runs are copied from the file itself, packets are held by pointer
+        if (!mInput->isStable()) {
+            *mErr << "-r needs a regular file that can be mapped" << std::endl;
+            return -1;
+        }
+        mRemux = new TsRemux(mErr);
+        if (mRemux->open(mFilePath, mRemuxPath) != 0) {
+            delete mRemux;
+            mRemux = nullptr;
+            return -1;
+        }
+        updateRemux();
+    }
+    if (!mAuTablePath.empty()) {
+        mAuTable = new TsAuTable();
+    }
+    if (!mMonitorPath.empty()) {
+        mMonitor = new TsMonitor(mErr);
+        if (mMonitor->open(mMonitorPath) != 0) {
+            delete mMonitor;
+            mMonitor = nullptr;
+            return -1;
+        }
+        setMonitorPids();
+    }
+    const uint8_t* pkt = nullptr;
+    bool isSynced = false;
+    if (resumed && resumeCheckpoint(checkpoint, isSynced) != 0) {
+        *mErr << "Cannot resume from " << mCheckpointPath << ", remove it to start over" << std::endl;
+        return -1;
+    }
+    openOutputs();
+    selectCore();
+    // Payload pointers into a mapping can be queued for writev() as they are
+    mEsStable = mInput->isStable();
+
+    // The index, the PCR timeline, -r, the access unit table and the
+    // TR 101 290 checks need every packet in order
+    const bool ordered = mIndexBuilder || mPcr || mRemux || mAuTable || mMonitor;
+    if (mThreads > 1 && !mShowStreamInfo && mInput->isStable() && !ordered) {
+        // First pass: the PID table only changes until every PMT is known
+        const uint64_t first_pass_limit = 64ULL << 20;
+        while (!isPsiComplete() && mInput->offset() < first_pass_limit && readNextTsPacket(pkt, isSynced)) {
+            mPacketOffset = mReadOffset;
+            packet(pkt);
+        }
+        if (isPsiComplete() && isSynced) {
+            parseChunks();
+        } else if (mInput->avail() > 0) {
+            *mErr << "PSI incomplete after first pass, parsing single-threaded" << std::endl;
+        }
+    } else if (mPipeline && !mShowStreamInfo && !ordered) {
+        parsePipelined();
+    }
+    const bool live = mInput->isLive();
+    const uint64_t checkpointNs = (uint64_t)mCheckpointIntervalSec * 1000000000ULL;
+    uint64_t nextCheckpoint = steadyNs() + checkpointNs;
+    bool interrupted = false;
+    bool stopped = false;
+    // Live input wants each packet as it comes, -r every packet in turn
+    const bool blocks = mBlockDecode && !live && !mRemux;
+    TsPacketBlock block;
+    bool done = false;
+    while (!done) {
+        // Ctrl-C/SIGTERM: a checkpointed scan saves its state, any other
+        // finishes with what it has parsed
+        if (TsInput::stopRequested()) {
+            interrupted = mCheckpointing;
+            stopped = true;
+            break;
+        }
+        const uint64_t before = mPacketIndex;
+        const uint8_t* data = nullptr;
+        if (blocks && isSynced && readBlock(block, data)) {
+            const PidEntry* table = mPidTable.data();
+            switch (mCore) {
+                case CORE_PSI:
+                    done = parseBlock(TsPsiCore(table, {this}, {}, {}, {}), data, block, ordered);
+                    break;
+                case CORE_PES:
+                    done = parseBlock(TsPesCore(table, {this}, {this}, {}, {}), data, block, ordered);
+                    break;
+                default:
+                    done = parseBlock(TsFullCore(table, {this}, {this}, {this}, {this}), data, block, ordered);
+                    break;
+            }
+        } else if (readNextTsPacket(pkt, isSynced)) {
+            mPacketOffset = mReadOffset;
+            packet(pkt);
+            if (mRemux) {
+                feedRemux(pkt);
+            }
+            if (live) {
+                recordLatency();
+                if (mInput->avail() < (size_t)mPacketSize) {
+                    // Everything received so far is parsed, push it out before
+                    // blocking for more
+                    mEsWriter.flushAll();
+                    mTimestamps.flush(*mOut);
+                    mOut->flush();
+                }
+            }
+            // Only re-check when a table added something
+            if (mShowStreamInfo && mPsiChanged && !ordered) {
+                mPsiChanged = false;
+                done = isStreamInfoComplete();
+            }
+        } else {
+            break;
+        }
+
+        // Every 4096 packets; a block may step over the multiple itself
+        const bool tick = (before >> 12) != (mPacketIndex >> 12);
+        TS_METRIC(mMetrics, if (mMetricsIntervalMs > 0 && tick &&
+                                mMetrics->snapshotDue(mMetricsIntervalMs)) mMetrics->write(mMetricsPath, mErr));
+        if (mCheckpointing && tick && steadyNs() >= nextCheckpoint) {
+            writeCheckpoint();
+            nextCheckpoint = steadyNs() + checkpointNs;
+        }
+    }
+
+    if (interrupted) {
+        // Ctrl-C: what is open stays open, the next run continues it
+        int ret = writeCheckpoint();
+        if (ret == 0) {
+            *mErr << "Interrupted at offset " << mInput->offset() << ", state saved to " << mCheckpointPath << std::endl;
+        }
+        mEsWriter.closeAll();
+        delete mInput;
+        mInput = nullptr;
+        return ret;
+    }
+    if (stopped && !live) {
+        *mErr << "Interrupted at offset " << mInput->offset() << std::endl;
+    }
+    int ret = mRemux ? finishRemux() : 0;
+    finishParse(live);
+    if (mCheckpointing) {
+        unlink(mCheckpointPath.c_str());
+    }
+    if (mIndexBuilder) {
+        string path = TsIndex::pathFor(mFilePath);
+        mPes.flushAll();
+        if (stopped) {
+            // Later runs would trust a partial index, leave none
+            *mErr << "Index not written, the parse did not reach the end" << std::endl;
+        } else if (mIndexBuilder->write(path, mFilePath, mPacketSize, mErr) == 0) {
+            *mErr << "Index written to " << path << " (" << mIndexBuilder->entries() << " PES entries)" << std::endl;
+        }
+        delete mIndexBuilder;
+        mIndexBuilder = nullptr;
+    }
+    if (mAuTable) {
+        if (mAuTable->write(mAuTablePath) == 0) {
+            mAuTable->printSummary(*mErr);
+        }
+        delete mAuTable;
+        mAuTable = nullptr;
+    }
+    if (mPcr) {
+        mPcr->printReport(*mOut);
+        if (!mPcrTimelinePath.empty()) {
+            mPcr->writeTimeline(mPcrTimelinePath);
+        }
+        delete mPcr;
+        mPcr = nullptr;
+    }
+    if (mMonitor) {
+        if (mMonitor->close() != 0) {
+            ret = -1;
+        }
+        mMonitor->printReport(*mOut);
+        delete mMonitor;
+        mMonitor = nullptr;
+    }
+    return ret;
+}
+
+void TsParser::finishParse(bool live) {
+    // Units still open at the end are complete as far as we will ever know
+    mPes.flushAll();
+    mTimestamps.flush(*mOut);
+    // Queued fragments may point into the input, write them before it goes
+    mEsWriter.closeAll();
+    for (auto& out : mOutPids) {
+        out.second = nullptr;
+    }
+    rebuildPidTable();
+    if (mShowEsStats) {
+        mEsWriter.printStats(*mErr);
+    }
+    if (live) {
+        printLatency();
+    }
+    if (mSyncLossCount > 0) {
+        *mErr << "Sync lost " << mSyncLossCount << " times, " << mSkippedBytes
+                  << " bytes skipped (" << TsSyncScanner::implName() << " scanner)" << std::endl;
+    }
+    if (mCrcErrors > 0) {
+        *mErr << "PSI sections with CRC errors: " << mCrcErrors << " (rejected, "
+                  << tsCrcImplName() << " CRC)" << std::endl;
+    }
+    if (mPes.ccErrors() > 0) {
+        *mErr << "PES continuity errors: " << mPes.ccErrors()
+                  << (mDropCorruptPes ? " (units dropped)" : " (units flagged)") << std::endl;
+    }
+    TS_METRIC(mMetrics, mMetrics->write(mMetricsPath, mErr));
+    delete mInput;
+    mInput = nullptr;
+}
+
+// Checkpoints cover the plain single-threaded scan of a regular file: the
+// state of the other modes is not saved
+bool TsParser::checkpointUsable(bool everyPacket) {
+    const char* reason = nullptr;
+    if (mShowStreamInfo) {
+        reason = "-s";
+    } else if (everyPacket || mBuildIndex) {
+        reason = "--index, --pcr, -r, --au-table and --tr101290";
+    } else if (mThreads > 1 || mPipeline) {
+        reason = "-j and --pipeline";
+    } else if (!mMetricsPath.empty()) {
+        reason = "--metrics";
+    } else if (mTimeFrom >= 0 || mTimeTo >= 0) {
+        reason = "--from/--to";
+    } else if (TsIndex::fingerprint(mFilePath, mCheckpointInput) != 0) {
+        reason = "an input that is not a regular file";
+    }
+    if (reason) {
+        *mErr << "--checkpoint is not available with " << reason << ", ignored" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// FNV-1a over the options that decide what the run writes
+uint64_t TsParser::checkpointOptions() const {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    auto mix = [&hash](uint64_t value) {
+        for (int i = 0; i < 8; i++) {
+            hash = (hash ^ ((value >> (i * 8)) & 0xff)) * 0x100000001b3ULL;
+        }
+    };
+    for (const auto& out : mOutPids) {
+        mix(out.first);
+    }
+    mix(mDumpAllPids);
+    mix(mPrintPts);
+    mix(mPrintAllPids);
+    mix(mPrintPid);
+    mix(mTimestamps.format());
+    mix(mDropCorruptPes);
+    return hash;
+}
+
+// 1: the checkpoint is there and belongs to this input and options, 0: start
+// from the beginning, -1: it belongs to another run, which keeps it unless
+// --force was given
+int TsParser::loadCheckpoint(TsCheckpointReader& checkpoint) {
+    mCheckpointOptions = checkpointOptions();
+    if (checkpoint.open(mCheckpointPath, mErr) != 0) {
+        return 0;
+    }
+    const TsCheckpointHeader& h = checkpoint.header();
+    if (h.fileSize != mCheckpointInput.size || h.fileMtime != mCheckpointInput.mtime ||
+        h.checksum != mCheckpointInput.checksum || h.options != mCheckpointOptions) {
+        if (mCheckpointForce) {
+            *mErr << "Replacing checkpoint " << mCheckpointPath << " of another input or other options" << std::endl;
+            return 0;
+        }
+        *mErr << "Checkpoint " << mCheckpointPath << " belongs to another input or other options,"
+              << " remove it or add --force to start over" << std::endl;
+        return -1;
+    }
+    return 1;
+}
+
+static void putPesStream(TsCheckpointWriter& out, const PesStream& s) {
+    out.put(s.active);
+    out.put(s.headerDone);
+    out.put(s.lastCc);
+    out.put(s.flags);
+    out.put(s.offset);
+    out.putBytes(s.header, s.headerLength);
+    out.put(s.headerNeed);
+    out.put(s.bounded);
+    out.put(s.remaining);
+    out.put(s.streamId);
+    out.put(s.hasPts);
+    out.put(s.hasDts);
+    out.put(s.pts);
+    out.put(s.dts);
+    out.putBytes(s.owned.data(), s.owned.size());
+    out.put(s.payloadLength);
+}
+
+static bool getPesStream(TsCheckpointReader& in, PesStream& s) {
+    size_t header_length = 0;
+    bool ok = in.get(s.active) && in.get(s.headerDone) && in.get(s.lastCc) && in.get(s.flags) &&
+              in.get(s.offset) && in.getBytes(s.header, sizeof(s.header), header_length) &&
+              in.get(s.headerNeed) && in.get(s.bounded) && in.get(s.remaining) && in.get(s.streamId) &&
+              in.get(s.hasPts) && in.get(s.hasDts) && in.get(s.pts) && in.get(s.dts) &&
+              in.getBytes(s.owned) && in.get(s.payloadLength);
+    s.headerLength = header_length;
+    return ok;
+}
+
+/*
+ * Body of a checkpoint, in this order:
+ *   counters, -p output length
+ *   ES outputs: PID, path, length on disk, unwritten tail
+ *   PSI: cache entries with their sections, PAT first, then the PMTs in
+ *        mPmt order, then the rest; replayed through the parse functions
+ *   partial sections, PES streams (payload copied out), last PCR per PID
+ * Outputs are synced before the checkpoint is renamed into place, so every
+ * byte it counts is on disk; bytes past that are cut off on resume.
+ */
+int TsParser::writeCheckpoint() {
+    TsCheckpointWriter out;
+    out.put(mPacketIndex);
+    out.put(mSyncLossCount);
+    out.put(mSkippedBytes);
+    out.put(mCrcErrors);
+    out.put(mPsiUpdates);
+    out.put(mPes.ccErrors());
+    out.put(mPes.units());
+
+    uint64_t printed = UINT64_MAX;
+    if (mPrintPts && mOut == &std::cout) {
+        mTimestamps.flush(*mOut);
+        mOut->flush();
+        struct stat st;
+        if (fstat(STDOUT_FILENO, &st) == 0 && S_ISREG(st.st_mode)) {
+            fdatasync(STDOUT_FILENO);
+            printed = st.st_size;
+        }
+    }
+    out.put(printed);
+
+    int ret = 0;
+    vector<uint8_t> tail;
+    out.put<uint32_t>(std::count_if(mOutPids.begin(), mOutPids.end(), [](const pair<const int, EsSink*>& o) { return o.second; }));
+    for (const auto& o : mOutPids) {
+        if (!o.second) {
+            continue;
+        }
+        if (o.second->checkpoint(tail) != 0) {
+            ret = -1;
+        }
+        out.put(o.first);
+        out.putBytes(o.second->path().data(), o.second->path().size());
+        out.put<uint64_t>(o.second->length() - tail.size());
+        out.putBytes(tail.data(), tail.size());
+    }
+    // Only now: fragments queued in place may have pointed into the payload
+    // that detach() writes over. What is still in the input window goes
+    // with the checkpoint.
+    mPes.detach();
+
+    vector<uint64_t> keys;
+    for (const auto& entry : mPsiCache) {
+        if (((entry.first >> 32) & 0xff) == 0x00) {
+            keys.push_back(entry.first);
+        }
+    }
+    for (const auto& pmt : mPmt) {
+        for (const auto& entry : mPsiCache) {
+            if (((entry.first >> 32) & 0xff) == 0x02 && ((entry.first >> 8) & 0xffff) == pmt.program_number) {
+                keys.push_back(entry.first);
+            }
+        }
+    }
+    for (const auto& entry : mPsiCache) {
+        uint64_t table = (entry.first >> 32) & 0xff;
+        if (table != 0x00 && table != 0x02) {
+            keys.push_back(entry.first);
+        }
+    }
+    out.put<uint32_t>(keys.size());
+    for (uint64_t key : keys) {
+        const PsiCacheEntry& entry = mPsiCache[key];
+        const vector<uint8_t>& section = mPsiSections[key];
+        out.put(key);
+        out.put(entry.version);
+        out.put(entry.crc);
+        out.putBytes(section.data(), section.size());
+    }
+
+    vector<int> pids;
+    for (int pid = 0; pid < 8192; pid++) {
+        const SectionBuffer* buf = mSections.find(pid);
+        if (buf && buf->collecting) {
+            pids.push_back(pid);
+        }
+    }
+    out.put<uint32_t>(pids.size());
+    for (int pid : pids) {
+        const SectionBuffer& buf = *mSections.find(pid);
+        out.put(pid);
+        out.put(buf.expected_length);
+        out.put(buf.last_cc);
+        out.putBytes(buf.data, buf.length);
+    }
+
+    pids.clear();
+    for (int pid = 0; pid < 8192; pid++) {
+        if (mPes.find(pid)) {
+            pids.push_back(pid);
+        }
+    }
+    out.put<uint32_t>(pids.size());
+    for (int pid : pids) {
+        out.put(pid);
+        putPesStream(out, *mPes.find(pid));
+    }
+
+    pids.clear();
+    for (int pid = 0; pid < 8192; pid++) {
+        if (mLastPcr[pid] != UINT64_MAX) {
+            pids.push_back(pid);
+        }
+    }
+    out.put<uint32_t>(pids.size());
+    for (int pid : pids) {
+        out.put(pid);
+        out.put(mLastPcr[pid]);
+    }
+
+    if (ret != 0) {
+        *mErr << "Output files could not be synced, checkpoint not written" << std::endl;
+        return ret;
+    }
+    TsCheckpointHeader header = {};
+    header.packetSize = mPacketSize;
+    header.fileSize = mCheckpointInput.size;
+    header.fileMtime = mCheckpointInput.mtime;
+    header.checksum = mCheckpointInput.checksum;
+    header.options = mCheckpointOptions;
+    header.offset = mInput->offset();
+    return out.write(mCheckpointPath, header, mErr);
+}
+
+// Puts the parser where writeCheckpoint() left it and the input at the
+// next packet. Runs before openOutputs(): the ES files of the checkpoint are
+// continued, not truncated.
+int TsParser::resumeCheckpoint(TsCheckpointReader& checkpoint, bool& isSynced) {
+    TsCheckpointReader& in = checkpoint;
+    const TsCheckpointHeader& header = in.header();
+    uint64_t cc_errors = 0;
+    uint64_t units = 0;
+    uint64_t printed = 0;
+    if (!(in.get(mPacketIndex) && in.get(mSyncLossCount) && in.get(mSkippedBytes) && in.get(mCrcErrors) &&
+          in.get(mPsiUpdates) && in.get(cc_errors) && in.get(units) && in.get(printed))) {
+        return -1;
+    }
+    mPes.restoreCounters(cc_errors, units);
+    if (printed != UINT64_MAX) {
+        // The interrupted run's -p output is kept up to the checkpoint
+        struct stat st;
+        if (fstat(STDOUT_FILENO, &st) == 0 && S_ISREG(st.st_mode) && (uint64_t)st.st_size >= printed &&
+            ftruncate(STDOUT_FILENO, printed) == 0) {
+            lseek(STDOUT_FILENO, printed, SEEK_SET);
+        } else {
+            *mErr << "-p output before offset " << header.offset
+                  << " is not repeated, append to the interrupted run's output (>>)" << std::endl;
+        }
+    }
+
+    uint32_t count = 0;
+    if (!in.get(count)) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        int pid = 0;
+        vector<uint8_t> path;
+        uint64_t length = 0;
+        vector<uint8_t> tail;
+        if (!(in.get(pid) && in.getBytes(path) && in.get(length) && in.getBytes(tail)) || pid < 0 || pid >= 8192) {
+            return -1;
+        }
+        EsSink* sink = mEsWriter.resume(string(path.begin(), path.end()), length, tail);
+        if (!sink) {
+            return -1;
+        }
+        mOutPids[pid] = sink;
+    }
+
+    if (!in.get(count)) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t key = 0;
+        PsiCacheEntry entry = {};
+        vector<uint8_t> section;
+        if (!(in.get(key) && in.get(entry.version) && in.get(entry.crc) && in.getBytes(section))) {
+            return -1;
+        }
+        mPsiCache[key] = entry;
+        if (section.empty()) {
+            continue;
+        }
+        const int len = section.size();
+        if (section[0] == 0x00) {
+            parsePat(section.data(), len);
+        } else if (section[0] == 0x02) {
+            parsePmt(section.data(), len);
+        } else {
+            parseSdt(section.data(), len);
+        }
+        mPsiSections[key] = std::move(section);
+    }
+
+    if (!in.get(count)) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        int pid = 0;
+        SectionBuffer buf;
+        size_t length = 0;
+        if (!(in.get(pid) && in.get(buf.expected_length) && in.get(buf.last_cc) &&
+              pid >= 0 && pid < 8192 && in.getBytes(buf.data, sizeof(buf.data), length))) {
+            return -1;
+        }
+        SectionBuffer& target = *mSections.get(pid);
+        memcpy(target.data, buf.data, length);
+        target.length = length;
+        target.expected_length = buf.expected_length;
+        target.last_cc = buf.last_cc;
+        target.collecting = true;
+    }
+
+    if (!in.get(count)) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        int pid = 0;
+        PesStream stream;
+        if (!(in.get(pid) && pid >= 0 && pid < 8192 && getPesStream(in, stream))) {
+            return -1;
+        }
+        mPes.restore(pid, stream);
+    }
+
+    if (!in.get(count)) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        int pid = 0;
+        uint64_t pcr = 0;
+        if (!(in.get(pid) && in.get(pcr) && pid >= 0 && pid < 8192)) {
+            return -1;
+        }
+        mLastPcr[pid] = pcr;
+    }
+    if (in.get(count)) {
+        // Nothing follows the last table
+        return -1;
+    }
+
+    // Targeted read, as for a ranged -o: a mapping is not touched before it
+    while (mInput->offset() < header.offset) {
+        size_t n = fillInput(1 << 20);
+        if (n == 0) {
+            break;
+        }
+        mInput->consume(std::min<uint64_t>(n, header.offset - mInput->offset()));
+    }
+    if (mInput->offset() != header.offset) {
+        *mErr << "The input ends before the checkpoint offset " << header.offset << std::endl;
+        return -1;
+    }
+    mPacketSize = header.packetSize;
+    isSynced = true;
+    *mErr << "Resuming from " << mCheckpointPath << " at offset " << header.offset << std::endl;
+    return 0;
+}
+
+// Answers -s, -p and ranged -o from the sidecar index. Returns false if
+// the index is missing or cannot help, the caller then scans the input.
+bool TsParser::parseWithIndex(int& ret) {
+    const bool ranged = mTimeFrom >= 0 || mTimeTo >= 0;
+    const bool want_es = mDumpAllPids || !mOutPids.empty();
+    TsIndex index;
+    if (index.open(TsIndex::pathFor(mFilePath), mFilePath, mErr) != 0) {
+        if (ranged) {
+            *mErr << "--from/--to need an index, build one with --index" << std::endl;
+            ret = -1;
+            return true;
+        }
+        return false;
+    }
+    if (want_es && !ranged) {
+        // Every byte is needed anyway
+        return false;
+    }
+    const TsIndexHeader& header = index.header();
+    for (uint64_t i = 0; i < header.sectionCount; i++) {
+        const TsIndexSection& section = index.sections()[i];
+        const uint8_t* data = index.sectionData(section);
+        mPacketOffset = section.offset;
+        if (!acceptSection(section.pid, data, section.length)) {
+            continue;
+        }
+        if (data[0] == 0x00) {
+            parsePat(data, section.length);
+        } else if (data[0] == 0x02) {
+            parsePmt(data, section.length);
+        } else {
+            parseSdt(data, section.length);
+        }
+    }
+    ret = 0;
+    if (mShowStreamInfo) {
+        return true;
+    }
+    const uint64_t from = mTimeFrom >= 0 ? header.baseTime + (uint64_t)(mTimeFrom * 90000) : 0;
+    const uint64_t to = mTimeTo >= 0 ? header.baseTime + (uint64_t)(mTimeTo * 90000) : UINT64_MAX;
+    const TsIndexPts* entries = index.entries();
+    if (mPrintPts) {
+        for (uint64_t i = 0; i < header.ptsCount; i++) {
+            const TsIndexPts& entry = entries[i];
+            if (entry.time >= from && entry.time < to && mPidTable[entry.pid].printPts) {
+                // The index keeps no PCR per PES, the column stays empty
+                TsTimestampRecord record = {};
+                record.offset = entry.offset;
+                record.pts = entry.pts;
+                record.dts = entry.dts;
+                record.pid = entry.pid;
+                record.flags = (entry.flags & TS_INDEX_DTS) ? TS_RECORD_DTS : 0;
+                printTimestamp(record);
+            }
+        }
+        mPtsFromIndex = true;
+    }
+    if (!want_es) {
+        return true;
+    }
+
+    // Byte range per PID: from the last keyframe at or before 'from' up to
+    // the first unit at or after 'to'
+    mUnitRange.assign(8192, {0, 0});
+    uint64_t start = header.fileSize;
+    uint64_t end = 0;
+    for (int pid = 0; pid < 8192; pid++) {
+        if (mPidTable[pid].role != PID_ROLE_PES || !(mDumpAllPids || mOutPids.count(pid))) {
+            continue;
+        }
+        uint64_t count = 0;
+        const uint32_t* list = index.pidEntries(pid, count);
+        if (!list) {
+            continue;
+        }
+        uint64_t first = index.lowerBound(pid, from);
+        uint64_t last = index.lowerBound(pid, to);
+        bool has_keyframes = false;
+        for (uint64_t i = 0; i < count && !has_keyframes; i++) {
+            has_keyframes = entries[list[i]].flags & TS_INDEX_KEYFRAME;
+        }
+        while (has_keyframes && first > 0 && (first == count || !(entries[list[first]].flags & TS_INDEX_KEYFRAME))) {
+            first--;
+        }
+        uint64_t range_start = first < count ? entries[list[first]].offset : header.fileSize;
+        uint64_t range_end = last < count ? entries[list[last]].offset : header.fileSize;
+        if (range_start >= range_end) {
+            continue;
+        }
+        mUnitRange[pid] = {range_start, range_end};
+        start = std::min(start, range_start);
+        end = std::max(end, range_end);
+    }
+
+    mInput = TsInput::create(mFilePath, mInputConfig);
+    if (!mInput) {
+        *mErr << "Cannot open " << mFilePath << std::endl;
+        ret = -1;
+        return true;
+    }
+    openOutputs();
+    mEsStable = mInput->isStable();
+    mRangeActive = true;
+    // Targeted read: a mapping is only touched from 'start' on
+    while (start < end && mInput->offset() < start) {
+        size_t n = fillInput(1 << 20);
+        if (n == 0) {
+            break;
+        }
+        mInput->consume(std::min<uint64_t>(n, start - mInput->offset()));
+    }
+    const uint8_t* pkt = nullptr;
+    bool isSynced = false;
+    while (start < end && !TsInput::stopRequested() && readNextTsPacket(pkt, isSynced) && mReadOffset <= end) {
+        mPacketOffset = mReadOffset;
+        packet(pkt);
+    }
+    finishParse(false);
+    mRangeActive = false;
+    return true;
+}
+
+void TsParser::rebuildPidTable() {
+    mPidTable.assign(8192, PidEntry());
+    // Later assignments win: PAT/SDT over PMT over PES
+    for (const auto& pmt : mPmt) {
+        for (const auto& stream : pmt.streams) {
+            PidEntry& entry = mPidTable[stream.elementary_pid];
+            entry.role = PID_ROLE_PES;
+            entry.printPts = mPrintAllPids || mPrintPid == stream.elementary_pid;
+            entry.pcrPid = pmt.pcr_pid;
+            auto it = mOutPids.find(stream.elementary_pid);
+            entry.out = it != mOutPids.end() ? it->second : nullptr;
+            entry.assemble = entry.printPts || mDumpAllPids || it != mOutPids.end() || mIndexBuilder;
+            if (mAuTable) {
+                int codec = TsAuTable::codecFor(stream.stream_type);
+                mAuTable->setCodec(stream.elementary_pid, codec);
+                entry.assemble = entry.assemble || codec != NAL_CODEC_NONE;
+            }
+        }
+    }
+    for (const auto& program : mPat) {
+        PidEntry& entry = mPidTable[program.second];
+        entry = PidEntry();
+        entry.role = PID_ROLE_PMT;
+        entry.sectionBuf = mSections.get(program.second);
+    }
+    PidEntry& sdt = mPidTable[0x0011];
+    sdt = PidEntry();
+    sdt.role = PID_ROLE_SDT;
+    sdt.sectionBuf = mSections.get(0x0011);
+    PidEntry& pat = mPidTable[0x0000];
+    pat = PidEntry();
+    pat.role = PID_ROLE_PAT;
+    pat.sectionBuf = mSections.get(0x0000);
+    mPidTable[0x1fff] = PidEntry();
+    mPidTable[0x1fff].role = PID_ROLE_NULL;
+    if (mPcr) {
+        setPcrPrograms();
+    }
+    if (mMonitor) {
+        setMonitorPids();
+    }
+    if (mRemux) {
+        updateRemux();
+    }
+}
+
+// Tells the PCR timeline which PIDs each program clock covers
+void TsParser::setPcrPrograms() {
+    for (const auto& pmt : mPmt) {
+        vector<int> pids;
+        auto it = mPat.find(pmt.program_number);
+        if (it != mPat.end()) {
+            pids.push_back(it->second);
+        }
+        for (const auto& stream : pmt.streams) {
+            pids.push_back(stream.elementary_pid);
+        }
+        if (std::find(pids.begin(), pids.end(), pmt.pcr_pid) == pids.end()) {
+            pids.push_back(pmt.pcr_pid);
+        }
+        mPcr->setProgram(pmt.program_number, pmt.pcr_pid, pids);
+    }
+}
+
+// Tells the TR 101 290 checks which PMT, elementary stream and PCR PIDs
+// PAT and the PMTs refer to
+void TsParser::setMonitorPids() {
+    vector<int> pmtPids;
+    vector<int> esPids;
+    vector<int> pcrPids;
+    auto add = [](vector<int>& pids, int pid) {
+        if (std::find(pids.begin(), pids.end(), pid) == pids.end()) {
+            pids.push_back(pid);
+        }
+    };
+    for (const auto& program : mPat) {
+        add(pmtPids, program.second);
+    }
+    for (const auto& pmt : mPmt) {
+        for (const auto& stream : pmt.streams) {
+            add(esPids, stream.elementary_pid);
+        }
+        if (pmt.pcr_pid != 0x1fff) {
+            add(pcrPids, pmt.pcr_pid);
+        }
+    }
+    mMonitor->setPids(pmtPids, esPids, pcrPids);
+}
+
+// Video, audio and subtitles: what -r keeps unless --keep says otherwise
+static bool isAvTextStream(uint8_t streamType, const string& desc) {
+    switch (streamType) {
+        case 0x05:
+            return false;
+        case 0x06:
+            return desc == "AC3 Audio" || desc == "DTS Audio" || desc == "Subtitles";
+        default:
+            return desc.compare(0, 7, "Unknown") != 0;
+    }
+}
+
+// -r: the PIDs copied out, the PAT/PMT PIDs rewritten and the programs left.
+// A program stays when one of its streams does, with its PMT and PCR PIDs.
+void TsParser::updateRemux() {
+    vector<uint8_t> keep(8192, 0);
+    vector<uint8_t> psi(8192, 0);
+    vector<int> programs;
+    keep[0x0000] = psi[0x0000] = 1;
+    // CAT and the DVB SI tables go through as they are
+    keep[0x0001] = 1;
+    for (int pid = 0x0010; pid <= 0x0014; pid++) {
+        keep[pid] = 1;
+    }
+    for (const auto& pmt : mPmt) {
+        bool kept = false;
+        for (const auto& stream : pmt.streams) {
+            const int pid = stream.elementary_pid;
+            bool wanted;
+            if (mRemuxKeep.empty()) {
+                auto info = mStreamInfo.find(pid);
+                wanted = isAvTextStream(stream.stream_type, info != mStreamInfo.end() ? info->second : string());
+            } else {
+                wanted = std::find(mRemuxKeep.begin(), mRemuxKeep.end(), pid) != mRemuxKeep.end();
+            }
+            if (wanted) {
+                keep[pid] = 1;
+                kept = true;
+            }
+        }
+        if (!kept) {
+            continue;
+        }
+        programs.push_back(pmt.program_number);
+        auto it = mPat.find(pmt.program_number);
+        if (it != mPat.end()) {
+            keep[it->second] = psi[it->second] = 1;
+        }
+        if (pmt.pcr_pid < 0x1fff) {
+            keep[pmt.pcr_pid] = 1;
+        }
+    }
+    mRemux->setKeep(keep, psi, programs);
+}
+
+// Until every PMT is known the PAT cannot be rewritten: the packets wait,
+// by pointer into the mapping, as long as TS_REMUX_HOLD_LIMIT allows
+void TsParser::feedRemux(const uint8_t* pkt) {
+    const size_t len = mInput->offset() - mReadOffset;
+    if (!mRemux->holding()) {
+        mRemux->packet(pkt, mReadOffset, len, mPacketSize);
+        return;
+    }
+    mRemux->hold(pkt, mReadOffset, len, mPacketSize);
+    if (isPsiComplete() || mReadOffset >= TS_REMUX_HOLD_LIMIT) {
+        mRemux->release();
+    }
+}
+
+int TsParser::finishRemux() {
+    int ret = mRemux->finish();
+    const TsRemuxStats& stats = mRemux->stats();
+    char line[200];
+    snprintf(line, sizeof(line), "Remux: kept %llu of %llu packets, %.1f MB copied by the kernel, "
+             "%.1f MB buffered, %llu PSI packets rewritten", (unsigned long long)stats.keptPackets,
+             (unsigned long long)stats.packets, stats.copiedBytes / 1048576.0, stats.bufferedBytes / 1048576.0,
+             (unsigned long long)stats.psiPackets);
+    *mErr << line << std::endl;
+    delete mRemux;
+    mRemux = nullptr;
+    return ret;
+}
+
+void TsParser::recordLatency() {
+    uint64_t arrival = mInput->arrivalNs(mInput->offset() - 1);
+    if (arrival == 0) {
+        return;
+    }
+    uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    uint64_t ns = now > arrival ? now - arrival : 0;
+    mLatency.count++;
+    mLatency.sumNs += ns;
+    mLatency.maxNs = std::max(mLatency.maxNs, ns);
+    uint64_t us = ns / 1000;
+    int bucket = 0;
+    while (us > 1 && bucket < 31) {
+        us >>= 1;
+        bucket++;
+    }
+    mLatency.buckets[bucket]++;
+}
+
+void TsParser::printLatency() {
+    if (mLatency.count == 0) {
+        return;
+    }
+    // Upper bound of the bucket holding the 99th percentile
+    uint64_t target = mLatency.count - mLatency.count / 100;
+    uint64_t seen = 0;
+    int p99 = 0;
+    for (; p99 < 31; p99++) {
+        seen += mLatency.buckets[p99];
+        if (seen >= target) {
+            break;
+        }
+    }
+    // The bucket bound may lie past anything seen
+    const uint64_t maxUs = mLatency.maxNs / 1000;
+    *mErr << "Latency (arrival to callback) over " << mLatency.count << " packets: avg "
+          << mLatency.sumNs / mLatency.count / 1000 << " us, p99 <= " << std::min<uint64_t>(2ULL << p99, maxUs)
+          << " us, max " << maxUs << " us" << std::endl;
 }
 
-TsParser::~TsParser() {
-    if (mInFp) {
-        fclose(mInFp);
+bool TsParser::isPsiComplete() const {
+    if (!isHasGetPat || mPmt.size() < mPat.size()) {
+        return false;
     }
-    for (auto& fp : mOutPidsFp) {
-        if (fp) {
-            fclose(fp);
+    for (const auto& entry : mPat) {
+        bool found = false;
+        for (const auto& pmt : mPmt) {
+            if (pmt.program_number == entry.first && pmt.isGotPmt) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            return false;
         }
     }
+    return true;
 }
 
-void TsParser::setCommand(CommandOption option, void* param) {
-    switch (option) {
-        case OPTION_SET_INPUT_FILE:
-            mFilePath = string((char*)param);
-            break;
-        case OPTION_OUTPUT_PID:
-        {
-            int pid = *(int*)param;
-            if (pid == 0x1fff) {
-                mDumpAllPids = true;
-            } else {
-                char out_filename[256];
-                sprintf(out_filename, "out_%04x.es", pid);
-                FILE* out_fp = fopen(out_filename, "wb");
-                if (out_fp) {
-                    mOutPidsFp.push_back(out_fp);
-                    mOutPids[pid] = out_fp;
-                } else {
-                    std::cerr << "Cannot open output file: " << out_filename << std::endl;
-                }
+bool TsParser::isStreamInfoComplete(ProbeReport* report) const {
+    int pmts = 0;
+    int services = 0;
+    for (const auto& entry : mPat) {
+        for (const auto& pmt : mPmt) {
+            if (pmt.program_number == entry.first && pmt.isGotPmt) {
+                pmts++;
+                services += pmt.isGotServiceInfo ? 1 : 0;
+                break;
             }
+        }
+    }
+    bool complete = !mPat.empty() && pmts == (int)mPat.size() && services == (int)mPat.size();
+    if (report) {
+        report->programs = mPat.size();
+        report->pmts = pmts;
+        report->services = services;
+        report->complete = complete;
+    }
+    return complete;
+}
+
+// -s on a regular file within a byte and time budget: read the head, then
+// small windows spread over the rest of the file, until PAT, every PMT and
+// the SDT entries are known. Returns false if the input cannot be probed.
+bool TsParser::probe() {
+    int fd = ::open(mFilePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return false;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+    const uint64_t file_size = st.st_size;
+    // The budget is a limit, each window is clamped to what is left of it
+    const uint64_t budget = mProbeBytes;
+    const uint64_t head = std::min<uint64_t>(budget / 2, TS_PROBE_HEAD);
+    const uint64_t start = steadyNs();
+    vector<uint8_t> buf(std::min<uint64_t>(budget, TS_PROBE_WINDOW));
+    ProbeReport& report = mProbeReport;
+    uint64_t offset = 0;
+    uint64_t stride = 0;
+    bool complete = false;
+    std::ostringstream err;
+    std::ostream* saved_err = mErr;
+    mErr = &err; // resync notes are expected at every jump
+    while (!complete && offset < file_size && report.bytesRead < budget &&
+           steadyNs() - start < (uint64_t)mProbeMs * 1000000) {
+        size_t want = std::min<uint64_t>(TS_PROBE_WINDOW, budget - report.bytesRead);
+        ssize_t n = pread(fd, buf.data(), want, offset);
+        if (n <= 0) {
             break;
         }
-        case OPTION_PRINT_PTS:
-        {
-            int pid = *(int*)param;
-            if (pid == 0x1fff) {
-                mPrintAllPids = true;
-            } else {
-                mPrintPid = pid;
+        report.bytesRead += n;
+        report.reads++;
+        // Sections never continue across a jump
+        mSections.reset();
+        TsMemoryInput input(buf.data(), n, offset);
+        mInput = &input;
+        const uint8_t* pkt = nullptr;
+        bool isSynced = false;
+        while (readNextTsPacket(pkt, isSynced)) {
+            mPacketOffset = mReadOffset;
+            packet(pkt);
+            if (mPsiChanged) {
+                mPsiChanged = false;
+                if ((complete = isStreamInfoComplete())) {
+                    break;
+                }
             }
-            mPrintPts = true;
-            break;
         }
-        case OPTION_SHOW_STREAM_INFO:
-            mShowStreamInfo = true;
-            break;
-        default:
+        mInput = nullptr;
+        if (offset + n < head) {
+            offset += n;
+            continue;
+        }
+        if (stride == 0) {
+            // Spread the rest of the budget evenly over the rest of the file
+            uint64_t reads = std::max<uint64_t>(1, (budget - report.bytesRead) / TS_PROBE_WINDOW);
+            uint64_t from = offset + n;
+            stride = std::max<uint64_t>(TS_PROBE_WINDOW, (file_size - std::min(file_size, from)) / reads);
+            offset = from + stride / 2 - std::min<uint64_t>(stride / 2, TS_PROBE_WINDOW / 2);
+        } else {
+            offset += stride;
+        }
+    }
+    mErr = saved_err;
+    mSyncLossCount = 0;
+    mSkippedBytes = 0;
+    ::close(fd);
+    isStreamInfoComplete(&report);
+    report.done = true;
+    report.elapsedUs = (steadyNs() - start) / 1000;
+    return true;
+}
+
+void TsParser::initWorker(const TsParser& master) {
+    mPidTable = master.mPidTable;
+    // Workers handle PES with the tables of the first pass, and only watch
+    // PAT/PMT for a new version that makes their chunk void
+    for (int pid = 0; pid < (int)mPidTable.size(); pid++) {
+        PidEntry& entry = mPidTable[pid];
+        if (entry.role == PID_ROLE_PAT || entry.role == PID_ROLE_PMT) {
+            entry.sectionBuf = mSections.get(pid);
+        } else if (entry.role != PID_ROLE_PES && entry.role != PID_ROLE_NULL) {
+            entry = PidEntry();
+        }
+        entry.out = nullptr;
+    }
+    mPsiCache = master.mPsiCache;
+    mPsiWatch = true;
+    mDumpAllPids = master.mDumpAllPids;
+    mPrintPts = master.mPrintPts;
+    mPrintAllPids = master.mPrintAllPids;
+    mPrintPid = master.mPrintPid;
+    mTimestamps.setFormat(master.mTimestamps.format());
+    mShowStreamInfo = master.mShowStreamInfo;
+    mPacketSize = master.mPacketSize;
+    mCaptureEs = true;
+    mCaptureBuf.resize(8192);
+    mChunkPesSlot.assign(8192, -1);
+    mDropCorruptPes = master.mDropCorruptPes;
+    mPes.setDropCorrupt(mDropCorruptPes);
+    mOutPids = master.mOutPids; // only used to decide what to capture
+    if (master.mMetrics) {
+        mMetrics = new TsMetrics();
+    }
+    selectCore();
+}
+
+void TsParser::parseChunk(const uint8_t* data, size_t size, uint64_t dataOffset, uint64_t start, uint64_t end, int packetSize, bool startSynced, ParseChunkResult& result) {
+    // The window runs to the end of the input so a resync may look past 'end'
+    TsMemoryInput input(data + start, size - start, dataOffset + start);
+    std::ostringstream out;
+    std::ostringstream err;
+    mInput = &input;
+    mOut = &out;
+    mErr = &err;
+    mOutMarks = &result.outMarks;
+    mChunkPes = &result.pes;
+    mPacketIndex = 0;
+    mSyncLossCount = 0;
+    mSkippedBytes = 0;
+    mCrcErrors = 0;
+    mPacketSize = packetSize;
+    // Chunks of one worker are not adjacent, sections do not continue
+    mSections.reset();
+    mPsiChangeSeen = false;
+    result.startPacketSize = packetSize;
+    const uint8_t* pkt = nullptr;
+    bool isSynced = startSynced || (size - start >= TS_PACKET_SIZE && data[start] == 0x47);
+    bool first = true;
+    while (readNextTsPacket(pkt, isSynced)) {
+        uint64_t offset = pkt - data;
+        if (first) {
+            // Bytes skipped to find the first packet belong to the previous chunk
+            mSkippedBytes = 0;
+            result.firstPacket = dataOffset + offset;
+            first = false;
+        }
+        if (offset >= end) {
+            result.nextPacket = dataOffset + offset;
             break;
+        }
+        mPacketOffset = mReadOffset;
+        packet(pkt);
+    }
+    if (first) {
+        result.firstPacket = UINT64_MAX;
+    }
+    // Open units are finished by the next chunk
+    for (auto& c : result.pes) {
+        if (c.started) {
+            c.tail = std::move(*mPes.find(c.pid));
+        }
+        mChunkPesSlot[c.pid] = -1;
+    }
+    result.ccErrors = mPes.ccErrors();
+    mPes.reset();
+    for (int pid = 0; pid < (int)mCaptureBuf.size(); pid++) {
+        if (!mCaptureBuf[pid].empty()) {
+            result.es.emplace_back(pid, std::move(mCaptureBuf[pid]));
+            mCaptureBuf[pid].clear();
+        }
     }
+    mTimestamps.flush(out);
+    result.out = out.str();
+    result.err = err.str();
+    result.packets = mPacketIndex;
+    result.syncLossCount = mSyncLossCount;
+    result.skippedBytes = mSkippedBytes;
+    result.crcErrors = mCrcErrors;
+    result.psiChanged = mPsiChangeSeen;
+    result.endPacketSize = mPacketSize;
+    // Counted per chunk, so a chunk that is parsed again is not counted twice
+    TS_METRIC(mMetrics, result.metrics.reset(mMetrics), mMetrics = new TsMetrics());
+    mInput = nullptr;
+    mOut = &std::cout;
+    mErr = &std::cerr;
+    mOutMarks = nullptr;
+    mChunkPes = nullptr;
 }
 
-bool TsParser::readNextTsPacket(FILE* fp, uint8_t* pkt, bool& isSynced) {
-    if (!isSynced) {
-        int c;
-        while ((c = fgetc(fp)) != EOF) {
-            if (c == 0x47) {
-                pkt[0] = 0x47;
-                size_t n = fread(pkt + 1, 1, 187, fp);
-                if (n < 187) return false;
-                int next = fgetc(fp);
-                if (next == 0x47) {
-                    fseek(fp, -1, SEEK_CUR);
-                    isSynced = true;
-                    return true;
-                } else if (next == EOF) {
-                    return false;
+void TsParser::parseChunks() {
+    const uint8_t* data = mInput->data();
+    const uint64_t data_offset = mInput->offset();
+    const size_t size = mInput->avail();
+    const size_t chunk_bytes = (size_t)TS_PARSE_CHUNK_BYTES / mPacketSize * mPacketSize;
+    const size_t chunk_count = (size + chunk_bytes - 1) / chunk_bytes;
+    const size_t max_in_flight = mThreads * 2;
+    vector<ParseChunkResult> results(chunk_count);
+    std::mutex lock;
+    std::condition_variable cond;
+    size_t next_chunk = 0;
+    size_t written = 0;
+
+    auto worker = [&]() {
+        TsParser parser;
+        parser.initWorker(*this);
+        for (;;) {
+            size_t index;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                cond.wait(guard, [&]() { return next_chunk >= chunk_count || next_chunk < written + max_in_flight; });
+                if (next_chunk >= chunk_count) {
+                    return;
                 }
-                fseek(fp, -187, SEEK_CUR);
+                index = next_chunk++;
+            }
+            ParseChunkResult result;
+            size_t start = index * chunk_bytes;
+            size_t end = std::min(start + chunk_bytes, size);
+            parser.parseChunk(data, size, data_offset, start, end, mPacketSize, index == 0, result);
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                results[index] = std::move(result);
+                results[index].done = true;
             }
+            cond.notify_all();
         }
-        return false;
-    } else {
-        size_t n = fread(pkt, 1, 188, fp);
-        return n == 188;
+    };
+    vector<std::thread> threads;
+    for (int i = 0; i < mThreads; i++) {
+        threads.emplace_back(worker);
+    }
+
+    // Stitch chunk results back together in input order
+    uint64_t expected = data_offset;
+    uint64_t resume = UINT64_MAX; // PSI changed: parse single-threaded from here
+    int packet_size = mPacketSize;
+    TsParser redo;
+    redo.initWorker(*this);
+    for (size_t i = 0; i < chunk_count; i++) {
+        if (TsInput::stopRequested()) {
+            // Hand out no more chunks, parse() stops at what is written
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                next_chunk = chunk_count;
+            }
+            cond.notify_all();
+            resume = expected;
+            break;
+        }
+        ParseChunkResult result;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            cond.wait(guard, [&]() { return results[i].done; });
+            result = std::move(results[i]);
+        }
+        if (expected == UINT64_MAX) {
+            // Sync was never found again before the end of the input
+            result = ParseChunkResult();
+        } else if (result.firstPacket != expected || result.startPacketSize != packet_size) {
+            // The worker guessed the packet grid at the chunk start wrongly
+            // (sync was lost across the boundary), parse it again from where
+            // the previous chunk really stopped
+            size_t end = std::min((i + 1) * chunk_bytes, size);
+            result = ParseChunkResult();
+            if (expected - data_offset < end) {
+                redo.parseChunk(data, size, data_offset, expected - data_offset, end, packet_size, true, result);
+            } else {
+                result.firstPacket = expected;
+                result.nextPacket = expected;
+                result.endPacketSize = packet_size;
+            }
+        }
+        if (result.psiChanged) {
+            // The tables the workers use are out of date from this chunk on
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                next_chunk = chunk_count;
+            }
+            cond.notify_all();
+            resume = expected;
+            break;
+        }
+        // Finish the units the previous chunk left open, in input order
+        vector<pair<const uint8_t*, int>> lead;
+        for (const auto& c : result.pes) {
+            lead.insert(lead.end(), c.lead.begin(), c.lead.end());
+        }
+        std::sort(lead.begin(), lead.end());
+        std::ostringstream lead_out;
+        vector<pair<uint64_t, size_t>> lead_marks;
+        std::ostream* out = mOut;
+        mTimestamps.flush(*mOut);
+        mOut = &lead_out;
+        mOutMarks = &lead_marks;
+        for (const auto& p : lead) {
+            const uint8_t* pkt = p.first;
+            int pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+            mPacketOffset = data_offset + (pkt - data);
+            mPes.push(pid, pkt + p.second, std::max(0, 188 - p.second), pkt[3] & 0x0F, false, mPacketOffset);
+        }
+        for (auto& c : result.pes) {
+            if (c.started) {
+                mPes.handOver(c.pid, c.firstCc, c.tail);
+            }
+        }
+        mTimestamps.flush(lead_out);
+        mOut = out;
+        mOutMarks = nullptr;
+        mEsStable = false; // result buffers are freed below
+        for (auto& es : result.es) {
+            saveEs(es.second.data(), es.second.size(), es.first);
+        }
+        mEsStable = mInput->isStable();
+        // Merge PTS lines by packet offset
+        string lead_text = lead_out.str();
+        size_t a = 0, b = 0, pos_a = 0, pos_b = 0;
+        while (a < lead_marks.size() || b < result.outMarks.size()) {
+            if (b == result.outMarks.size() || (a < lead_marks.size() && lead_marks[a].first < result.outMarks[b].first)) {
+                mOut->write(lead_text.data() + pos_a, lead_marks[a].second - pos_a);
+                pos_a = lead_marks[a++].second;
+            } else {
+                mOut->write(result.out.data() + pos_b, result.outMarks[b].second - pos_b);
+                pos_b = result.outMarks[b++].second;
+            }
+        }
+        mOut->write(lead_text.data() + pos_a, lead_text.size() - pos_a);
+        mOut->write(result.out.data() + pos_b, result.out.size() - pos_b);
+        mErr->write(result.err.data(), result.err.size());
+        mPacketIndex += result.packets;
+        mSyncLossCount += result.syncLossCount;
+        mSkippedBytes += result.skippedBytes;
+        mCrcErrors += result.crcErrors;
+        mPes.addCcErrors(result.ccErrors);
+        TS_METRIC(mMetrics, if (result.metrics) mMetrics->merge(*result.metrics));
+        expected = result.nextPacket;
+        packet_size = result.endPacketSize;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            written++;
+        }
+        cond.notify_all();
+    }
+    for (auto& thread : threads) {
+        thread.join();
     }
+    mPacketSize = packet_size;
+    mEsStable = mInput->isStable();
+    if (resume != UINT64_MAX) {
+        if (!TsInput::stopRequested()) {
+            *mErr << "PSI changed at offset " << resume << ", parsing single-threaded from there" << std::endl;
+        }
+        mInput->consume(resume - data_offset);
+        return;
+    }
+    mInput->consume(size);
 }
 
-int TsParser::parse() {
-    mInFp = fopen(mFilePath.c_str(), "rb");
-    if (!mInFp) {
-        std::cerr << "Cannot open " << mFilePath << std::endl;
-        return -1;
+void TsParser::parsePipelined() {
+    const bool stable = mInput->isStable();
+    const bool live = mInput->isLive();
+    vector<PacketBatch> packet_batches(TS_PIPELINE_DEPTH);
+    vector<EsBatch> es_batches(TS_PIPELINE_DEPTH);
+    // Each link has a ring of filled batches and one returning empty ones
+    SpscRing<PacketBatch*> packet_full(TS_PIPELINE_DEPTH);
+    SpscRing<PacketBatch*> packet_free(TS_PIPELINE_DEPTH);
+    SpscRing<EsBatch*> es_full(TS_PIPELINE_DEPTH);
+    SpscRing<EsBatch*> es_free(TS_PIPELINE_DEPTH);
+    for (auto& batch : packet_batches) {
+        batch.packets.reserve(TS_PIPELINE_BATCH);
+        batch.offsets.reserve(TS_PIPELINE_BATCH);
+        if (!stable) {
+            batch.storage.resize(TS_PIPELINE_BATCH * TS_PACKET_SIZE);
+        }
+        packet_free.tryPush(&batch);
+    }
+    for (auto& batch : es_batches) {
+        batch.items.reserve(TS_PIPELINE_ES_ITEMS);
+        batch.arena.reserve(TS_PIPELINE_ES_ARENA + TS_PACKET_SIZE);
+        es_free.tryPush(&batch);
+    }
+    for (auto& stats : mStageStats) {
+        stats = PipelineStageStats();
     }
+    mEsFull = &es_full;
+    mEsFree = &es_free;
+    mPipelineRunning = true;
 
-    uint8_t pkt[188];
-    bool isSynced = false;
-    while (readNextTsPacket(mInFp, pkt, isSynced)) {
-        packet(pkt);
+    // Reader: sync and cut the input into packets; copies them out of a
+    // window that moves (stdio, sockets)
+    auto reader = [&]() {
+        pinThread(mPinCpus[STAGE_READER], "reader");
+        PipelineStageStats& stats = mStageStats[STAGE_READER];
+        uint64_t start = steadyNs();
+        const uint8_t* pkt = nullptr;
+        bool isSynced = false;
+        PacketBatch* batch = nullptr;
+        for (;;) {
+            if (!batch) {
+                stats.blockedNs += packet_free.pop(batch);
+                batch->packets.clear();
+                batch->offsets.clear();
+                batch->last = false;
+            }
+            // Ctrl-C ends the pipeline as the end of the input would
+            bool more = !TsInput::stopRequested() && readNextTsPacket(pkt, isSynced);
+            if (more && !batch->packets.empty() && batch->packetSize != mPacketSize) {
+                // Re-locked on another packet size: a batch holds one size
+                stats.batches++;
+                stats.blockedNs += packet_full.push(batch);
+                stats.blockedNs += packet_free.pop(batch);
+                batch->packets.clear();
+                batch->offsets.clear();
+                batch->last = false;
+            }
+            if (more) {
+                if (batch->packets.empty()) {
+                    batch->packetSize = mPacketSize;
+                }
+                if (!stable) {
+                    uint8_t* copy = batch->storage.data() + batch->packets.size() * TS_PACKET_SIZE;
+                    memcpy(copy, pkt, TS_PACKET_SIZE);
+                    pkt = copy;
+                }
+                batch->packets.push_back(pkt);
+                batch->offsets.push_back(mReadOffset);
+            }
+            // Live inputs pass on what they have rather than wait for a full batch
+            if (!more || batch->packets.size() == TS_PIPELINE_BATCH ||
+                (live && mInput->avail() < (size_t)mPacketSize)) {
+                batch->last = !more;
+                stats.batches++;
+                stats.blockedNs += packet_full.push(batch);
+                batch = nullptr;
+                if (!more) {
+                    break;
+                }
+            }
+        }
+        stats.wallNs = steadyNs() - start;
+    };
+
+    // Parser: PSI, PES reassembly, PTS output; ES goes out in EsBatches
+    auto parser = [&]() {
+        pinThread(mPinCpus[STAGE_PARSER], "parser");
+        PipelineStageStats& stats = mStageStats[STAGE_PARSER];
+        uint64_t start = steadyNs();
+        stats.blockedNs += es_free.pop(mEsBatch);
+        for (;;) {
+            PacketBatch* batch = nullptr;
+            stats.starvedNs += packet_full.pop(batch);
+            stats.batches++;
+            mBatchPacketSize = batch->packetSize;
+            for (size_t i = 0; i < batch->packets.size(); i++) {
+                mPacketOffset = batch->offsets[i];
+                packet(batch->packets[i]);
+            }
+            const bool last = batch->last;
+            if (!stable) {
+                // Open PES units may point into the batch, which is reused
+                mPes.detach();
+            }
+            if (last) {
+                mPes.flushAll();
+                submitEsBatch(true);
+            } else if (live && !mEsBatch->items.empty()) {
+                submitEsBatch(false);
+                mTimestamps.flush(*mOut);
+                mOut->flush();
+            }
+            stats.blockedNs += packet_free.push(batch);
+            if (last) {
+                break;
+            }
+        }
+        stats.wallNs = steadyNs() - start;
+    };
 
-        if (mShowStreamInfo && !mPat.empty()) {
-            int pat_program_count = mPat.size();
-            int got_pmt_count = 0;
-            for (const auto& entry : mPat) {
-                uint16_t program_number = entry.first;
-                for (const auto& pmt : mPmt) {
-                    if (pmt.program_number == program_number && pmt.isGotPmt && pmt.isGotServiceInfo) {
-                        got_pmt_count++;
-                        break;
-                    }
+    // Writer: owns the writev()/write() calls of every ES sink
+    auto writer = [&]() {
+        pinThread(mPinCpus[STAGE_WRITER], "writer");
+        PipelineStageStats& stats = mStageStats[STAGE_WRITER];
+        uint64_t start = steadyNs();
+        vector<EsSink*> sinks;
+        for (;;) {
+            EsBatch* batch = nullptr;
+            stats.starvedNs += es_full.pop(batch);
+            stats.batches++;
+            TS_METRIC_TIMER(mMetrics, METRIC_STAGE_WRITE, true);
+            for (const auto& item : batch->items) {
+                if (item.data) {
+                    item.sink->append(item.data, item.len, true);
+                } else {
+                    item.sink->append(batch->arena.data() + item.offset, item.len, false);
+                }
+                if (std::find(sinks.begin(), sinks.end(), item.sink) == sinks.end()) {
+                    sinks.push_back(item.sink);
                 }
             }
-            if (got_pmt_count == pat_program_count) {
+            const bool last = batch->last;
+            if (live || last) {
+                for (auto sink : sinks) {
+                    sink->flush();
+                }
+            }
+            batch->items.clear();
+            batch->arena.clear();
+            stats.blockedNs += es_free.push(batch);
+            if (last) {
                 break;
             }
         }
+        stats.wallNs = steadyNs() - start;
+    };
+
+    std::thread reader_thread(reader);
+    std::thread parser_thread(parser);
+    std::thread writer_thread(writer);
+    reader_thread.join();
+    parser_thread.join();
+    writer_thread.join();
+    mEsBatch = nullptr;
+    mEsFull = nullptr;
+    mEsFree = nullptr;
+    mPipelineRunning = false;
+    printPipelineStats();
+}
+
+void TsParser::submitEsBatch(bool last) {
+    PipelineStageStats& stats = mStageStats[STAGE_PARSER];
+    mEsBatch->last = last;
+    stats.blockedNs += mEsFull->push(mEsBatch);
+    mEsBatch = nullptr;
+    if (!last) {
+        stats.blockedNs += mEsFree->pop(mEsBatch);
     }
+}
 
-    fclose(mInFp);
-    mInFp = nullptr;
-    return 0;
+void TsParser::printPipelineStats() {
+    static const char* names[STAGE_COUNT] = {"reader", "parser", "writer"};
+    *mErr << "Pipeline stages (" << mPacketIndex << " packets):" << std::endl;
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        const PipelineStageStats& stats = mStageStats[i];
+        double wall = stats.wallNs ? (double)stats.wallNs : 1.0;
+        uint64_t waited = std::min(stats.wallNs, stats.starvedNs + stats.blockedNs);
+        char line[160];
+        snprintf(line, sizeof(line), "  %s: busy %5.1f%%, starved %5.1f%%, blocked %5.1f%%, %llu batches",
+                 names[i], 100.0 * (stats.wallNs - waited) / wall, 100.0 * stats.starvedNs / wall,
+                 100.0 * stats.blockedNs / wall, (unsigned long long)stats.batches);
+        *mErr << line << std::endl;
+    }
 }
 
-void TsParser::saveEs(uint8_t *pkt, int len, int pid) {
-    if (mDumpAllPids) {
+void TsParser::openOutputs() {
+    for (auto& out : mOutPids) {
+        if (!out.second) {
+            char out_filename[256];
+            sprintf(out_filename, "out_%04x.es", out.first);
+            out.second = mEsWriter.open(out_filename);
+        }
+    }
+    rebuildPidTable();
+}
+
+void TsParser::saveEs(const uint8_t *pkt, int len, int pid) {
+    PidEntry& entry = mPidTable[pid];
+    if (mCaptureEs) {
+        if (mDumpAllPids || mOutPids.count(pid)) {
+            mCaptureBuf[pid].insert(mCaptureBuf[pid].end(), pkt, pkt + len);
+        }
+        return;
+    }
+    if (!entry.out) {
+        // A PID that left the PMT still finishes its open unit into its file
+        auto it = mOutPids.find(pid);
+        if (it != mOutPids.end()) {
+            entry.out = it->second;
+        }
+    }
+    if (!entry.out && mDumpAllPids) {
         char out_filename[256];
         sprintf(out_filename, "out_%04x.es", pid);
-        FILE* out_fp = nullptr;
-        auto it = mOutPids.find(pid);
-        if (it == mOutPids.end()) {
-            out_fp = fopen(out_filename, "wb");
-            if (out_fp) {
-                mOutPidsFp.push_back(out_fp);
-                mOutPids[pid] = out_fp;
-            } else {
-                std::cerr << "Cannot open output file: " << out_filename << std::endl;
-                return;
-            }
+        EsSink* sink = mEsWriter.open(out_filename);
+        if (!sink) {
+            return;
+        }
+        mOutPids[pid] = sink;
+        entry.out = sink;
+    }
+    if (entry.out && mEsBatch) {
+        // Pipeline mode: the writer thread does the appending
+        EsBatch& batch = *mEsBatch;
+        if (mEsStable) {
+            batch.items.push_back({entry.out, pkt, 0, (size_t)len});
         } else {
-            out_fp = it->second;
+            batch.items.push_back({entry.out, nullptr, batch.arena.size(), (size_t)len});
+            batch.arena.insert(batch.arena.end(), pkt, pkt + len);
         }
-        if (out_fp) {
-            fwrite(pkt, 1, len, out_fp);
+        if (batch.items.size() >= TS_PIPELINE_ES_ITEMS || batch.arena.size() >= TS_PIPELINE_ES_ARENA) {
+            submitEsBatch(false);
         }
+    } else if (entry.out) {
+        entry.out->append(pkt, len, mEsStable);
+    }
+}
+
+void TsParser::onPesHeader(const PesUnit& unit) {
+    if (!unit.hasPts) {
         return;
     }
-    for (auto& outPid : mOutPids) {
-        if (outPid.first == pid) {
-            fwrite(pkt, 1, len, outPid.second);
-            break;
-        }
+    if (mIndexBuilder) {
+        uint8_t flags = TS_INDEX_PTS | (unit.hasDts ? TS_INDEX_DTS : 0) |
+                        (mUnitRandomAccess[unit.pid] ? TS_INDEX_KEYFRAME : 0);
+        mIndexBuilder->addPts(unit.pid, unit.offset, flags, unit.pts, unit.hasDts ? unit.dts : 0);
+    }
+    if (!mPidTable[unit.pid].printPts || mPtsFromIndex) {
+        return;
+    }
+    TsTimestampRecord record = {};
+    record.offset = unit.offset;
+    record.pts = unit.pts;
+    record.pid = unit.pid;
+    if (unit.hasDts) {
+        record.dts = unit.dts;
+        record.flags |= TS_RECORD_DTS;
+    }
+    const uint64_t pcr = mLastPcr[mPidTable[unit.pid].pcrPid];
+    if (pcr != UINT64_MAX) {
+        record.pcr = pcr;
+        record.flags |= TS_RECORD_PCR;
+    }
+    printTimestamp(record);
+    if (mOutMarks) {
+        mOutMarks->emplace_back(mPacketOffset, (size_t)mOut->tellp() + mTimestamps.pending());
     }
 }
 
-int TsParser::parseAdaptationField(uint8_t *pkt, int pid) {
-    uint8_t adaptation_field_length = pkt[0];
-    if (adaptation_field_length > 0) {
-        int PCR_flag = (pkt[1] >> 4) & 0x01;
-        if (PCR_flag) {
-            if (adaptation_field_length < 7) {
-                return 0;
-            }
-            uint64_t pcr_base = (((uint64_t)pkt[2]) << 25)
-                        | (pkt[3] << 17)
-                        | (pkt[4] << 9)
-                        | (pkt[5] << 1)
-                        | ((pkt[6] & 0x80) >> 7);
-            uint64_t pcr_extension = ((pkt[6] & 0x01) << 8) | pkt[7];
-            uint64_t pcr = pcr_base * 300 + pcr_extension;
-            mLastPcr = pcr;
-        }
-    } else {
-        adaptation_field_length = 0;
-    }
-    return adaptation_field_length;
+void TsParser::printTimestamp(const TsTimestampRecord& record) {
+    mTimestamps.add(*mOut, record);
 }
 
-void TsParser::parsePes(uint8_t *pkt, int len, int pid)
-{
-    // Implementation for parsing the PES header
-    if (len < 9) {
+void TsParser::onPesUnit(const PesUnit& unit) {
+    if (mRangeActive && (unit.offset < mUnitRange[unit.pid].first || unit.offset >= mUnitRange[unit.pid].second)) {
         return;
     }
-    int packet_start_code_prefix = (pkt[0] << 16) | (pkt[1] << 8) | pkt[2];
-    if (packet_start_code_prefix != 0x000001)
-    {
-        cerr << "Invalid packet start code prefix: " << std::hex << packet_start_code_prefix << std::dec << std::endl;
+    TS_METRIC(mMetrics, mMetrics->pid(unit.pid).pesUnits++,
+              mMetrics->pid(unit.pid).pesErrors += (unit.flags & (PES_FLAG_CC_ERROR | PES_FLAG_TRUNCATED | PES_FLAG_BAD_HEADER)) != 0);
+    if (unit.flags & PES_FLAG_BAD_HEADER) {
+        int packet_start_code_prefix = (unit.header[0] << 16) | (unit.header[1] << 8) | unit.header[2];
+        if (packet_start_code_prefix != 0x000001) {
+            *mErr << "Invalid packet start code prefix: " << std::hex << packet_start_code_prefix << std::dec << std::endl;
+        }
         return;
     }
-    
-    int stream_id = pkt[3];
-    int pes_packet_length = (pkt[4] << 8) | pkt[5];//N
+    if (mAuTable) {
+        mAuTable->unit(unit);
+    }
+    // Pipeline mode times the writes on the writer thread
+    TS_METRIC_TIMER(mMetrics, METRIC_STAGE_WRITE, !mEsBatch && (mPidTable[unit.pid].out || mDumpAllPids));
+    for (int i = 0; i < unit.spanCount; i++) {
+        saveEs(unit.spans[i].data, unit.spans[i].len, unit.pid);
+    }
+}
 
+static inline uint64_t psiCacheKey(int pid, const uint8_t* section) {
+    return ((uint64_t)pid << 40) | ((uint64_t)section[0] << 32) |
+           ((uint64_t)((section[3] << 8) | section[4]) << 8) | section[6];
+}
 
-    int pes_header_length = pkt[8];
-    if (len < 9 + pes_header_length) {
+// A complete section from the core: parsed if it is new, by the role of its PID
+void TsParser::onSection(int pid, int role, const uint8_t* section, int len) {
+    const uint64_t crcErrors = mCrcErrors;
+    const bool accepted = acceptSection(pid, section, len);
+    if (mMonitor) {
+        // A repetition counts as an occurrence, a section failing its CRC not
+        mMonitor->section(pid, section[0], mCrcErrors == crcErrors, mPacketOffset);
+    }
+    if (!accepted) {
         return;
     }
-    if (mPrintPts) {
-        if (stream_id != 0xBC && stream_id != 0xBF &&
-            stream_id != 0xF0 && stream_id != 0xF1 && stream_id != 0xFF &&
-            stream_id != 0xF2 && stream_id != 0xF8) {
-            // Audio or Video stream
-            int pts_dts_flag = (pkt[7] >> 6) & 0x03;
-            if (pts_dts_flag == 0x02 || pts_dts_flag == 0x03) {
-                int pts_dts = ((pkt[9] & 0x0e) << 29)
-                            | (pkt[10] << 22)
-                            | ((pkt[11] & 0xfe) << 14)
-                            | (pkt[12] << 7)
-                            | (pkt[13] >> 1);
-                // Further processing of PTS/DTS can be added here
-                if (pts_dts_flag == 0x02) {
-                    // PTS only
-                    uint64_t pts = pts_dts;
-                    // mLastPts = pts;
-                    // Process PTS value as needed
-                    if (mPrintPid == pid  || mPrintAllPids) {
-                        std::cout << "PID: " << pid << ", PTS: 0x" << std::hex << pts << std::dec  << " (" << pts << ")" << " mPrintPid: " << mPrintPid  << " mPrintAllPids: " << mPrintAllPids << std::endl;
-                    }
-                } else if (pts_dts_flag == 0x03) {
-                    // PTS and DTS
-                    uint64_t pts = pts_dts;
-                    uint64_t dts = ((pkt[14] & 0x0E) << 29)
-                                | (pkt[15] << 22)
-                                | ((pkt[16] & 0xFE) << 14)
-                                | (pkt[17] << 7)
-                                | (pkt[18] >> 1);
-                    // mLastPts = pts;
-                    // mLastDts = dts;
-                    // Process PTS and DTS values as needed
-                    if (mPrintPid == pid || mPrintAllPids) {
-                        std::cout << "PID: " << pid << ", PTS: 0x" << std::hex << pts << ", DTS: 0x" << std::hex << dts << std::dec << " mPrintPid: " << mPrintPid  << " mPrintAllPids: " << mPrintAllPids<< std::endl;
-                    }
-                }
+    if (mCheckpointing && (section[1] & 0x80)) {
+        // A checkpoint rebuilds the tables from these
+        mPsiSections[psiCacheKey(pid, section)].assign(section, section + len);
+    }
+    if (mPsiWatch) {
+        mPsiChangeSeen = true;
+        return;
+    }
+    if (mIndexBuilder) {
+        mIndexBuilder->addSection(pid, section, len, mPacketOffset);
+    }
+    switch (role) {
+        case PID_ROLE_PAT:
+            if (mRemux) {
+                mRemux->setSection(pid, section, len);
             }
-        }
+            parsePat(section, len);
+            break;
+        case PID_ROLE_PMT:
+            if (mRemux) {
+                mRemux->setSection(pid, section, len);
+            }
+            parsePmt(section, len);
+            break;
+        case PID_ROLE_SDT:
+            parseSdt(section, len);
+            break;
+        default:
+            break;
     }
+}
 
-    int size = len - 9 - pes_header_length;
-    if (size > 0) {
-        saveEs(pkt + 9 + pes_header_length, size, pid);
+// Decides whether a complete section is worth parsing: a repetition of the
+// cached version is recognised from its header and CRC_32 field alone, and
+// only a section that differs has its CRC computed. A new version of a
+// known section is reported as an update.
+bool TsParser::acceptSection(int pid, const uint8_t* section, int len) {
+    if (!(section[1] & 0x80)) {
+        // Short form: no version, no CRC
+        return true;
+    }
+    if (len < 12 || !(section[5] & 0x01)) {
+        // Too short for the header and CRC, or a table that is not valid yet
+        return false;
+    }
+    const uint8_t version = (section[5] >> 1) & 0x1f;
+    const uint8_t* p = section + len - 4;
+    const uint32_t crc = ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    const uint64_t key = psiCacheKey(pid, section);
+    auto it = mPsiCache.find(key);
+    if (it != mPsiCache.end() && it->second.version == version && it->second.crc == crc) {
+        return false;
     }
+    if (!tsSectionCrcValid(section, len)) {
+        mCrcErrors++;
+        TS_METRIC(mMetrics, mMetrics->pid(pid).crcErrors++);
+        return false;
+    }
+    if (mPsiWatch) {
+        // Worker: the caller voids the chunk, the master parses it again
+        return true;
+    }
+    if (it == mPsiCache.end()) {
+        mPsiCache[key] = {version, crc};
+        return true;
+    }
+    mPsiUpdates++;
+    TS_METRIC(mMetrics, mMetrics->pid(pid).tableUpdates++);
+    const int extension = (section[3] << 8) | section[4];
+    char table[64];
+    if (section[0] == 0x02) {
+        snprintf(table, sizeof(table), "PMT program %d", extension);
+    } else {
+        snprintf(table, sizeof(table), "%s ts_id %d section %d", section[0] == 0x00 ? "PAT" : "SDT", extension, section[6]);
+    }
+    char line[160];
+    snprintf(line, sizeof(line), "PSI update at offset %llu: %s on PID 0x%04x, version %d -> %d",
+             (unsigned long long)mPacketOffset, table, pid, it->second.version, version);
+    *mErr << line << std::endl;
+    it->second = {version, crc};
+    return true;
 }
 
-void TsParser::processSectionData(uint8_t* pkt, int offset, int pid, int continuity_counter, int payload_unit_start_indicator, std::map<int, SectionBuffer>& secbuf_map, void (TsParser::*parseFunc)(uint8_t*, int)) {
-    auto& secbuf = secbuf_map[pid];
-    if (payload_unit_start_indicator) {
-        secbuf.data.clear();
-        secbuf.collecting = true;
-        secbuf.last_cc = continuity_counter;
-        int pointer_field = pkt[offset];
-        offset += 1 + pointer_field;
-        int remain = 188 - offset;
-        if (remain > 0) {
-            secbuf.data.insert(secbuf.data.end(), pkt + offset, pkt + 188);
-        }
-        if (secbuf.data.size() >= 3) {
-            int section_length = ((secbuf.data[1] & 0x0F) << 8) | secbuf.data[2];
-            secbuf.expected_length = section_length + 3;
-        }
-    } else if (secbuf.collecting) {
-        if (((secbuf.last_cc + 1) & 0x0F) != continuity_counter) {
-            secbuf.data.clear();
-            secbuf.collecting = false;
-        } else {
-            secbuf.last_cc = continuity_counter;
-            int remain = 188 - offset;
-            if (remain > 0) {
-                secbuf.data.insert(secbuf.data.end(), pkt + offset, pkt + 188);
+// A program left the PAT or moved its PMT: forget the PMT, including its
+// cache entries, so the next one is parsed whatever its version
+void TsParser::removeProgram(int programNumber) {
+    mPat.erase(programNumber);
+    for (auto it = mPmt.begin(); it != mPmt.end(); ++it) {
+        if (it->program_number == programNumber) {
+            for (const auto& stream : it->streams) {
+                mStreamInfo.erase(stream.elementary_pid);
             }
+            mPmt.erase(it);
+            break;
         }
-    } else {
-        // ignore
     }
-    if (secbuf.collecting && secbuf.expected_length > 0 &&
-        (int)secbuf.data.size() >= secbuf.expected_length) {
-        secbuf.collecting = false;
-        (this->*parseFunc)(secbuf.data.data(), secbuf.expected_length);
-        secbuf.data.clear();
-        secbuf.expected_length = 0;
-        secbuf.collecting = false;
+    for (auto it = mPsiCache.begin(); it != mPsiCache.end();) {
+        if (((it->first >> 32) & 0xff) == 0x02 && ((it->first >> 8) & 0xffff) == (uint64_t)programNumber) {
+            it = mPsiCache.erase(it);
+        } else {
+            ++it;
+        }
     }
+    mPsiChanged = true;
 }
 
-void TsParser::packet(uint8_t *pkt) {
+void TsParser::packet(const uint8_t *pkt) {
     int sync_byte = pkt[0];
     if (sync_byte != 0x47) {
         return;
     }
     mPacketIndex++;
-    int transport_error_indicator = (pkt[1] >> 7) & 0x01;
-    int payload_unit_start_indicator = (pkt[1] >> 6) & 0x01;
-    int transport_priority = (pkt[1] >> 5) & 0x01;
-    int pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
-    if (pid == 0x1fff) {
+    if (mDropCorruptPes && ((pkt[1] & 0x80) || (pkt[3] & 0xc0))) {
+        countDropped(((pkt[1] & 0x1f) << 8) | pkt[2], pkt);
         return;
     }
-    int transport_scrambling_control = (pkt[3] >> 6) & 0x03;
-    int adaptation_field_control = (pkt[3] >> 4) & 0x03;
-    int continuity_counter = pkt[3] & 0x0F;
-    int offset = 4;
-    // printf("transport_error_indicator=%d, payload_unit_start_indicator=%d, transport_priority=%d, pid=%d, transport_scrambling_control=%d, adaptation_field_control=%d, continuity_counter=%d\n",
-    //     transport_error_indicator, payload_unit_start_indicator, transport_priority, pid, transport_scrambling_control, adaptation_field_control, continuity_counter);
-    if (adaptation_field_control & 0x02) {
-        int adaptation_field_length = parseAdaptationField(pkt + offset, pid);
-        offset += 1 + adaptation_field_length;// +1:pkt[0]
-    }
-    if (adaptation_field_control & 0x01) {
-        if (pid == 0x0000) {
-            if (!isHasGetPat) {
-                offset += payload_unit_start_indicator ? 1 : 0;
-                if (!parsePat(pkt + offset, 188 - offset))
-                    isHasGetPat = true;
-            }
-            return;
+    const PidEntry* table = mPidTable.data();
+    switch (mCore) {
+        case CORE_PSI:
+            TsPsiCore(table, {this}, {}, {}, {}).packet(pkt);
+            break;
+        case CORE_PES:
+            TsPesCore(table, {this}, {this}, {}, {}).packet(pkt);
+            break;
+        default:
+            TsFullCore(table, {this}, {this}, {this}, {this}).packet(pkt);
+            break;
+    }
+}
+
+// --drop-corrupt passes TEI and scrambled packets over; they are still
+// counted, and seen by the TR 101 290 checks
+void TsParser::countDropped(int pid, const uint8_t* pkt) {
+    TS_METRIC(mMetrics, mMetrics->countPacket(pid, pkt, countedPacketSize()));
+    if (mMonitor) {
+        mMonitor->packet(pid, pkt, mPacketOffset);
+    }
+}
+
+// The next TS_BLOCK_PACKETS packets decoded into 'block' and consumed, or
+// as many of them as are in sync; false leaves a short or unsynced input to
+// readNextTsPacket()
+bool TsParser::readBlock(TsPacketBlock& block, const uint8_t*& data) {
+    const size_t bytes = (size_t)mPacketSize * TS_BLOCK_PACKETS;
+    if (fillInput(bytes) < bytes) {
+        return false;
+    }
+    data = mInput->data();
+    TsBlockDecoder::decode(data, mPacketSize, TS_BLOCK_PACKETS, block);
+    if (!block.allSynced()) {
+        block.count = __builtin_ctzll(~block.synced);
+        if (block.count == 0) {
+            return false;
         }
-        if (pid == 0x0011) { // SDT PID
-            // offset += payload_unit_start_indicator ? 1 : 0;
-            // parseSdt(pkt + offset, 188 - offset);
-            processSectionData(pkt, offset, pid, continuity_counter, payload_unit_start_indicator, mSdtSectionBuf, &TsParser::parseSdt);
-            return;
+    }
+    mReadOffset = mInput->offset();
+    mInput->consume((size_t)mPacketSize * block.count);
+    return true;
+}
+
+// The packets of a block in input order, as packet() would take them one by
+// one. Null packets, and with --drop-corrupt TEI and scrambled ones, are
+// passed over by their mask bits. Returns true once -s has what it needs.
+template <class Core>
+bool TsParser::parseBlock(Core core, const uint8_t* data, const TsPacketBlock& block, bool ordered) {
+    const uint64_t first = mPacketIndex;
+    const uint64_t all = block.count == 64 ? ~0ULL : (1ULL << block.count) - 1;
+    const uint64_t dropped = mDropCorruptPes ? block.tei | block.scrambled : 0;
+    // Only the metrics of the full core count null packets
+    uint64_t todo = mCore == CORE_FULL ? all : all & ~block.null;
+    for (; todo; todo &= todo - 1) {
+        const int i = __builtin_ctzll(todo);
+        const uint8_t* pkt = data + (size_t)i * mPacketSize;
+        mPacketIndex = first + i + 1;
+        mPacketOffset = mReadOffset + (uint64_t)i * mPacketSize;
+        if ((dropped >> i) & 1) {
+            countDropped(block.pid[i], pkt);
+            continue;
         }
-        bool isPmtPid = false;
-        for (const auto& entry : mPat) {
-            if (entry.second == pid) {
-                isPmtPid = true;
-                break;
+        core.decoded(pkt, block.pid[i], block.flags[i], block.cc[i], block.payload[i]);
+        if (mShowStreamInfo && mPsiChanged && !ordered) {
+            mPsiChanged = false;
+            if (isStreamInfoComplete()) {
+                return true;
             }
         }
-        if (isPmtPid) {
-            // offset += payload_unit_start_indicator ? 1 : 0;
-            // parsePmt(pkt + offset, 188 - offset);
-            processSectionData(pkt, offset, pid, continuity_counter, payload_unit_start_indicator, mPmtSectionBuf, &TsParser::parsePmt);
-            return;
-        }
-        bool isPesPid = false;
-        for (const auto& entry : mPmt) {
-            for (const auto& stream : entry.streams) {
-                if (stream.elementary_pid == pid) {
-                    isPesPid = true;
-                    break;
-                }
-            }
-            if (isPesPid) {
-                break;
-            }
+    }
+    mPacketIndex = first + block.count;
+    return false;
+}
+
+// Picks the narrowest core for the options; until this runs CORE_FULL
+// serves every caller
+void TsParser::selectCore() {
+    // CSV and binary -p output carry the PCR, only the full core reads it
+    const bool wantPcr = mPrintPts && mTimestamps.format() != TS_FORMAT_TEXT;
+    if (mIndexBuilder || mPcr || mMetrics || mRemux || mMonitor || wantPcr) {
+        mCore = CORE_FULL;
+    } else if (mShowStreamInfo || (!mPrintPts && !mDumpAllPids && mOutPids.empty() && !mAuTable)) {
+        mCore = CORE_PSI;
+    } else {
+        mCore = CORE_PES;
+    }
+}
+
+void TsParser::pesPayload(const uint8_t* pkt, int offset, int pid, int continuity_counter, int payload_unit_start_indicator) {
+    // An index built along -s still needs every PES, later runs read from it
+    if (mShowStreamInfo && !mIndexBuilder) {
+        return;
+    }
+    if (mIndexBuilder && payload_unit_start_indicator) {
+        mUnitRandomAccess[pid] = mRandomAccess;
+    }
+    if (mChunkPes) {
+        // Worker: hold back what belongs to the previous chunk's unit
+        int& slot = mChunkPesSlot[pid];
+        if (slot < 0) {
+            slot = mChunkPes->size();
+            mChunkPes->emplace_back();
+            mChunkPes->back().pid = pid;
         }
-        if (!mShowStreamInfo && isPesPid) {
-            if (payload_unit_start_indicator) {
-                parsePes(pkt + offset, 188 - offset, pid);
-            } else {
-                saveEs(pkt + offset, 188 - offset, pid);
+        PesChunkPid& c = (*mChunkPes)[slot];
+        if (!c.started) {
+            if (!payload_unit_start_indicator) {
+                c.lead.emplace_back(pkt, offset);
+                return;
             }
+            c.started = true;
+            c.firstCc = continuity_counter;
         }
     }
+    mPes.push(pid, pkt + offset, std::max(0, 188 - offset), continuity_counter, payload_unit_start_indicator, mPacketOffset);
 }
 
-int TsParser::parsePat(uint8_t *pkt, int len)
+void TsParser::parsePat(const uint8_t *pkt, int len)
 {
     if (len < 12) {
-        return -1;
+        return;
     }
     // for (int i=0; i<4; i++) {
     //     printf("%02X ", pkt[i]);
@@ -389,13 +2224,13 @@ int TsParser::parsePat(uint8_t *pkt, int len)
     // printf("\n");
     uint16_t table_id = pkt[0];
     if (table_id != 0x00) {
-        return -1;
+        return;
     }
 
     uint8_t section_syntax_indicator = (pkt[1] >> 7) & 0x01;
     uint16_t section_length = ((pkt[1] & 0x0f) << 8) | pkt[2];
     if (section_length + 3 > len) {
-        return -1;
+        return;
     }
     uint16_t transport_stream_id = (pkt[3] << 8) | pkt[4];
     uint8_t version = (pkt[5] & 0x1e) >> 1;
@@ -412,47 +2247,65 @@ int TsParser::parsePat(uint8_t *pkt, int len)
     //      << ", last_section_number: " << (int)last_section_number
     //      << ", program_info_len: " << program_info_len << endl;
 
+    vector<int>& programs = mPatPrograms;
+    programs.clear();
     for (int i = 0; i < program_info_len; i += 4) {
         uint16_t program_number = (pkt[8 + i] << 8) | pkt[9 + i];
         if (program_number != 0) {
             uint16_t program_map_pid = (pkt[10 + i] & 0x1f) << 8 | pkt[11 + i];
             // printf("program_number: 0x%04x, program_map_pid: 0x%04x\n", program_number, program_map_pid);
+            auto it = mPat.find(program_number);
+            if (it != mPat.end() && it->second != program_map_pid) {
+                removeProgram(program_number);
+            }
             mPat[program_number] = program_map_pid;
+            programs.push_back(program_number);
+            mPsiChanged = true;
+        }
+    }
+    // A new version replaces what this section listed before
+    vector<int>& previous = mPatSections[section_number];
+    for (int program : previous) {
+        if (std::find(programs.begin(), programs.end(), program) == programs.end()) {
+            removeProgram(program);
         }
     }
+    previous = programs;
+    isHasGetPat = true;
+    rebuildPidTable();
     // std::cout << "Parsed PAT: " << mPat.size() << " programs found." << std::endl;
     // for (auto& entry : mPat) {
     //     std::cout << "  Program Number: " << entry.first << ", PMT PID: 0x"
     //               << std::hex << entry.second << std::dec << std::endl;
     // }
-    return 0;
 }
 
-string TsParser::parsePrivatePesDescriptor(const uint8_t* es_info, int es_info_length) {
-    std::string desc_detail;
+void TsParser::parsePrivatePesDescriptor(const uint8_t* es_info, int es_info_length, string& desc_detail) {
+    desc_detail.clear();
     int desc_pos = 0;
     while (desc_pos + 2 <= es_info_length) {
         uint8_t descriptor_tag = es_info[desc_pos];
         uint8_t descriptor_len = es_info[desc_pos + 1];
         if (desc_pos + 2 + descriptor_len > es_info_length) break;
-        if (descriptor_tag == 0x6A) desc_detail = "AC3 Audio";
-        else if (descriptor_tag == 0x73) desc_detail = "DTS Audio";
-        else if (descriptor_tag == 0x59) desc_detail = "Subtitles";
+        if (descriptor_tag == 0x6A) desc_detail.assign("AC3 Audio");
+        else if (descriptor_tag == 0x73) desc_detail.assign("DTS Audio");
+        else if (descriptor_tag == 0x59) desc_detail.assign("Subtitles");
         else if (descriptor_tag == 0x05 && descriptor_len >= 4) {
             char format[5] = {0};
             memcpy(format, es_info + desc_pos + 2, 4);
-            desc_detail = std::string("Registration: ") + format;
+            desc_detail.assign("Registration: ");
+            desc_detail.append(format);
         } else {
-            desc_detail = "Unknown";
+            desc_detail.assign("Unknown");
         }
         desc_pos += 2 + descriptor_len;
     }
-    return desc_detail;
 }
 
 void TsParser::storeStreamInfo(const uint8_t* es_info, int es_info_length, uint8_t stream_type, uint16_t elementary_pid) {
-    std::string stream_desc;
-    std::string desc_detail;
+    // Assigned in place: a PMT update that keeps its PIDs reuses the strings
+    string& desc = mStreamInfo[elementary_pid];
+    const char* stream_desc = nullptr;
 
     switch (stream_type) {
         case 0x01:
@@ -467,8 +2320,8 @@ void TsParser::storeStreamInfo(const uint8_t* es_info, int es_info_length, uint8
             stream_desc = "Private Sections";
             break;
         case 0x06:
-            desc_detail = parsePrivatePesDescriptor(es_info, es_info_length);
-            stream_desc = desc_detail.empty() ? "Private PES" : desc_detail;
+            parsePrivatePesDescriptor(es_info, es_info_length, desc);
+            stream_desc = desc.empty() ? "Private PES" : nullptr;
             break;
         case 0x0F:
             stream_desc = "AAC Audio";
@@ -527,15 +2380,19 @@ void TsParser::storeStreamInfo(const uint8_t* es_info, int es_info_length, uint8
         case 0xEA:
             stream_desc = "VC-1 Video";
             break;
-        default:
-            stream_desc = "Unknown(type 0x" + std::to_string((int)stream_type) + ")";
-            if (!desc_detail.empty()) stream_desc += " (" + desc_detail + ")";
+        default: {
+            char unknown[32];
+            snprintf(unknown, sizeof(unknown), "Unknown(type 0x%d)", stream_type);
+            desc.assign(unknown);
             break;
+        }
+    }
+    if (stream_desc) {
+        desc.assign(stream_desc);
     }
-    mStreamInfo[elementary_pid] = stream_desc;
 }
 
-void TsParser::parsePmt(uint8_t *pkt, int len)
+void TsParser::parsePmt(const uint8_t *pkt, int len)
 {
     if (len < 13) {
         return;
@@ -548,7 +2405,10 @@ void TsParser::parsePmt(uint8_t *pkt, int len)
     //     printf("%02X ", pkt[i]);
     // }
     // printf("\n");
-    Pmt pmt;
+    // Built in the scratch entry, whose streams keep the capacity of the
+    // version it replaced last time
+    Pmt& pmt = mPmtScratch;
+    pmt.streams.clear();
     pmt.section_length = ((pkt[1] & 0x0f) << 8) | pkt[2];
     // printf("section_length:%d, len:%d\n", section_length, len);
     // section_length maybe larger than len
@@ -557,11 +2417,12 @@ void TsParser::parsePmt(uint8_t *pkt, int len)
     //     return;
     // }
     pmt.program_number = (pkt[3] << 8) | pkt[4];
-    
-    for (auto &entry: mPmt) {
-        if (pmt.program_number == entry.program_number && entry.isGotPmt) {
-            // printf("program_number: %d, pmt already got\n", pmt.program_number);
-            return;
+    // Repetitions are filtered by acceptSection(), this is a new version
+    auto previous = mPmt.end();
+    for (auto it = mPmt.begin(); it != mPmt.end(); ++it) {
+        if (pmt.program_number == it->program_number) {
+            previous = it;
+            break;
         }
     }
 
@@ -590,7 +2451,23 @@ void TsParser::parsePmt(uint8_t *pkt, int len)
         pos += stream_info.es_info_length;
     }
     pmt.isGotPmt = true;
-    mPmt.push_back(pmt);
+    pmt.isGotServiceInfo = mServiceInfos.find(pmt.program_number) != mServiceInfos.end();
+    if (previous != mPmt.end()) {
+        // Streams the new version dropped lose their description
+        for (const auto& stream : previous->streams) {
+            auto kept = std::find_if(pmt.streams.begin(), pmt.streams.end(), [&](const PmtStreamInfo& s) {
+                return s.elementary_pid == stream.elementary_pid;
+            });
+            if (kept == pmt.streams.end()) {
+                mStreamInfo.erase(stream.elementary_pid);
+            }
+        }
+        std::swap(*previous, pmt);
+    } else {
+        mPmt.push_back(pmt);
+    }
+    mPsiChanged = true;
+    rebuildPidTable();
     // cout << "Parsed PMT for Program Number: " << program_number << ", PCR PID: 0x"
     //      << std::hex << pcr_pid << std::dec << std::endl;
     // for (auto& info : mStreamInfo) {
@@ -599,7 +2476,7 @@ void TsParser::parsePmt(uint8_t *pkt, int len)
     // }
 }
 
-void TsParser::parseSdt(uint8_t *pkt, int len) {
+void TsParser::parseSdt(const uint8_t *pkt, int len) {
     if (len < 11) return;
     uint8_t table_id = pkt[0];
     if (table_id != 0x42 && table_id != 0x46) return;
@@ -617,8 +2494,8 @@ void TsParser::parseSdt(uint8_t *pkt, int len) {
     while (pos < section_length + 3 - 4) { // Exclude CRC
         if (pos + 5 > len) break;
         uint16_t service_id = (pkt[pos] << 8) | pkt[pos + 1];
-        if (mServiceInfos.find(service_id) != mServiceInfos.end()) {
-            // Service info already exists
+        if (table_id == 0x46 && mServiceInfos.find(service_id) != mServiceInfos.end()) {
+            // The actual TS's own SDT wins over another TS's
             uint16_t descriptors_loop_length = ((pkt[pos + 3] & 0x0F) << 8) | pkt[pos + 4];
             pos += 5 + descriptors_loop_length;
             continue;
@@ -631,8 +2508,13 @@ void TsParser::parseSdt(uint8_t *pkt, int len) {
         uint16_t descriptors_loop_length = ((pkt[pos + 3] & 0x0F) << 8) | pkt[pos + 4];
         int desc_pos = pos + 5;
         int desc_end = desc_pos + descriptors_loop_length;
-        std::string service_name;
-        std::string provider_name;
+        // Written in place, a new SDT version reuses the strings
+        ServiceInfo& info = mServiceInfos[service_id];
+        info.service_id = service_id;
+        std::string& service_name = info.service_name;
+        std::string& provider_name = info.provider_name;
+        service_name.clear();
+        provider_name.clear();
         while (desc_pos + 2 <= desc_end && desc_end <= len) {
             uint8_t descriptor_tag = pkt[desc_pos];
             if (descriptor_tag != 0x48) {
@@ -645,14 +2527,14 @@ void TsParser::parseSdt(uint8_t *pkt, int len) {
             uint8_t service_provider_name_length = pkt[desc_pos + 3];
             if (service_provider_name_length + 4 > descriptor_len) break;
             desc_pos += 4;
-            provider_name = std::string((char*)pkt + desc_pos, service_provider_name_length);
+            provider_name.assign((const char*)pkt + desc_pos, service_provider_name_length);
             desc_pos += service_provider_name_length;
             uint8_t service_name_length = pkt[desc_pos];
             desc_pos += 1;
-            service_name = std::string((char*)pkt + desc_pos, service_name_length);
+            service_name.assign((const char*)pkt + desc_pos, service_name_length);
             desc_pos += service_name_length;
         }
-        mServiceInfos[service_id] = {service_id, service_name, provider_name};
+        mPsiChanged = true;
         // printf("  Service ID: 0x%04x, Service Name: %s, Provider Name: %s\n",
         //        service_id, service_name.c_str(), provider_name.c_str());
         for (auto &entry: mPmt) {
@@ -685,4 +2567,11 @@ void TsParser::showStreamInfo()
         }
         cout << "----------------------------------------" << std::endl;
     }
+    if (mProbeReport.done) {
+        const ProbeReport& report = mProbeReport;
+        cout << "Probe: " << (report.complete ? "complete" : "partial")
+             << " (PAT " << (report.programs ? "yes" : "no") << ", PMT " << report.pmts << "/" << report.programs
+             << ", SDT " << report.services << "/" << report.programs << "), " << report.bytesRead
+             << " bytes in " << report.reads << " reads, " << report.elapsedUs / 1000.0 << " ms" << std::endl;
+    }
 }
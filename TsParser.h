@@ -25,8 +25,27 @@
 #include <map>
 #include <cstdint>
 #include <algorithm>
+#include <sstream>
+#include <memory>
+#include "TsInput.h"
+#include "TsSync.h"
+#include "EsWriter.h"
+#include "PesAssembler.h"
+#include "SpscRing.h"
+#include "SectionPool.h"
+#include "TsParserCore.h"
+#include "TsIndex.h"
+#include "TsMetrics.h"
+#include "TsPcrTimeline.h"
+#include "TsRemux.h"
+#include "TsTimestamps.h"
+#include "TsNal.h"
+#include "TsCheckpoint.h"
+#include "TsMonitor.h"
 using namespace std;
 
+#define TS_PROBE_WINDOW (256 << 10) // -s probe read size
+
 typedef enum command_options {
     OPTION_SET_INPUT_FILE,
     OPTION_OUTPUT_PID,
@@ -34,6 +53,38 @@ typedef enum command_options {
     OPTION_MERGE_ALL_PIDS,
     OPTION_PRINT_PTS,
     OPTION_SHOW_STREAM_INFO,
+    OPTION_DISABLE_MMAP,
+    OPTION_THREADS,
+    OPTION_ES_BUFFER_SIZE,
+    OPTION_ES_PREALLOCATE,
+    OPTION_ES_DIRECT_IO,
+    OPTION_ES_STATS,
+    OPTION_RCVBUF,
+    OPTION_IDLE_TIMEOUT,
+    OPTION_DROP_CORRUPT_PES,
+    OPTION_PIPELINE,
+    OPTION_PIN_CPUS,
+    OPTION_BUILD_INDEX,
+    OPTION_NO_INDEX,
+    OPTION_TIME_FROM,
+    OPTION_TIME_TO,
+    OPTION_PROBE,
+    OPTION_PROBE_BYTES,
+    OPTION_PROBE_MS,
+    OPTION_METRICS_FILE,
+    OPTION_METRICS_INTERVAL,
+    OPTION_PCR_REPORT,
+    OPTION_PCR_TIMELINE,
+    OPTION_PCR_WINDOW,
+    OPTION_REMUX_KEEP,
+    OPTION_PTS_FORMAT,
+    OPTION_AU_TABLE,
+    OPTION_URING_DEPTH,
+    OPTION_DIRECT_INPUT,
+    OPTION_CHECKPOINT,
+    OPTION_CHECKPOINT_INTERVAL,
+    OPTION_TR101290,
+    OPTION_CHECKPOINT_FORCE,
 } CommandOption;
 
 typedef struct PmtStreamInfo {
@@ -58,11 +109,107 @@ typedef struct Pmt {
     bool isGotServiceInfo = false;
 } Pmt;
 
-struct SectionBuffer {
-    std::vector<uint8_t> data;
-    int expected_length = 0;
-    int last_cc = -1;
-    bool collecting = false;
+// Last accepted version of one PSI section. Keyed by PID, table_id,
+// table_id_extension and section_number, see psiCacheKey().
+struct PsiCacheEntry {
+    uint8_t version;
+    uint32_t crc; // the section's CRC_32 field
+};
+
+// Which TsParserCore configuration packet() runs, see selectCore()
+enum {
+    CORE_PSI = 0, // tables only: -s, or nothing asked of the PES
+    CORE_PES,     // -p and -o
+    CORE_FULL,    // every hook, the sinks test at run time what is enabled
+};
+
+// A worker's view of one PES PID in its chunk: packets before the first
+// unit start continue the previous chunk's unit, the unit still open at the
+// end continues into the next chunk
+struct PesChunkPid {
+    int pid = 0;
+    vector<pair<const uint8_t*, int>> lead; // packet, payload offset
+    bool started = false; // a unit start was seen in the chunk
+    int firstCc = 0;      // its continuity counter
+    PesStream tail;
+};
+
+// What a worker produced for one chunk of the input, in packet order
+struct ParseChunkResult {
+    vector<pair<int, vector<uint8_t>>> es; // PID -> ES bytes
+    vector<PesChunkPid> pes;
+    string out;
+    vector<pair<uint64_t, size_t>> outMarks; // packet offset, end of its lines in 'out'
+    string err;
+    uint64_t firstPacket = UINT64_MAX; // offset of the first packet parsed
+    uint64_t nextPacket = UINT64_MAX;  // offset of the first packet past the chunk
+    uint64_t packets = 0;
+    uint64_t syncLossCount = 0;
+    uint64_t skippedBytes = 0;
+    uint64_t ccErrors = 0;
+    uint64_t crcErrors = 0;
+    bool psiChanged = false; // a PAT/PMT differs from the first pass, chunk is void
+    std::unique_ptr<TsMetrics> metrics; // counted in this chunk, merged if it is kept
+    int startPacketSize = 0;
+    int endPacketSize = 0;
+    bool done = false;
+};
+
+// Live inputs: time from packet arrival to the end of its processing
+struct LatencyStats {
+    uint64_t count = 0;
+    uint64_t sumNs = 0;
+    uint64_t maxNs = 0;
+    uint64_t buckets[32] = {0}; // bucket i: [2^i, 2^(i+1)) microseconds
+};
+
+// Pipeline mode: packets handed from the reader to the parser thread.
+// Packets point into the input when it is stable, else into 'storage'.
+struct PacketBatch {
+    vector<const uint8_t*> packets;
+    vector<uint64_t> offsets;
+    vector<uint8_t> storage;
+    int packetSize = TS_PACKET_SIZE; // of every packet in the batch
+    bool last = false;
+};
+
+// Pipeline mode: ES payload handed from the parser to the writer thread
+struct EsBatch {
+    struct Item {
+        EsSink* sink;
+        const uint8_t* data; // stable input memory, or nullptr: 'offset' into arena
+        size_t offset;
+        size_t len;
+    };
+    vector<Item> items;
+    vector<uint8_t> arena;
+    bool last = false;
+};
+
+enum {
+    STAGE_READER = 0,
+    STAGE_PARSER,
+    STAGE_WRITER,
+    STAGE_COUNT,
+};
+
+struct PipelineStageStats {
+    uint64_t wallNs = 0;
+    uint64_t starvedNs = 0; // waiting for input from the previous stage
+    uint64_t blockedNs = 0; // waiting for room towards the next stage
+    uint64_t batches = 0;
+};
+
+// -s probe: budget and how far it got
+struct ProbeReport {
+    bool done = false;      // a probe ran, print the report
+    bool complete = false;
+    int programs = 0;       // in the PAT
+    int pmts = 0;           // programs with their PMT
+    int services = 0;       // programs with an SDT entry
+    uint64_t bytesRead = 0;
+    int reads = 0;
+    uint64_t elapsedUs = 0;
 };
 
 struct ServiceInfo {
@@ -71,7 +218,13 @@ struct ServiceInfo {
     std::string provider_name;
 };
 
-class TsParser{
+class TsParser : private PesListener {
+    friend class TsBench; // times the private stages directly
+    friend class TsBatch; // captures the output and reads the tables of each file
+    friend struct TsParserPsi;
+    friend struct TsParserPes;
+    friend struct TsParserPcr;
+    friend struct TsParserMetrics;
     public:
         TsParser(const string& file_path = "");
         ~TsParser();
@@ -82,14 +235,19 @@ class TsParser{
         int mVideoPid;
         int mAudioPid;
         int mTextPid;
-        FILE *mInFp;
-        vector<FILE*> mOutPidsFp;
-        map<int, FILE*> mOutPids;
+        TsInput *mInput;
+        TsInputConfig mInputConfig;
+        EsWriter mEsWriter;
+        map<int, EsSink*> mOutPids; // sinks are opened when parsing starts
+        bool mEsStable = false;     // saveEs() data stays valid until the next flush
+        bool mShowEsStats = false;
+        LatencyStats mLatency;
         string mFilePath;
-        uint64_t mLastPcr;
+        vector<uint64_t> mLastPcr; // per PCR PID, UINT64_MAX: none yet (CORE_FULL only)
         bool mPrintPts = false;
+        TsTimestampWriter mTimestamps;
         bool mShowStreamInfo = false;
-        map<int, string> mStreamInfo;
+        map<int, string> mStreamInfo; // entries are rewritten in place when a PMT changes
         map<int, int> mPat; // program_number to PMT PID
         vector<Pmt> mPmt;
         bool mDumpAllPids = false;
@@ -97,25 +255,214 @@ class TsParser{
         int mPrintPid;
         bool isHasGetPat = false;
         bool isHasGetPmt = false;
-        std::map<int, SectionBuffer> mPmtSectionBuf;
+        SectionPool mSections;
         std::map<int, ServiceInfo> mServiceInfos;
-        std::map<int, SectionBuffer> mSdtSectionBuf;
+        Pmt mPmtScratch;          // next version of a PMT, swapped with the current one
+        vector<int> mPatPrograms; // programs of the PAT section being parsed
+        std::map<uint64_t, PsiCacheEntry> mPsiCache;
+        map<int, vector<int>> mPatSections; // PAT section_number to its program numbers
+        uint64_t mPsiUpdates = 0;            // sections that replaced an older version
+        bool mPsiWatch = false;              // worker: flag PAT/PMT changes instead of parsing them
+        bool mPsiChangeSeen = false;
         uint64_t mPacketIndex = 0;
+        vector<PidEntry> mPidTable;
+        int mCore = CORE_FULL;
+        int mThreads = 1;
+        bool mCaptureEs = false; // worker: collect ES into mCaptureBuf instead of writing
+        vector<vector<uint8_t>> mCaptureBuf;
+        std::ostream* mOut = &std::cout;
+        std::ostream* mErr = &std::cerr;
+        TsSyncScanner mSync;
+        int mPacketSize = TS_PACKET_SIZE; // 188, 192 (M2TS) or 204, detected at sync
+        uint64_t mSyncLossCount = 0;
+        uint64_t mSkippedBytes = 0;
+        uint64_t mCrcErrors = 0; // PSI sections rejected on a CRC_32 mismatch
+        uint64_t mReadOffset = 0;   // input offset of the packet readNextTsPacket() returned
+        uint64_t mPacketOffset = 0; // input offset of the packet being parsed
+        PesAssembler mPes{this};
+        bool mDropCorruptPes = false;
+        vector<PesChunkPid>* mChunkPes = nullptr; // worker: per-PID chunk edges
+        vector<int> mChunkPesSlot;                // PID -> index in *mChunkPes
+        vector<pair<uint64_t, size_t>>* mOutMarks = nullptr;
+        bool mPipeline = false;
+        bool mPipelineRunning = false;
+        int mBatchPacketSize = TS_PACKET_SIZE; // parser stage: size of the batch it works on
+        int mPinCpus[STAGE_COUNT] = {-1, -1, -1};
+        PipelineStageStats mStageStats[STAGE_COUNT];
+        EsBatch* mEsBatch = nullptr; // parser thread: ES collected for the writer
+        SpscRing<EsBatch*>* mEsFull = nullptr;
+        SpscRing<EsBatch*>* mEsFree = nullptr;
+        bool mBuildIndex = false;
+        bool mUseIndex = true;
+        TsIndexBuilder* mIndexBuilder = nullptr;
+        double mTimeFrom = -1; // seconds from the start of the index, -1: unset
+        double mTimeTo = -1;
+        bool mRandomAccess = false;          // random_access_indicator of the current packet
+        vector<uint8_t> mUnitRandomAccess;   // per PID, of the open PES unit
+        bool mPtsFromIndex = false;          // PTS lines were printed from the index
+        bool mRangeActive = false;           // only units starting in mUnitRange are written
+        vector<pair<uint64_t, uint64_t>> mUnitRange;
+        bool mPsiChanged = false;             // PAT/PMT/SDT content grew since the last check
+        bool mProbe = false;
+        uint64_t mProbeBytes = 2 << 20;
+        int mProbeMs = 100;
+        ProbeReport mProbeReport;
+        TsMetrics* mMetrics = nullptr;  // set when a metrics file is requested
+        string mMetricsPath;
+        int mMetricsIntervalMs = 0;     // periodic snapshots, 0: only at the end
+        TsPcrTimeline* mPcr = nullptr;  // set while a PCR report is collected
+        bool mPcrReport = false;
+        string mPcrTimelinePath;        // CSV of the timeline, empty: none
+        int mPcrWindowMs = 1000;
+        TsMonitor* mMonitor = nullptr;  // set while TR 101 290 checks run
+        string mMonitorPath;            // --tr101290 error list
+        TsRemux* mRemux = nullptr;      // set while -r writes its output
+        string mRemuxPath;
+        vector<int> mRemuxKeep;         // --keep PIDs, empty: video, audio and text
+        TsAuTable* mAuTable = nullptr;  // set while the access unit table is collected
+        string mAuTablePath;
+        string mCheckpointPath;         // --checkpoint, empty: none
+        int mCheckpointIntervalSec = TS_CHECKPOINT_INTERVAL;
+        bool mCheckpointForce = false;  // --force: start over a checkpoint that does not match
+        bool mCheckpointing = false;    // the scan saves its state to mCheckpointPath
+        TsIndexFingerprint mCheckpointInput;
+        uint64_t mCheckpointOptions = 0; // taken before the run adds -o outputs of its own
+        map<uint64_t, vector<uint8_t>> mPsiSections; // while checkpointing: the section behind each mPsiCache entry
+        bool mBlockDecode = true; // parse() decodes TS_BLOCK_PACKETS headers at once where it can
     private:
-        void packet(uint8_t *pkt);
-        int parseAdaptationField(uint8_t *pkt, int pid);
-        void parsePes(uint8_t *pkt, int len, int pid);
-        int parsePat(uint8_t *pkt, int len);
-        void parsePmt(uint8_t *pkt, int len);
-        void parsePcr(uint8_t *pkt, int len);
-        void parsePesHeader(uint8_t *pkt, int len);
-        void parsePesPayload(uint8_t *pkt, int len);
-        void saveEs(uint8_t *pkt, int len, int pid);
+        void packet(const uint8_t *pkt);
+        bool readBlock(TsPacketBlock& block, const uint8_t*& data);
+        template <class Core> bool parseBlock(Core core, const uint8_t* data, const TsPacketBlock& block, bool ordered);
+        void selectCore();
+        void onSection(int pid, int role, const uint8_t* section, int len);
+        void pesPayload(const uint8_t* pkt, int offset, int pid, int continuity_counter, int payload_unit_start_indicator);
+        void setPcrPrograms();
+        void setMonitorPids();
+        void countDropped(int pid, const uint8_t* pkt);
+        // Size the metrics charge a packet with; while the pipeline runs the
+        // reader thread owns mPacketSize, the parser takes it from the batch
+        int countedPacketSize() const { return mPipelineRunning ? mBatchPacketSize : mPacketSize; }
+        void updateRemux();
+        void feedRemux(const uint8_t* pkt);
+        int finishRemux();
+        bool acceptSection(int pid, const uint8_t* section, int len);
+        void removeProgram(int programNumber);
+        void parsePat(const uint8_t *pkt, int len);
+        void parsePmt(const uint8_t *pkt, int len);
+        void parsePcr(const uint8_t *pkt, int len);
+        void parsePesHeader(const uint8_t *pkt, int len);
+        void parsePesPayload(const uint8_t *pkt, int len);
+        void saveEs(const uint8_t *pkt, int len, int pid);
+        void onPesHeader(const PesUnit& unit) override;
+        void printTimestamp(const TsTimestampRecord& record);
+        void onPesUnit(const PesUnit& unit) override;
         void storeStreamInfo(const uint8_t* es_info, int es_info_length, uint8_t stream_type, uint16_t elementary_pid);
-        string parsePrivatePesDescriptor(const uint8_t* es_info, int es_info_length);
-        void parseSdt(uint8_t *pkt, int len);
-        void processSectionData(uint8_t* pkt, int offset, int pid, int continuity_counter, int payload_unit_start_indicator, std::map<int, SectionBuffer>& secbuf_map, void (TsParser::*parseFunc)(uint8_t*, int));
-        bool readNextTsPacket(FILE* fp, uint8_t* pkt, bool& isSynced);
+        void parsePrivatePesDescriptor(const uint8_t* es_info, int es_info_length, string& desc_detail);
+        void parseSdt(const uint8_t *pkt, int len);
+        void rebuildPidTable();
+        void openOutputs();
+        void recordLatency();
+        void printLatency();
+        bool isPsiComplete() const;
+        bool isStreamInfoComplete(ProbeReport* report = nullptr) const;
+        bool probe();
+        void parseChunks();
+        bool parseWithIndex(int& ret);
+        void finishParse(bool live);
+        bool checkpointUsable(bool everyPacket);
+        uint64_t checkpointOptions() const;
+        int loadCheckpoint(TsCheckpointReader& checkpoint);
+        int resumeCheckpoint(TsCheckpointReader& checkpoint, bool& isSynced);
+        int writeCheckpoint();
+        void parsePipelined();
+        void submitEsBatch(bool last);
+        void printPipelineStats();
+        void initWorker(const TsParser& master);
+        void parseChunk(const uint8_t* data, size_t size, uint64_t dataOffset, uint64_t start, uint64_t end, int packetSize, bool startSynced, ParseChunkResult& result);
+        size_t fillInput(size_t want);
+        bool readNextTsPacket(const uint8_t*& pkt, bool& isSynced);
+};
+
+// Sinks binding TsParserCore to a TsParser
+struct TsParserPsi {
+    TsParser* parser;
+    void section(int pid, int role, const uint8_t* data, int len) {
+        parser->onSection(pid, role, data, len);
+    }
+};
+
+struct TsParserPes {
+    static constexpr bool enabled = true;
+    TsParser* parser;
+    void payload(const PidEntry& entry, const uint8_t* pkt, int offset, int pid, int cc, int pusi) {
+        if (entry.assemble) {
+            parser->pesPayload(pkt, offset, pid, cc, pusi);
+        }
+    }
+};
+
+struct TsParserPcr {
+    static constexpr bool enabled = true;
+    TsParser* parser;
+    void countPacket(int pid, const uint8_t* pkt) {
+        if (parser->mPcr) {
+            parser->mPcr->countPacket(pid);
+        }
+        if (parser->mMonitor) {
+            parser->mMonitor->packet(pid, pkt, parser->mPacketOffset);
+        }
+    }
+    void randomAccess(bool flag) { parser->mRandomAccess = flag; }
+    void pcr(int pid, uint64_t pcr, bool discontinuity) {
+        parser->mLastPcr[pid] = pcr;
+        if (parser->mIndexBuilder) {
+            parser->mIndexBuilder->addPcr(pid, pcr, parser->mPacketOffset);
+        }
+        if (parser->mPcr) {
+            parser->mPcr->addPcr(pid, pcr, discontinuity);
+        }
+        if (parser->mMonitor) {
+            parser->mMonitor->pcr(pid, pcr, discontinuity, parser->mPacketOffset);
+        }
+    }
 };
 
+#ifndef TS_NO_METRICS
+struct TsParserMetrics {
+    TsParser* parser;
+    TsMetricTimer dispatchTimer() {
+        bool sampled = (parser->mPacketIndex & (TS_METRICS_SAMPLE - 1)) == 0;
+        return TsMetricTimer(sampled ? parser->mMetrics : nullptr, METRIC_STAGE_DISPATCH);
+    }
+    TsMetricTimer sectionTimer() { return TsMetricTimer(parser->mMetrics, METRIC_STAGE_SECTION); }
+    void countPacket(int pid, const uint8_t* pkt) {
+        if (parser->mMetrics) {
+            parser->mMetrics->countPacket(pid, pkt, parser->countedPacketSize());
+        }
+    }
+    void section(int pid) {
+        if (parser->mMetrics) {
+            parser->mMetrics->pid(pid).sections++;
+        }
+    }
+    void sectionError(int pid) {
+        if (parser->mMetrics) {
+            parser->mMetrics->pid(pid).sectionErrors++;
+        }
+    }
+};
+#else
+struct TsParserMetrics : NoMetricsSink {
+    TsParserMetrics(TsParser*) {}
+};
+#endif
+
+// The configurations the command line runs, instantiated in TsParser.cpp
+typedef TsParserCore<TsParserPsi, NoPesSink, NoPcrSink, NoMetricsSink> TsPsiCore;
+typedef TsParserCore<TsParserPsi, TsParserPes, NoPcrSink, NoMetricsSink> TsPesCore;
+typedef TsParserCore<TsParserPsi, TsParserPes, TsParserPcr, TsParserMetrics> TsFullCore;
+extern template class TsParserCore<TsParserPsi, NoPesSink, NoPcrSink, NoMetricsSink>;
+extern template class TsParserCore<TsParserPsi, TsParserPes, NoPcrSink, NoMetricsSink>;
+extern template class TsParserCore<TsParserPsi, TsParserPes, TsParserPcr, TsParserMetrics>;
+
 #endif /* _TS_PARSER_H_ */
\ No newline at end of file
@@ -0,0 +1,218 @@
+/**
+ * File: TsParserCore.h
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: TsParserCore template, per packet parsing parameterised on its sinks
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _TS_PARSER_CORE_H_
+#define _TS_PARSER_CORE_H_
+
+#include <cstdint>
+#include "SectionPool.h"
+#include "TsBlock.h"
+using namespace std;
+
+class EsSink;
+
+typedef enum pid_role {
+    PID_ROLE_NONE = 0,
+    PID_ROLE_PAT,
+    PID_ROLE_SDT,
+    PID_ROLE_PMT,
+    PID_ROLE_PES,
+    PID_ROLE_NULL,
+} PidRole;
+
+// One slot per PID, rebuilt when PAT/PMT content changes
+struct PidEntry {
+    uint8_t role = PID_ROLE_NONE; // PAT/SDT/PMT sections go to the PSI sink by role
+    bool printPts = false;
+    uint16_t pcrPid = 0x1fff; // PES: PCR PID of its program
+    SectionBuffer* sectionBuf = nullptr; // PAT/PMT/SDT, from mSections
+    EsSink* out = nullptr; // ES sink for -o
+    bool assemble = false; // PES payload is reassembled (-o or -p wants it)
+};
+
+/*
+ * Sinks that take no part in a configuration. Their hooks are empty inline
+ * functions, so the code in front of them folds away as well.
+ */
+struct NoPesSink {
+    static constexpr bool enabled = false;
+    void payload(const PidEntry&, const uint8_t*, int, int, int, int) {}
+};
+
+struct NoPcrSink {
+    static constexpr bool enabled = false;
+    void countPacket(int, const uint8_t*) {}
+    void randomAccess(bool) {}
+    void pcr(int, uint64_t, bool) {}
+};
+
+struct NoMetricsSink {
+    struct Timer {};
+    Timer dispatchTimer() { return Timer(); }
+    Timer sectionTimer() { return Timer(); }
+    void countPacket(int, const uint8_t*) {}
+    void section(int) {}
+    void sectionError(int) {}
+};
+
+/*
+ * The per packet work of the parser: header, PID dispatch, adaptation
+ * field, PSI section assembly and the hand-off of PES payload. packet()
+ * decodes the header itself, decoded() takes one from a TsPacketBlock. What is done
+ * with the results is up to the sinks:
+ *   PsiSink      section(pid, role, data, len) for every complete section
+ *   PesSink      payload(entry, pkt, offset, pid, cc, pusi), 'enabled'
+ *   PcrSink      countPacket(pid, pkt), randomAccess(flag), pcr(pid, pcr,
+ *                discontinuity), 'enabled'
+ *   MetricsSink  dispatchTimer(), sectionTimer(), countPacket(pid, pkt),
+ *                section(pid), sectionError(pid)
+ * Each combination is compiled on its own, a disabled feature leaves no
+ * test behind. The sinks are small handles, the core is built per call.
+ */
+template <class PsiSink, class PesSink, class PcrSink, class MetricsSink>
+class TsParserCore {
+    public:
+        TsParserCore(const PidEntry* table, PsiSink psi, PesSink pes, PcrSink pcr, MetricsSink metrics)
+            : mTable(table), mPsi(psi), mPes(pes), mPcr(pcr), mMetrics(metrics) {
+        }
+        // 'pkt' starts with the sync byte
+        void packet(const uint8_t* pkt);
+        // ... its header already split up: 'flags' TS_BLOCK_*, 'payload' the
+        // payload offset
+        void decoded(const uint8_t* pkt, int pid, int flags, int continuity_counter, int payload);
+        void sectionData(const uint8_t* pkt, int offset, int pid, int continuity_counter, int payload_unit_start_indicator, const PidEntry& entry);
+    private:
+        int adaptationField(const uint8_t* af, int pid);
+        const PidEntry* mTable;
+        PsiSink mPsi;
+        PesSink mPes;
+        PcrSink mPcr;
+        MetricsSink mMetrics;
+};
+
+template <class PsiSink, class PesSink, class PcrSink, class MetricsSink>
+inline void TsParserCore<PsiSink, PesSink, PcrSink, MetricsSink>::packet(const uint8_t* pkt) {
+    const int pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+    const int adaptation_field_control = (pkt[3] >> 4) & 0x03;
+    const int flags = ((pkt[1] >> 6) & 0x01) | ((adaptation_field_control & 0x02) ? TS_BLOCK_AF : 0) |
+                      ((adaptation_field_control & 0x01) ? TS_BLOCK_PAYLOAD : 0);
+    // +1: adaptation_field_length
+    const int payload = (adaptation_field_control & 0x02) ? 5 + pkt[4] : 4;
+    decoded(pkt, pid, flags, pkt[3] & 0x0F, payload);
+}
+
+template <class PsiSink, class PesSink, class PcrSink, class MetricsSink>
+inline void TsParserCore<PsiSink, PesSink, PcrSink, MetricsSink>::decoded(const uint8_t* pkt, int pid, int flags, int continuity_counter, int payload) {
+    [[maybe_unused]] auto timer = mMetrics.dispatchTimer();
+    mMetrics.countPacket(pid, pkt);
+    mPcr.countPacket(pid, pkt);
+    const PidEntry& entry = mTable[pid];
+    if (entry.role == PID_ROLE_NULL) {
+        return;
+    }
+    mPcr.randomAccess(false);
+    // The payload offset is known, only the PCR sink wants the field itself
+    if (PcrSink::enabled && (flags & TS_BLOCK_AF)) {
+        adaptationField(pkt + 4, pid);
+    }
+    if (!(flags & TS_BLOCK_PAYLOAD)) {
+        return;
+    }
+    const int payload_unit_start_indicator = flags & TS_BLOCK_PUSI;
+    switch (entry.role) {
+        case PID_ROLE_PAT:
+        case PID_ROLE_SDT:
+        case PID_ROLE_PMT:
+            sectionData(pkt, payload, pid, continuity_counter, payload_unit_start_indicator, entry);
+            break;
+        case PID_ROLE_PES:
+            if (PesSink::enabled) {
+                mPes.payload(entry, pkt, payload, pid, continuity_counter, payload_unit_start_indicator);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+template <class PsiSink, class PesSink, class PcrSink, class MetricsSink>
+inline int TsParserCore<PsiSink, PesSink, PcrSink, MetricsSink>::adaptationField(const uint8_t* af, int pid) {
+    const uint8_t adaptation_field_length = af[0];
+    if (adaptation_field_length == 0) {
+        return 0;
+    }
+    mPcr.randomAccess((af[1] >> 6) & 0x01);
+    if (af[1] & 0x10) {
+        if (adaptation_field_length < 7) {
+            return 0;
+        }
+        if (PcrSink::enabled) {
+            uint64_t pcr_base = (((uint64_t)af[2]) << 25)
+                        | (af[3] << 17)
+                        | (af[4] << 9)
+                        | (af[5] << 1)
+                        | ((af[6] & 0x80) >> 7);
+            uint64_t pcr_extension = ((af[6] & 0x01) << 8) | af[7];
+            mPcr.pcr(pid, pcr_base * 300 + pcr_extension, (af[1] >> 7) & 0x01);
+        }
+    }
+    return adaptation_field_length;
+}
+
+template <class PsiSink, class PesSink, class PcrSink, class MetricsSink>
+inline void TsParserCore<PsiSink, PesSink, PcrSink, MetricsSink>::sectionData(const uint8_t* pkt, int offset, int pid, int continuity_counter, int payload_unit_start_indicator, const PidEntry& entry) {
+    [[maybe_unused]] auto timer = mMetrics.sectionTimer();
+    // The sink may rebuild the PID table, the buffer itself stays
+    SectionBuffer& secbuf = *entry.sectionBuf;
+    const int role = entry.role;
+    if (payload_unit_start_indicator) {
+        secbuf.clear();
+        secbuf.collecting = true;
+        secbuf.last_cc = continuity_counter;
+        int pointer_field = pkt[offset];
+        offset += 1 + pointer_field;
+        int remain = 188 - offset;
+        if (remain > 0) {
+            secbuf.append(pkt + offset, remain);
+        }
+        if (secbuf.length >= 3) {
+            int section_length = ((secbuf.data[1] & 0x0F) << 8) | secbuf.data[2];
+            secbuf.expected_length = section_length + 3;
+        }
+    } else if (secbuf.collecting) {
+        if (((secbuf.last_cc + 1) & 0x0F) != continuity_counter) {
+            mMetrics.sectionError(pid);
+            secbuf.clear();
+        } else {
+            secbuf.last_cc = continuity_counter;
+            int remain = 188 - offset;
+            if (remain > 0) {
+                secbuf.append(pkt + offset, remain);
+            }
+        }
+    }
+    if (secbuf.collecting && secbuf.expected_length > 0 &&
+        secbuf.length >= secbuf.expected_length) {
+        secbuf.collecting = false;
+        mMetrics.section(pid);
+        mPsi.section(pid, role, secbuf.data, secbuf.expected_length);
+        secbuf.clear();
+    }
+}
+
+#endif /* _TS_PARSER_CORE_H_ */
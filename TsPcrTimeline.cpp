@@ -0,0 +1,244 @@
+/**
+ * File: TsPcrTimeline.cpp
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: Implementation of TsPcrTimeline
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "TsPcrTimeline.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#define TS_BITS_PER_PACKET (188 * 8) // M2TS time codes and RS parity are not transport rate
+
+void PcrRate::add(uint64_t windowBits, uint64_t windowTicks) {
+    double bps = windowBits * (double)PCR_CLOCK_HZ / windowTicks;
+    minBps = windows ? std::min(minBps, bps) : bps;
+    maxBps = windows ? std::max(maxBps, bps) : bps;
+    bits += windowBits;
+    ticks += windowTicks;
+    windows++;
+}
+
+TsPcrTimeline::TsPcrTimeline(int windowMs)
+    : mWindowTicks(std::max(1, windowMs) * (PCR_CLOCK_HZ / 1000)),
+      mPidPackets(8192),
+      mClockSlot(8192, -1) {
+}
+
+PcrClock& TsPcrTimeline::clock(int pid) {
+    int& slot = mClockSlot[pid];
+    if (slot < 0) {
+        slot = mClocks.size();
+        mClocks.emplace_back();
+        mClocks.back().pid = pid;
+    }
+    return mClocks[slot];
+}
+
+void TsPcrTimeline::setProgram(int program, int pcrPid, const vector<int>& pids) {
+    if (pcrPid >= 0x1fff) {
+        // No PCR, nothing to measure against
+        return;
+    }
+    PcrClock& c = clock(pcrPid);
+    if (std::find(c.programs.begin(), c.programs.end(), program) == c.programs.end()) {
+        c.programs.push_back(program);
+    }
+    for (int pid : pids) {
+        if (std::find(c.pids.begin(), c.pids.end(), pid) == c.pids.end()) {
+            c.pids.push_back(pid);
+            c.windowPackets.push_back(mPidPackets[pid]);
+            c.pidRates.emplace_back();
+        }
+    }
+}
+
+// After the first PCR and after a discontinuity: nothing before it can be
+// compared with what follows
+void TsPcrTimeline::startSegment(PcrClock& c, uint64_t pcr, uint64_t packet) {
+    c.segmentStart = pcr;
+    c.last = pcr;
+    c.lastPacket = packet;
+    c.windowPcr = pcr;
+    c.windowPacket = packet;
+    for (size_t i = 0; i < c.pids.size(); i++) {
+        c.windowPackets[i] = mPidPackets[c.pids[i]];
+    }
+}
+
+void TsPcrTimeline::closeWindow(PcrClock& c, uint64_t pcr, uint64_t packet) {
+    const uint64_t ticks = pcr - c.windowPcr;
+    const uint64_t packets = packet - c.windowPacket;
+    c.muxRate.add(packets * TS_BITS_PER_PACKET, ticks);
+    if (packets > 0) {
+        c.ticksPerPacket = (double)ticks / packets;
+    }
+    uint64_t program_packets = 0;
+    for (size_t i = 0; i < c.pids.size(); i++) {
+        uint64_t count = mPidPackets[c.pids[i]];
+        c.pidRates[i].add((count - c.windowPackets[i]) * TS_BITS_PER_PACKET, ticks);
+        program_packets += count - c.windowPackets[i];
+        c.windowPackets[i] = count;
+    }
+    if (!c.pids.empty()) {
+        c.programRate.add(program_packets * TS_BITS_PER_PACKET, ticks);
+    }
+    c.windowPcr = pcr;
+    c.windowPacket = packet;
+}
+
+void TsPcrTimeline::addPoint(PcrClock& c, uint64_t packet) {
+    if (c.skipped++ % c.stride != 0) {
+        return;
+    }
+    if (c.points.size() == PCR_TIMELINE_POINTS) {
+        // Full: keep every other point and take half as many from now on
+        for (size_t i = 0; i < c.points.size() / 2; i++) {
+            c.points[i] = c.points[2 * i];
+        }
+        c.points.resize(c.points.size() / 2);
+        c.stride *= 2;
+        c.skipped = 1;
+    }
+    c.points.push_back({c.durationTicks + c.last - c.segmentStart, packet});
+}
+
+void TsPcrTimeline::addPcr(int pid, uint64_t pcr, bool discontinuity) {
+    PcrClock& c = clock(pid);
+    const uint64_t packet = mPackets - 1; // countPacket() saw this packet already
+    c.count++;
+    if (!c.started) {
+        c.started = true;
+        c.lastRaw = pcr;
+        startSegment(c, pcr, packet);
+        addPoint(c, packet);
+        return;
+    }
+    if (pcr < c.lastRaw && c.lastRaw - pcr > PCR_WRAP / 2) {
+        c.wraps += PCR_WRAP;
+    }
+    c.lastRaw = pcr;
+    const uint64_t value = pcr + c.wraps;
+    if (discontinuity || value < c.last || value - c.last > PCR_MAX_JUMP) {
+        c.discontinuities++;
+        c.durationTicks += c.last - c.segmentStart;
+        // A jump back would otherwise count as a wrap the next time
+        c.wraps = 0;
+        c.lastRaw = pcr;
+        startSegment(c, pcr, packet);
+        addPoint(c, packet);
+        return;
+    }
+    const uint64_t interval = value - c.last;
+    c.intervals++;
+    c.intervalSum += interval;
+    c.intervalMin = std::min(c.intervalMin, interval);
+    c.intervalMax = std::max(c.intervalMax, interval);
+    c.intervalsOver += interval > PCR_MAX_INTERVAL;
+    if (c.ticksPerPacket > 0) {
+        double predicted = c.last + (packet - c.lastPacket) * c.ticksPerPacket;
+        double ns = (value - predicted) * 1e9 / PCR_CLOCK_HZ;
+        c.jitterCount++;
+        c.jitterSumSq += ns * ns;
+        c.jitterMax = std::max(c.jitterMax, std::fabs(ns));
+    }
+    c.last = value;
+    c.lastPacket = packet;
+    if (value - c.windowPcr >= mWindowTicks) {
+        closeWindow(c, value, packet);
+    }
+    addPoint(c, packet);
+}
+
+static void printRate(std::ostream& out, const char* label, const PcrRate& rate) {
+    char line[160];
+    if (rate.windows == 0) {
+        snprintf(line, sizeof(line), "  %-12s no complete window", label);
+    } else {
+        snprintf(line, sizeof(line), "  %-12s min %.3f, avg %.3f, max %.3f Mbit/s", label,
+                 rate.minBps / 1e6, rate.averageBps() / 1e6, rate.maxBps / 1e6);
+    }
+    out << line << std::endl;
+}
+
+void TsPcrTimeline::printReport(std::ostream& out) const {
+    char line[200];
+    snprintf(line, sizeof(line), "PCR timeline (%.0f ms windows)", mWindowTicks * 1000.0 / PCR_CLOCK_HZ);
+    out << line << std::endl;
+    if (mClocks.empty()) {
+        out << "  no PCR found" << std::endl;
+    }
+    for (const auto& c : mClocks) {
+        string programs;
+        for (int program : c.programs) {
+            programs += (programs.empty() ? " (program " : ", ") + std::to_string(program);
+        }
+        if (!programs.empty()) {
+            programs += ")";
+        }
+        double duration = (c.durationTicks + c.last - c.segmentStart) / (double)PCR_CLOCK_HZ;
+        snprintf(line, sizeof(line), "PCR PID 0x%04x%s: %.3f s, %llu PCRs, %llu discontinuities", c.pid,
+                 programs.c_str(), duration, (unsigned long long)c.count, (unsigned long long)c.discontinuities);
+        out << line << std::endl;
+        if (c.intervals > 0) {
+            snprintf(line, sizeof(line), "  %-12s min %.3f, avg %.3f, max %.3f ms, %llu over %llu ms", "interval",
+                     c.intervalMin * 1000.0 / PCR_CLOCK_HZ, c.intervalSum * 1000.0 / PCR_CLOCK_HZ / c.intervals,
+                     c.intervalMax * 1000.0 / PCR_CLOCK_HZ, (unsigned long long)c.intervalsOver,
+                     (unsigned long long)(PCR_MAX_INTERVAL * 1000 / PCR_CLOCK_HZ));
+            out << line << std::endl;
+        }
+        if (c.jitterCount > 0) {
+            snprintf(line, sizeof(line), "  %-12s max %.0f ns, rms %.0f ns", "accuracy",
+                     c.jitterMax, std::sqrt(c.jitterSumSq / c.jitterCount));
+            out << line << std::endl;
+        }
+        printRate(out, "multiplex", c.muxRate);
+        if (!c.pids.empty()) {
+            printRate(out, "program", c.programRate);
+        }
+        for (size_t i = 0; i < c.pids.size(); i++) {
+            char label[16];
+            snprintf(label, sizeof(label), "pid 0x%04x", c.pids[i]);
+            printRate(out, label, c.pidRates[i]);
+        }
+    }
+}
+
+int TsPcrTimeline::writeTimeline(const string& path) const {
+    std::ofstream out(path);
+    out << "pcr_pid,time_s,packet,bitrate_bps\n";
+    char line[128];
+    for (const auto& c : mClocks) {
+        for (size_t i = 0; i < c.points.size(); i++) {
+            const PcrPoint& p = c.points[i];
+            int n = snprintf(line, sizeof(line), "%d,%.6f,%llu,", c.pid, p.time / (double)PCR_CLOCK_HZ,
+                             (unsigned long long)p.packet);
+            if (i > 0 && p.time > c.points[i - 1].time) {
+                const PcrPoint& q = c.points[i - 1];
+                snprintf(line + n, sizeof(line) - n, "%.0f",
+                         (p.packet - q.packet) * (double)TS_BITS_PER_PACKET * PCR_CLOCK_HZ / (p.time - q.time));
+            }
+            out << line << '\n';
+        }
+    }
+    if (!out) {
+        std::cerr << "Cannot write the PCR timeline to " << path << std::endl;
+        return -1;
+    }
+    return 0;
+}
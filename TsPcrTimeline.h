@@ -0,0 +1,126 @@
+/**
+ * File: TsPcrTimeline.h
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: TsPcrTimeline class definition, PCR based timing and bitrates
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _TS_PCR_TIMELINE_H_
+#define _TS_PCR_TIMELINE_H_
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Timeline points kept per PCR PID; when full every other one is dropped
+#ifndef PCR_TIMELINE_POINTS
+#define PCR_TIMELINE_POINTS 1024
+#endif
+
+#define PCR_CLOCK_HZ        27000000ULL
+#define PCR_WRAP            ((1ULL << 33) * 300)
+#define PCR_MAX_INTERVAL    (PCR_CLOCK_HZ / 10)  // 100 ms, ISO/IEC 13818-1
+#define PCR_MAX_JUMP        PCR_CLOCK_HZ         // larger steps are a discontinuity
+
+struct PcrPoint {
+    uint64_t time;   // 27 MHz since the first PCR, discontinuities cut out
+    uint64_t packet; // packets of the multiplex before the one carrying the PCR
+};
+
+// Bitrate over the windows of one clock
+struct PcrRate {
+    double minBps = 0;
+    double maxBps = 0;
+    uint64_t bits = 0;
+    uint64_t ticks = 0;
+    uint64_t windows = 0;
+    void add(uint64_t windowBits, uint64_t windowTicks);
+    double averageBps() const { return ticks ? bits * (double)PCR_CLOCK_HZ / ticks : 0; }
+};
+
+// Everything measured against one PCR PID
+struct PcrClock {
+    int pid = 0;
+    vector<int> programs;
+    bool started = false;
+    uint64_t lastRaw = 0;        // last PCR as sent
+    uint64_t wraps = 0;          // PCR_WRAP added so far
+    uint64_t last = 0;           // last PCR, unwrapped
+    uint64_t lastPacket = 0;
+    uint64_t segmentStart = 0;   // first PCR since the last discontinuity
+    uint64_t durationTicks = 0;  // of the segments before the current one
+    uint64_t count = 0;
+    uint64_t discontinuities = 0;
+    uint64_t intervals = 0;
+    uint64_t intervalSum = 0;
+    uint64_t intervalMin = UINT64_MAX;
+    uint64_t intervalMax = 0;
+    uint64_t intervalsOver = 0;  // over PCR_MAX_INTERVAL
+    // PCR accuracy: the PCR against the value the previous window's
+    // transport rate predicts for its position
+    double ticksPerPacket = 0;   // 0: no complete window yet
+    uint64_t jitterCount = 0;
+    double jitterSumSq = 0;      // ns^2
+    double jitterMax = 0;        // ns, absolute
+    // Sliding window
+    uint64_t windowPcr = 0;
+    uint64_t windowPacket = 0;
+    vector<int> pids;            // PIDs of its programs, PMT included
+    vector<uint64_t> windowPackets; // per entry of 'pids', at the window start
+    vector<PcrRate> pidRates;
+    PcrRate programRate;
+    PcrRate muxRate;             // the whole multiplex, on this clock
+    // Downsampled timeline
+    vector<PcrPoint> points;
+    uint64_t stride = 1;         // PCRs per point
+    uint64_t skipped = 0;        // PCRs since the last point
+};
+
+/*
+ * Built in the parsing pass from the PCRs the adaptation fields carry and
+ * a packet count per PID. Per PCR PID it keeps the PCR interval and
+ * accuracy, the duration (discontinuities excluded), bitrates per window of
+ * the PIDs and programs on that clock and of the multiplex, and a timeline
+ * of at most PCR_TIMELINE_POINTS points: a day long recording takes the
+ * same few kilobytes as a minute.
+ */
+class TsPcrTimeline {
+    public:
+        TsPcrTimeline(int windowMs = 1000);
+        void countPacket(int pid) {
+            mPackets++;
+            mPidPackets[pid]++;
+        }
+        // 'discontinuity': the discontinuity_indicator of the packet
+        void addPcr(int pid, uint64_t pcr, bool discontinuity);
+        // A PMT (re)assigned 'pids' to the program whose PCR is on 'pcrPid'
+        void setProgram(int program, int pcrPid, const vector<int>& pids);
+        void printReport(std::ostream& out) const;
+        // pcr_pid, time in seconds, packet, multiplex bitrate since the previous point
+        int writeTimeline(const string& path) const;
+    private:
+        PcrClock& clock(int pid);
+        void startSegment(PcrClock& c, uint64_t pcr, uint64_t packet);
+        void closeWindow(PcrClock& c, uint64_t pcr, uint64_t packet);
+        void addPoint(PcrClock& c, uint64_t packet);
+        uint64_t mWindowTicks;
+        uint64_t mPackets = 0;
+        vector<uint64_t> mPidPackets;
+        vector<PcrClock> mClocks;
+        vector<int> mClockSlot; // PID -> index in mClocks, -1: none
+};
+
+#endif /* _TS_PCR_TIMELINE_H_ */
@@ -0,0 +1,348 @@
+/**
+ * File: TsRemux.cpp
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: Implementation of TsRemux
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "TsRemux.h"
+#include "TsCrc.h"
+#include "TsSync.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static inline uint64_t sectionKey(int pid, const uint8_t* section) {
+    return ((uint64_t)pid << 32) | ((uint64_t)section[0] << 24) |
+           ((uint64_t)((section[3] << 8) | section[4]) << 8) | section[6];
+}
+
+TsRemux::TsRemux(std::ostream* err)
+    : mErr(err),
+      mKeep(8192, 0),
+      mPsi(8192, 0),
+      mCc(8192, 0) {
+    mBuffer.reserve(TS_REMUX_BUFFER_SIZE);
+}
+
+TsRemux::~TsRemux() {
+    if (mInFd >= 0) {
+        ::close(mInFd);
+    }
+    if (mOwnOut && mOutFd >= 0) {
+        ::close(mOutFd);
+    }
+}
+
+int TsRemux::open(const string& inPath, const string& outPath) {
+    mInFd = ::open(inPath.c_str(), O_RDONLY);
+    if (mInFd < 0) {
+        *mErr << "Cannot open " << inPath << ": " << strerror(errno) << std::endl;
+        return -1;
+    }
+    mOutPath = outPath;
+    if (outPath == "-") {
+        mOutFd = STDOUT_FILENO;
+    } else {
+        mOutFd = ::open(outPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        mOwnOut = true;
+    }
+    if (mOutFd < 0) {
+        *mErr << "Cannot create " << outPath << ": " << strerror(errno) << std::endl;
+        return -1;
+    }
+    struct stat st;
+    mOutIsPipe = fstat(mOutFd, &st) == 0 && S_ISFIFO(st.st_mode);
+    return 0;
+}
+
+void TsRemux::setKeep(const vector<uint8_t>& keepPids, const vector<uint8_t>& psiPids, const vector<int>& programs) {
+    mKeep = keepPids;
+    mPsi = psiPids;
+    mPrograms = programs;
+    mDirty = true;
+}
+
+void TsRemux::setSection(int pid, const uint8_t* section, int len) {
+    if (len < 12) {
+        return;
+    }
+    mSections[sectionKey(pid, section)].assign(section, section + len);
+    mDirty = true;
+}
+
+// PAT: the programs that are left. PMT: the streams that are left, and
+// nothing for a program that is gone.
+void TsRemux::rewrite() {
+    mRewritten.clear();
+    for (const auto& entry : mSections) {
+        const vector<uint8_t>& s = entry.second;
+        const int pid = entry.first >> 32;
+        const int end = s.size() - 4; // CRC_32
+        vector<uint8_t> out;
+        if (s[0] == 0x00) {
+            out.assign(s.begin(), s.begin() + 8);
+            for (int pos = 8; pos + 4 <= end; pos += 4) {
+                int program = (s[pos] << 8) | s[pos + 1];
+                if (program == 0 || std::find(mPrograms.begin(), mPrograms.end(), program) != mPrograms.end()) {
+                    out.insert(out.end(), s.begin() + pos, s.begin() + pos + 4);
+                }
+            }
+        } else if (s[0] == 0x02) {
+            int program = (s[3] << 8) | s[4];
+            int header = 12 + (((s[10] & 0x0f) << 8) | s[11]);
+            if (!mPsi[pid] || header > end ||
+                std::find(mPrograms.begin(), mPrograms.end(), program) == mPrograms.end()) {
+                continue;
+            }
+            out.assign(s.begin(), s.begin() + header);
+            int pos = header;
+            while (pos + 5 <= end) {
+                int elementary_pid = ((s[pos + 1] & 0x1f) << 8) | s[pos + 2];
+                int next = pos + 5 + (((s[pos + 3] & 0x0f) << 8) | s[pos + 4]);
+                if (next > end) {
+                    break;
+                }
+                if (mKeep[elementary_pid]) {
+                    out.insert(out.end(), s.begin() + pos, s.begin() + next);
+                }
+                pos = next;
+            }
+        } else {
+            continue;
+        }
+        int section_length = out.size() + 4 - 3;
+        out[1] = (out[1] & 0xf0) | ((section_length >> 8) & 0x0f);
+        out[2] = section_length & 0xff;
+        uint32_t crc = tsCrc32(out.data(), out.size());
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            out.push_back(crc >> shift);
+        }
+        mRewritten[entry.first] = std::move(out);
+    }
+    mDirty = false;
+}
+
+void TsRemux::hold(const uint8_t* pkt, uint64_t offset, size_t len, int packetSize) {
+    mHeld.push_back({pkt, offset, (uint32_t)len, (uint16_t)packetSize});
+}
+
+void TsRemux::release() {
+    mHolding = false;
+    for (const auto& held : mHeld) {
+        packet(held.pkt, held.offset, held.len, held.packetSize);
+    }
+    vector<Held>().swap(mHeld);
+}
+
+void TsRemux::packet(const uint8_t* pkt, uint64_t offset, size_t len, int packetSize) {
+    mStats.packets++;
+    const int pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+    if (!mKeep[pid]) {
+        return;
+    }
+    if (mPsi[pid]) {
+        writePsi(pkt, len, packetSize);
+        return;
+    }
+    mStats.keptPackets++;
+    // A unit is the TP_extra_header (M2TS) before the packet, the packet
+    // and the RS parity after it
+    const size_t lead = packetSize == M2TS_PACKET_SIZE && offset >= 4 ? 4 : 0;
+    const size_t body = std::min(len, (size_t)(packetSize == RS_TS_PACKET_SIZE ? RS_TS_PACKET_SIZE : TS_PACKET_SIZE));
+    keepUnit(pkt - lead, offset - lead, lead + body);
+}
+
+void TsRemux::keepUnit(const uint8_t* unit, uint64_t offset, size_t len) {
+    if (mRunLen > 0 && offset == mRunStart + mRunLen) {
+        if (mRunBuffered && mBuffer.size() + len > TS_REMUX_BUFFER_SIZE) {
+            // What is buffered of the run goes out, the run goes on from here
+            flushBuffer();
+            mRunStart += mRunLen;
+            mRunLen = 0;
+            mRunBufStart = 0;
+        }
+    } else {
+        closeRun();
+        if (mBuffer.size() + len > TS_REMUX_BUFFER_SIZE) {
+            flushBuffer();
+        }
+        mRunStart = offset;
+        mRunLen = 0;
+        mRunBuffered = true;
+        mRunBufStart = mBuffer.size();
+    }
+    mRunLen += len;
+    if (!mRunBuffered) {
+        return;
+    }
+    if (mKernelCopy && mRunLen >= TS_REMUX_COPY_MIN) {
+        // Long enough for the kernel: forget the bytes staged so far
+        mBuffer.resize(mRunBufStart);
+        mRunBuffered = false;
+    } else {
+        mBuffer.insert(mBuffer.end(), unit, unit + len);
+    }
+}
+
+// The rewritten section replaces the original from its first packet on;
+// the packets that continue the original are dropped
+void TsRemux::writePsi(const uint8_t* pkt, size_t len, int packetSize) {
+    if (!(pkt[1] & 0x40) || !(pkt[3] & 0x10)) {
+        return;
+    }
+    int offset = 4 + ((pkt[3] & 0x20) ? 1 + pkt[4] : 0);
+    if (offset >= TS_PACKET_SIZE) {
+        return;
+    }
+    int start = offset + 1 + pkt[offset];
+    if (start + 8 > TS_PACKET_SIZE) {
+        return;
+    }
+    const int pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+    if (mDirty) {
+        rewrite();
+    }
+    auto it = mRewritten.find(sectionKey(pid, pkt + start));
+    if (it == mRewritten.end()) {
+        return;
+    }
+    closeRun();
+    // New packets keep the original's TP_extra_header or parity bytes
+    const uint8_t* lead = pkt - 4;
+    const size_t lead_len = packetSize == M2TS_PACKET_SIZE ? 4 : 0;
+    const uint8_t* trail = pkt + TS_PACKET_SIZE;
+    const size_t trail_len = packetSize == RS_TS_PACKET_SIZE && len >= RS_TS_PACKET_SIZE ? 16 : 0;
+    const vector<uint8_t>& section = it->second;
+    size_t sent = 0;
+    while (sent < section.size()) {
+        uint8_t ts[TS_PACKET_SIZE];
+        memset(ts, 0xff, sizeof(ts));
+        ts[0] = 0x47;
+        ts[1] = (sent == 0 ? 0x40 : 0x00) | (pid >> 8);
+        ts[2] = pid & 0xff;
+        ts[3] = 0x10 | mCc[pid];
+        mCc[pid] = (mCc[pid] + 1) & 0x0f;
+        int pos = 4;
+        if (sent == 0) {
+            ts[pos++] = 0; // pointer_field
+        }
+        size_t n = std::min(section.size() - sent, (size_t)(TS_PACKET_SIZE - pos));
+        memcpy(ts + pos, section.data() + sent, n);
+        sent += n;
+        append(lead, lead_len);
+        append(ts, TS_PACKET_SIZE);
+        append(trail, trail_len);
+        mStats.psiPackets++;
+    }
+}
+
+void TsRemux::closeRun() {
+    if (mRunLen > 0 && !mRunBuffered) {
+        flushBuffer();
+        copyRange(mRunStart, mRunLen);
+    }
+    mRunLen = 0;
+    mRunBuffered = true;
+}
+
+void TsRemux::append(const uint8_t* data, size_t len) {
+    if (mBuffer.size() + len > TS_REMUX_BUFFER_SIZE) {
+        flushBuffer();
+    }
+    mBuffer.insert(mBuffer.end(), data, data + len);
+}
+
+static bool writeAll(int fd, const uint8_t* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::write(fd, data, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+void TsRemux::flushBuffer() {
+    if (mBuffer.empty()) {
+        return;
+    }
+    if (!mFailed && !writeAll(mOutFd, mBuffer.data(), mBuffer.size())) {
+        *mErr << "Cannot write " << mOutPath << ": " << strerror(errno) << std::endl;
+        mFailed = true;
+    }
+    mStats.bufferedBytes += mBuffer.size();
+    mBuffer.clear();
+}
+
+void TsRemux::copyRange(uint64_t offset, uint64_t len) {
+    while (len > 0 && mKernelCopy && !mFailed) {
+        loff_t in_offset = offset;
+        ssize_t n = mOutIsPipe ? splice(mInFd, &in_offset, mOutFd, nullptr, len, SPLICE_F_MORE)
+                               : copy_file_range(mInFd, &in_offset, mOutFd, nullptr, len, 0);
+        if (n > 0) {
+            offset += n;
+            len -= n;
+            mStats.copiedBytes += n;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS ||
+                             errno == EOPNOTSUPP || errno == EBADF)) {
+            // Not between these two files (filesystems, O_APPEND, a socket):
+            // read and write from now on
+            mKernelCopy = false;
+        } else {
+            *mErr << "Cannot copy to " << mOutPath << ": " << (n < 0 ? strerror(errno) : "input truncated") << std::endl;
+            mFailed = true;
+        }
+    }
+    while (len > 0 && !mFailed) {
+        mBuffer.resize(std::min<uint64_t>(len, TS_REMUX_BUFFER_SIZE));
+        ssize_t n = pread(mInFd, mBuffer.data(), mBuffer.size(), offset);
+        if (n <= 0) {
+            *mErr << "Cannot read the input at offset " << offset << std::endl;
+            mFailed = true;
+            break;
+        }
+        mBuffer.resize(n);
+        offset += n;
+        len -= n;
+        flushBuffer();
+    }
+    mBuffer.clear();
+}
+
+int TsRemux::finish() {
+    if (mHolding) {
+        release();
+    }
+    closeRun();
+    flushBuffer();
+    if (mOwnOut && mOutFd >= 0) {
+        if (::close(mOutFd) != 0 && !mFailed) {
+            *mErr << "Cannot write " << mOutPath << ": " << strerror(errno) << std::endl;
+            mFailed = true;
+        }
+        mOutFd = -1;
+    }
+    return mFailed ? -1 : 0;
+}
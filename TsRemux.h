@@ -0,0 +1,118 @@
+/**
+ * File: TsRemux.h
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: TsRemux class definition, TS to TS PID filter
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _TS_REMUX_H_
+#define _TS_REMUX_H_
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Runs of kept packets at least this long are copied by the kernel
+#ifndef TS_REMUX_COPY_MIN
+#define TS_REMUX_COPY_MIN (64 << 10)
+#endif
+
+// Input read at most while the packets wait for the PMTs
+#ifndef TS_REMUX_HOLD_LIMIT
+#define TS_REMUX_HOLD_LIMIT (64ULL << 20)
+#endif
+
+#define TS_REMUX_BUFFER_SIZE (1 << 20)
+
+struct TsRemuxStats {
+    uint64_t packets = 0;
+    uint64_t keptPackets = 0;
+    uint64_t psiPackets = 0;   // rewritten PAT/PMT packets written
+    uint64_t copiedBytes = 0;  // by copy_file_range() or splice()
+    uint64_t bufferedBytes = 0;
+};
+
+/*
+ * Writes the packets of the kept PIDs to another file, in input order and
+ * in the input's packet format. PAT and PMT are replaced by versions that
+ * only list what was kept, sent where the originals started. Consecutive
+ * kept packets form a run: a long one goes from the input file to the
+ * output with copy_file_range() (splice() for a pipe) and never enters
+ * user space, short runs and rewritten packets go through a buffer.
+ */
+class TsRemux {
+    public:
+        TsRemux(std::ostream* err);
+        ~TsRemux();
+        // 'outPath' "-" is stdout
+        int open(const string& inPath, const string& outPath);
+        // PIDs to copy, PIDs whose PAT/PMT sections are rewritten, and the
+        // programs still listed in the PAT
+        void setKeep(const vector<uint8_t>& keepPids, const vector<uint8_t>& psiPids, const vector<int>& programs);
+        // A PAT or PMT section as received, the rewritten one follows it
+        void setSection(int pid, const uint8_t* section, int len);
+        // One packet: 'pkt' at input offset 'offset', 'len' bytes of its
+        // unit from there. The input must stay mapped until finish().
+        void packet(const uint8_t* pkt, uint64_t offset, size_t len, int packetSize);
+        // Until the tables are known: keep the packets for later
+        void hold(const uint8_t* pkt, uint64_t offset, size_t len, int packetSize);
+        void release();
+        bool holding() const { return mHolding; }
+        int finish();
+        const TsRemuxStats& stats() const { return mStats; }
+    private:
+        struct Held {
+            const uint8_t* pkt;
+            uint64_t offset;
+            uint32_t len;
+            uint16_t packetSize;
+        };
+        void keepUnit(const uint8_t* unit, uint64_t offset, size_t len);
+        void writePsi(const uint8_t* pkt, size_t len, int packetSize);
+        void closeRun();
+        void append(const uint8_t* data, size_t len);
+        void flushBuffer();
+        void copyRange(uint64_t offset, uint64_t len);
+        void rewrite();
+        std::ostream* mErr;
+        int mInFd = -1;
+        int mOutFd = -1;
+        bool mOwnOut = false;
+        string mOutPath;
+        bool mKernelCopy = true;   // until copy_file_range()/splice() fails
+        bool mOutIsPipe = false;
+        bool mFailed = false;
+        vector<uint8_t> mBuffer;
+        // The run being collected: input range, and where it starts in
+        // mBuffer while it is still short enough to be buffered
+        uint64_t mRunStart = 0;
+        uint64_t mRunLen = 0;
+        bool mRunBuffered = true;
+        size_t mRunBufStart = 0;
+        vector<uint8_t> mKeep;     // per PID
+        vector<uint8_t> mPsi;      // per PID: PAT/PMT, rewritten
+        vector<int> mPrograms;
+        vector<uint8_t> mCc;       // per PID, of the rewritten packets
+        map<uint64_t, vector<uint8_t>> mSections;  // received, by PID, table and extension
+        map<uint64_t, vector<uint8_t>> mRewritten; // what is sent instead
+        bool mDirty = false;
+        bool mHolding = true;
+        vector<Held> mHeld;
+        TsRemuxStats mStats;
+};
+
+#endif /* _TS_REMUX_H_ */
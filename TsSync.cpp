@@ -0,0 +1,197 @@
+/**
+ * File: TsSync.cpp
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: Implementation of TsSyncScanner (SSE2/AVX2 with scalar fallback)
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "TsSync.h"
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TS_SYNC_X86 1
+#endif
+
+// Checked in this order, so an ambiguous run (e.g. all 0x47) locks to 188
+static const int kPacketSizes[] = { TS_PACKET_SIZE, M2TS_PACKET_SIZE, RS_TS_PACKET_SIZE };
+
+// Scans positions [0, end) that have full lookahead; returns the first sync
+// position or -1
+typedef long (*SyncScanFunc)(const uint8_t* buf, size_t end, int confirm, int& packetSize);
+
+static inline int confirmPosition(const uint8_t* buf, size_t pos, int confirm) {
+    for (int size : kPacketSizes) {
+        int k = 1;
+        while (k <= confirm && buf[pos + (size_t)k * size] == 0x47) {
+            k++;
+        }
+        if (k > confirm) {
+            return size;
+        }
+    }
+    return 0;
+}
+
+static long scanScalar(const uint8_t* buf, size_t end, int confirm, int& packetSize) {
+    size_t pos = 0;
+    while (pos < end) {
+        const uint8_t* hit = (const uint8_t*)memchr(buf + pos, 0x47, end - pos);
+        if (!hit) {
+            break;
+        }
+        pos = hit - buf;
+        int size = confirmPosition(buf, pos, confirm);
+        if (size) {
+            packetSize = size;
+            return pos;
+        }
+        pos++;
+    }
+    return -1;
+}
+
+#ifdef TS_SYNC_X86
+// Candidates in a block are the set bits of 'mask'; for every packet size the
+// mask is ANDed with the compare mask 'size' bytes further, 'confirm' times.
+// The lowest surviving bit wins, ties go to the earlier size in kPacketSizes.
+static inline long pickCandidate(const unsigned int* sizeMasks, size_t base, int& packetSize) {
+    int best = -1;
+    for (int s = 0; s < 3; s++) {
+        if (sizeMasks[s]) {
+            int bit = __builtin_ctz(sizeMasks[s]);
+            if (best < 0 || bit < best) {
+                best = bit;
+                packetSize = kPacketSizes[s];
+            }
+        }
+    }
+    return best < 0 ? -1 : (long)(base + best);
+}
+
+static long scanSse2(const uint8_t* buf, size_t end, int confirm, int& packetSize) {
+    const __m128i sync = _mm_set1_epi8(0x47);
+    size_t i = 0;
+    for (; i + 16 <= end; i += 16) {
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(buf + i)), sync));
+        if (!mask) {
+            continue;
+        }
+        unsigned int sizeMasks[3];
+        for (int s = 0; s < 3; s++) {
+            unsigned int m = mask;
+            for (int k = 1; k <= confirm && m; k++) {
+                const uint8_t* p = buf + i + (size_t)k * kPacketSizes[s];
+                m &= _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), sync));
+            }
+            sizeMasks[s] = m;
+        }
+        long pos = pickCandidate(sizeMasks, i, packetSize);
+        if (pos >= 0) {
+            return pos;
+        }
+    }
+    long pos = scanScalar(buf + i, end - i, confirm, packetSize);
+    return pos < 0 ? -1 : (long)(i + pos);
+}
+
+__attribute__((target("avx2")))
+static long scanAvx2(const uint8_t* buf, size_t end, int confirm, int& packetSize) {
+    const __m256i sync = _mm256_set1_epi8(0x47);
+    size_t i = 0;
+    for (; i + 32 <= end; i += 32) {
+        unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(buf + i)), sync));
+        if (!mask) {
+            continue;
+        }
+        unsigned int sizeMasks[3];
+        for (int s = 0; s < 3; s++) {
+            unsigned int m = mask;
+            for (int k = 1; k <= confirm && m; k++) {
+                const uint8_t* p = buf + i + (size_t)k * kPacketSizes[s];
+                m &= _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), sync));
+            }
+            sizeMasks[s] = m;
+        }
+        long pos = pickCandidate(sizeMasks, i, packetSize);
+        if (pos >= 0) {
+            return pos;
+        }
+    }
+    long pos = scanSse2(buf + i, end - i, confirm, packetSize);
+    return pos < 0 ? -1 : (long)(i + pos);
+}
+#endif
+
+static SyncScanFunc selectScanFunc(const char** name) {
+#ifdef TS_SYNC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return scanAvx2;
+    }
+    *name = "sse2";
+    return scanSse2;
+#else
+    *name = "scalar";
+    return scanScalar;
+#endif
+}
+
+static const char* gScanName = "scalar";
+static SyncScanFunc gScanFunc = selectScanFunc(&gScanName);
+
+TsSyncScanner::TsSyncScanner(int confirmCount)
+    : mConfirm(confirmCount < 1 ? 1 : confirmCount) {
+}
+
+const char* TsSyncScanner::implName() {
+    return gScanName;
+}
+
+long TsSyncScanner::scan(const uint8_t* buf, size_t len, bool atEof, size_t& scanned, int& packetSize) const {
+    size_t need = (size_t)mConfirm * TS_MAX_PACKET_SIZE;
+    size_t end = len > need ? len - need : 0;
+    long pos = gScanFunc(buf, end, mConfirm, packetSize);
+    if (pos >= 0) {
+        scanned = pos;
+        return pos;
+    }
+    scanned = end;
+    if (!atEof) {
+        return -1;
+    }
+    // Near the end fewer packets are left to confirm against
+    for (size_t i = end; i + TS_PACKET_SIZE <= len; i++) {
+        if (buf[i] != 0x47) {
+            continue;
+        }
+        for (int size : kPacketSizes) {
+            int confirm = (int)((len - 1 - i) / size);
+            if (confirm > mConfirm) {
+                confirm = mConfirm;
+            }
+            int k = 1;
+            while (k <= confirm && buf[i + (size_t)k * size] == 0x47) {
+                k++;
+            }
+            if (confirm >= 1 && k > confirm) {
+                scanned = i;
+                packetSize = size;
+                return i;
+            }
+        }
+    }
+    scanned = len;
+    return -1;
+}
@@ -0,0 +1,48 @@
+/**
+ * File: TsSync.h
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: TsSyncScanner class definition, sync byte search and packet size detection
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _TS_SYNC_H_
+#define _TS_SYNC_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#define TS_PACKET_SIZE      188
+#define M2TS_PACKET_SIZE    192 // 4-byte TP_extra_header + 188
+#define RS_TS_PACKET_SIZE   204 // 188 + 16 bytes Reed-Solomon parity
+#define TS_MAX_PACKET_SIZE  RS_TS_PACKET_SIZE
+
+class TsSyncScanner {
+    public:
+        // A position is accepted as sync when 'confirmCount' further sync bytes
+        // follow it at the same stride
+        TsSyncScanner(int confirmCount = 4);
+        // Find the first sync position in buf. Returns its offset and sets
+        // packetSize (188/192/204), or returns -1. 'scanned' is the number of
+        // leading bytes proven not to hold a sync position; the rest needs more
+        // lookahead. With atEof set, the tail is confirmed with whatever packets
+        // are left (at least one).
+        long scan(const uint8_t* buf, size_t len, bool atEof, size_t& scanned, int& packetSize) const;
+        // Bytes of lookahead needed to fully confirm one position
+        size_t lookahead() const { return (size_t)mConfirm * TS_MAX_PACKET_SIZE + 1; }
+        static const char* implName();
+    private:
+        int mConfirm;
+};
+
+#endif /* _TS_SYNC_H_ */
@@ -0,0 +1,108 @@
+/**
+ * File: TsTimestamps.cpp
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: Implementation of TsTimestampWriter
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#include "TsTimestamps.h"
+#include <charconv>
+#include <cstring>
+
+int TsTimestampWriter::parseFormat(const string& name) {
+    if (name == "text") {
+        return TS_FORMAT_TEXT;
+    }
+    if (name == "csv") {
+        return TS_FORMAT_CSV;
+    }
+    if (name == "binary") {
+        return TS_FORMAT_BINARY;
+    }
+    return -1;
+}
+
+static inline char* put(char* p, const char* text) {
+    size_t len = strlen(text);
+    memcpy(p, text, len);
+    return p + len;
+}
+
+// The buffer always has TS_TIMESTAMP_MAX_LINE bytes left, 'end' is never hit
+static inline char* putNumber(char* p, char* end, uint64_t value, int base = 10) {
+    return std::to_chars(p, end, value, base).ptr;
+}
+
+void TsTimestampWriter::begin(std::ostream& out) {
+    if (mFormat != TS_FORMAT_CSV) {
+        return;
+    }
+    if (mLength + TS_TIMESTAMP_MAX_LINE > mBuffer.size()) {
+        flush(out);
+    }
+    mLength = put(mBuffer.data() + mLength, "pid,offset,pts,dts,pcr\n") - mBuffer.data();
+}
+
+void TsTimestampWriter::add(std::ostream& out, const TsTimestampRecord& record) {
+    if (mLength + TS_TIMESTAMP_MAX_LINE > mBuffer.size()) {
+        flush(out);
+    }
+    char* p = mBuffer.data() + mLength;
+    char* end = mBuffer.data() + mBuffer.size();
+    switch (mFormat) {
+        case TS_FORMAT_BINARY:
+            memcpy(p, &record, sizeof(record));
+            p += sizeof(record);
+            break;
+        case TS_FORMAT_CSV:
+            p = putNumber(p, end, record.pid);
+            *p++ = ',';
+            p = putNumber(p, end, record.offset);
+            *p++ = ',';
+            p = putNumber(p, end, record.pts);
+            *p++ = ',';
+            if (record.flags & TS_RECORD_DTS) {
+                p = putNumber(p, end, record.dts);
+            }
+            *p++ = ',';
+            if (record.flags & TS_RECORD_PCR) {
+                p = putNumber(p, end, record.pcr);
+            }
+            *p++ = '\n';
+            break;
+        default:
+            p = put(p, "PID: ");
+            p = putNumber(p, end, record.pid);
+            p = put(p, ", PTS: 0x");
+            p = putNumber(p, end, record.pts, 16);
+            if (record.flags & TS_RECORD_DTS) {
+                p = put(p, ", DTS: 0x");
+                p = putNumber(p, end, record.dts, 16);
+            } else {
+                p = put(p, " (");
+                p = putNumber(p, end, record.pts);
+                *p++ = ')';
+            }
+            *p++ = '\n';
+            break;
+    }
+    mLength = p - mBuffer.data();
+}
+
+void TsTimestampWriter::flush(std::ostream& out) {
+    if (mLength > 0) {
+        out.write(mBuffer.data(), mLength);
+        mLength = 0;
+    }
+}
@@ -0,0 +1,82 @@
+/**
+ * File: TsTimestamps.h
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: TsTimestampWriter class definition, buffered -p output
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _TS_TIMESTAMPS_H_
+#define _TS_TIMESTAMPS_H_
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Formatted timestamps collected before they are written out in one block
+#ifndef TS_TIMESTAMP_BUFFER_SIZE
+#define TS_TIMESTAMP_BUFFER_SIZE (256 << 10)
+#endif
+
+#define TS_TIMESTAMP_MAX_LINE 128
+
+typedef enum timestamp_format {
+    TS_FORMAT_TEXT = 0, // PID: 257, PTS: 0x1b6c5e (1797214)
+    TS_FORMAT_CSV,      // pid,offset,pts,dts,pcr
+    TS_FORMAT_BINARY,   // TsTimestampRecord
+} TimestampFormat;
+
+#define TS_RECORD_DTS 0x01
+#define TS_RECORD_PCR 0x02
+
+// --pts-format binary: one record per PES header with a PTS, in the host's
+// byte order (little-endian on every target this builds for), no file header
+struct TsTimestampRecord {
+    uint64_t offset; // input offset of the packet starting the PES
+    uint64_t pts;    // 90 kHz, 33 bits
+    uint64_t dts;    // with TS_RECORD_DTS
+    uint64_t pcr;    // 27 MHz, last PCR of the program before the PES; with TS_RECORD_PCR
+    uint16_t pid;
+    uint16_t flags;
+    uint32_t reserved;
+};
+static_assert(sizeof(TsTimestampRecord) == 40, "TsTimestampRecord is a file format");
+
+/*
+ * -p output. Lines are formatted with std::to_chars into one buffer that is
+ * written when it fills or when the caller flushes, instead of an ostream
+ * insertion and a flush per line. The stream is passed on every call: the
+ * parser swaps its output for -j chunks and flushes before each swap.
+ */
+class TsTimestampWriter {
+    public:
+        TsTimestampWriter() : mBuffer(TS_TIMESTAMP_BUFFER_SIZE) {}
+        // "text", "csv" or "binary"; -1: unknown
+        static int parseFormat(const string& name);
+        void setFormat(int format) { mFormat = format; }
+        int format() const { return mFormat; }
+        // The CSV column names, nothing for the other formats
+        void begin(std::ostream& out);
+        void add(std::ostream& out, const TsTimestampRecord& record);
+        void flush(std::ostream& out);
+        // Bytes formatted but not written yet
+        size_t pending() const { return mLength; }
+    private:
+        vector<char> mBuffer;
+        size_t mLength = 0;
+        int mFormat = TS_FORMAT_TEXT;
+};
+
+#endif /* _TS_TIMESTAMPS_H_ */
@@ -0,0 +1,150 @@
+/**
+ * File: WorkStealingPool.h
+ * Author: qiuye.gan
+ * Date: 2025-12-01
+ * Description: WorkStealingPool, thread pool with one task deque per thread
+ * Copyright (C) 2024 Qiuye.gan(ganqiuye@163.com) All Rights Reserved.
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef _WORK_STEALING_POOL_H_
+#define _WORK_STEALING_POOL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+/*
+ * Every worker takes tasks from the front of its own deque; one that runs
+ * dry steals from the back of the others, so a few slow tasks do not leave
+ * threads idle while work is queued elsewhere. Tasks submitted from outside
+ * are dealt round-robin, tasks submitted by a task go to its own worker.
+ */
+class WorkStealingPool {
+    public:
+        explicit WorkStealingPool(int threads) {
+            threads = std::max(1, threads);
+            for (int i = 0; i < threads; i++) {
+                mQueues.emplace_back(new Queue());
+            }
+            for (int i = 0; i < threads; i++) {
+                mThreads.emplace_back([this, i]() { run(i); });
+            }
+        }
+        ~WorkStealingPool() {
+            wait();
+            {
+                std::lock_guard<std::mutex> guard(mIdleLock);
+                mStop = true;
+            }
+            mIdle.notify_all();
+            for (auto& thread : mThreads) {
+                thread.join();
+            }
+        }
+        void submit(std::function<void()> task) {
+            int self = workerIndex();
+            size_t target = self >= 0 ? self : mNext++ % mQueues.size();
+            {
+                // Counted before it can be taken, so wait() never sees zero early
+                std::lock_guard<std::mutex> guard(mIdleLock);
+                mOutstanding++;
+                mQueued++;
+            }
+            {
+                std::lock_guard<std::mutex> guard(mQueues[target]->lock);
+                mQueues[target]->tasks.push_back(std::move(task));
+            }
+            mIdle.notify_one();
+        }
+        // Until every submitted task (and what they submitted) has run
+        void wait() {
+            std::unique_lock<std::mutex> guard(mIdleLock);
+            mDone.wait(guard, [this]() { return mOutstanding == 0; });
+        }
+        int threads() const { return mThreads.size(); }
+        uint64_t steals() const { return mSteals; }
+    private:
+        struct Queue {
+            std::mutex lock;
+            std::deque<std::function<void()>> tasks;
+        };
+        static int& workerIndex() {
+            static thread_local int index = -1;
+            return index;
+        }
+        bool take(int self, std::function<void()>& task) {
+            const int count = mQueues.size();
+            for (int i = 0; i < count; i++) {
+                Queue& queue = *mQueues[(self + i) % count];
+                std::lock_guard<std::mutex> guard(queue.lock);
+                if (queue.tasks.empty()) {
+                    continue;
+                }
+                if (i == 0) {
+                    task = std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
+                } else {
+                    task = std::move(queue.tasks.back());
+                    queue.tasks.pop_back();
+                    mSteals++;
+                }
+                return true;
+            }
+            return false;
+        }
+        void run(int self) {
+            workerIndex() = self;
+            for (;;) {
+                {
+                    std::unique_lock<std::mutex> guard(mIdleLock);
+                    mIdle.wait(guard, [this]() { return mStop || mQueued > 0; });
+                    if (mStop) {
+                        return;
+                    }
+                }
+                std::function<void()> task;
+                if (!take(self, task)) {
+                    // Another worker got there first
+                    continue;
+                }
+                {
+                    std::lock_guard<std::mutex> guard(mIdleLock);
+                    mQueued--;
+                }
+                task();
+                std::lock_guard<std::mutex> guard(mIdleLock);
+                if (--mOutstanding == 0) {
+                    mDone.notify_all();
+                }
+            }
+        }
+        vector<unique_ptr<Queue>> mQueues;
+        vector<std::thread> mThreads;
+        std::mutex mIdleLock;
+        std::condition_variable mIdle;  // tasks were queued, or stop
+        std::condition_variable mDone;  // nothing outstanding
+        size_t mQueued = 0;             // in the deques, under mIdleLock
+        size_t mOutstanding = 0;        // queued or running, under mIdleLock
+        std::atomic<size_t> mNext{0};
+        std::atomic<uint64_t> mSteals{0};
+        bool mStop = false;
+};
+
+#endif /* _WORK_STEALING_POOL_H_ */
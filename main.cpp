@@ -1,17 +1,99 @@
 #include "TsParser.h"
+#include "TsBatch.h"
 #include <getopt.h>
+#include <signal.h>
 #define VERSION "1.2.0"
+
+// Long-only options (no short form)
+enum {
+    LONG_OPT_NO_MMAP = 256,
+    LONG_OPT_ES_BUFFER,
+    LONG_OPT_ES_PREALLOC,
+    LONG_OPT_ES_DIRECT,
+    LONG_OPT_ES_STATS,
+    LONG_OPT_RCVBUF,
+    LONG_OPT_IDLE_TIMEOUT,
+    LONG_OPT_DROP_CORRUPT,
+    LONG_OPT_PIPELINE,
+    LONG_OPT_PIN,
+    LONG_OPT_INDEX,
+    LONG_OPT_NO_INDEX,
+    LONG_OPT_FROM,
+    LONG_OPT_TO,
+    LONG_OPT_PROBE,
+    LONG_OPT_PROBE_BYTES,
+    LONG_OPT_PROBE_MS,
+    LONG_OPT_METRICS,
+    LONG_OPT_METRICS_INTERVAL,
+    LONG_OPT_BATCH,
+    LONG_OPT_BATCH_REPORT,
+    LONG_OPT_BATCH_MAX_FILES,
+    LONG_OPT_BATCH_MAX_MEM,
+    LONG_OPT_PCR,
+    LONG_OPT_PCR_TIMELINE,
+    LONG_OPT_PCR_WINDOW,
+    LONG_OPT_KEEP,
+    LONG_OPT_PTS_FORMAT,
+    LONG_OPT_AU_TABLE,
+    LONG_OPT_URING,
+    LONG_OPT_URING_DIRECT,
+    LONG_OPT_CHECKPOINT,
+    LONG_OPT_CHECKPOINT_INTERVAL,
+    LONG_OPT_TR101290,
+    LONG_OPT_FORCE,
+};
+
+void StopHandler(int) {
+    TsInput::requestStop();
+}
+
 void Usage (char* argv[]) {
     std::cout << "Copyright: qiuye.gan(qiuye.gan@amlogic.com)" << std::endl;
     std::cout << "Version: " << VERSION << "\n" << std::endl;
     std::cout << "Usage: " << argv[0] << " <infile> [OPTIONS...]" << std::endl;
     std::cout << "OPTIONS:" << std::endl;
-    std::cout << "  -i, --infile <FILE>     Input TS file path" << std::endl;
+    std::cout << "  -i, --infile <FILE>     Input TS file, '-' for stdin, or udp://[@]addr:port, rtp://..." << std::endl;
     std::cout << "  -s, --showinfo          Show stream information" << std::endl;
     std::cout << "  -o, --output_pid [PID]  Output PID to out_pid.es (no PID => dump all PIDs)" << std::endl;
-    // std::cout << "  -r | --remove         : Remove all PIDs except video, audio and text" << std::endl;
+    std::cout << "  -r, --remove <FILE>     Write the TS with only video, audio and text PIDs to FILE ('-': stdout)" << std::endl;
     // std::cout << "  -m | --merge          : Merge all PIDs into one file" << std::endl;
     std::cout << "  -p, --print [PID]       Print pts (no PID => print all PIDs)" << std::endl;
+    std::cout << "      --pts-format <F>    -p output: text (default), csv or binary" << std::endl;
+    std::cout << "  -j, --jobs <N>          Parse with N worker threads (-o/-p on regular files)" << std::endl;
+    std::cout << "      --keep <PID>        -r keeps PID instead of video/audio/text (repeatable)" << std::endl;
+    std::cout << "      --no-mmap           Read the input with stdio instead of mmap" << std::endl;
+    std::cout << "      --io-uring <DEPTH>  Read the input file with io_uring, DEPTH 1 MB reads in flight" << std::endl;
+    std::cout << "      --io-direct         --io-uring reads with O_DIRECT" << std::endl;
+    std::cout << "      --es-buffer <MB>    Output buffer per ES file (default 4)" << std::endl;
+    std::cout << "      --es-prealloc <MB>  Preallocate each ES file with fallocate" << std::endl;
+    std::cout << "      --es-direct         Write ES files with O_DIRECT" << std::endl;
+    std::cout << "      --es-stats          Print ES write statistics" << std::endl;
+    std::cout << "      --rcvbuf <KB>       Socket receive buffer for udp/rtp input" << std::endl;
+    std::cout << "      --idle-timeout <MS> Stop a live input after MS without data" << std::endl;
+    std::cout << "      --drop-corrupt      Drop PES packets hit by continuity errors, and TEI or scrambled TS packets" << std::endl;
+    std::cout << "      --pipeline          Read, parse and write ES on three threads" << std::endl;
+    std::cout << "      --pin <R,P,W>       Pin the pipeline threads to CPUs (-1: not pinned)" << std::endl;
+    std::cout << "      --index             Build the <infile>.tsidx index while parsing" << std::endl;
+    std::cout << "      --no-index          Do not use an existing index" << std::endl;
+    std::cout << "      --from <SEC>        Start -p/-o at SEC seconds (needs an index)" << std::endl;
+    std::cout << "      --to <SEC>          Stop -p/-o at SEC seconds (needs an index)" << std::endl;
+    std::cout << "      --probe             -s reading only parts of the file, within a budget" << std::endl;
+    std::cout << "      --probe-bytes <KB>  Probe read budget (default 2048)" << std::endl;
+    std::cout << "      --probe-ms <MS>     Probe time budget (default 100)" << std::endl;
+    std::cout << "      --metrics <FILE>    Write per-PID and stage metrics (FILE.prom: Prometheus, else JSON)" << std::endl;
+    std::cout << "      --metrics-interval <SEC> Also rewrite the metrics file every SEC seconds" << std::endl;
+    std::cout << "      --pcr               Report PCR interval, accuracy, duration and bitrates" << std::endl;
+    std::cout << "      --pcr-timeline <FILE> Also write the downsampled PCR timeline as CSV" << std::endl;
+    std::cout << "      --pcr-window <MS>   Bitrate window of --pcr (default 1000)" << std::endl;
+    std::cout << "      --au-table <FILE>   Write the access units of H.264/H.265/VVC PIDs as CSV (offset, size, keyframe, PTS)" << std::endl;
+    std::cout << "      --tr101290 <FILE>   Check ETSI TR 101 290 priority 1 and 2, list the errors in FILE as CSV" << std::endl;
+    std::cout << "      --checkpoint <FILE> Save the scan state to FILE, resume from it if it is there (-o/-p)" << std::endl;
+    std::cout << "      --checkpoint-interval <SEC> Seconds between checkpoints (default " << TS_CHECKPOINT_INTERVAL << ")" << std::endl;
+    std::cout << "      --force             Start over a checkpoint of another input or other options" << std::endl;
+    std::cout << "      --batch <DIR|LIST>  -s on every TS file of DIR, or listed in LIST ('-': stdin), one JSON line each" << std::endl;
+    std::cout << "      --batch-report <FILE> Write the batch records to FILE instead of stdout" << std::endl;
+    std::cout << "      --batch-max-files <N> Open files allowed to the batch (default half the fd limit)" << std::endl;
+    std::cout << "      --batch-max-mem <MB>  Memory allowed to the files parsed at once (default 1024)" << std::endl;
     std::cout << "  -h, --help              Show this help message" << std::endl;
     std::cout << "  -v, --version           Show version information" << std::endl;
     std::cout << "\nExample: " << argv[0] << " -i input.ts -p" << std::endl;
@@ -36,22 +118,60 @@ int main(int argc, char *argv[]) {
 
     int optionChar = 0;
     int optionIndex = 0;
-    const char *shortOptions = "hi:so::p::v";
+    const char *shortOptions = "hi:so::r:p::j:v";
     const struct option longOptions[] = {
         {"help",          no_argument,       0, 'h'},
         {"infile",        required_argument, 0, 'i'},
         {"showinfo",      no_argument,       0, 's'},
         {"output_pid",    optional_argument, 0, 'o'},
-        // {"remove",        no_argument,       0, 'r'},
+        {"remove",        required_argument, 0, 'r'},
         // {"merge",         no_argument,       0, 'm'},
         {"print",         optional_argument, 0, 'p'},
+        {"jobs",          required_argument, 0, 'j'},
         {"version",       no_argument,       0, 'v'},
+        {"no-mmap",       no_argument,       0, LONG_OPT_NO_MMAP},
+        {"io-uring",      required_argument, 0, LONG_OPT_URING},
+        {"io-direct",     no_argument,       0, LONG_OPT_URING_DIRECT},
+        {"es-buffer",     required_argument, 0, LONG_OPT_ES_BUFFER},
+        {"es-prealloc",   required_argument, 0, LONG_OPT_ES_PREALLOC},
+        {"es-direct",     no_argument,       0, LONG_OPT_ES_DIRECT},
+        {"es-stats",      no_argument,       0, LONG_OPT_ES_STATS},
+        {"rcvbuf",        required_argument, 0, LONG_OPT_RCVBUF},
+        {"idle-timeout",  required_argument, 0, LONG_OPT_IDLE_TIMEOUT},
+        {"drop-corrupt",  no_argument,       0, LONG_OPT_DROP_CORRUPT},
+        {"pipeline",      no_argument,       0, LONG_OPT_PIPELINE},
+        {"pin",           required_argument, 0, LONG_OPT_PIN},
+        {"index",         no_argument,       0, LONG_OPT_INDEX},
+        {"no-index",      no_argument,       0, LONG_OPT_NO_INDEX},
+        {"from",          required_argument, 0, LONG_OPT_FROM},
+        {"to",            required_argument, 0, LONG_OPT_TO},
+        {"probe",         no_argument,       0, LONG_OPT_PROBE},
+        {"probe-bytes",   required_argument, 0, LONG_OPT_PROBE_BYTES},
+        {"probe-ms",      required_argument, 0, LONG_OPT_PROBE_MS},
+        {"metrics",       required_argument, 0, LONG_OPT_METRICS},
+        {"metrics-interval", required_argument, 0, LONG_OPT_METRICS_INTERVAL},
+        {"keep",          required_argument, 0, LONG_OPT_KEEP},
+        {"pts-format",    required_argument, 0, LONG_OPT_PTS_FORMAT},
+        {"pcr",           no_argument,       0, LONG_OPT_PCR},
+        {"pcr-timeline",  required_argument, 0, LONG_OPT_PCR_TIMELINE},
+        {"pcr-window",    required_argument, 0, LONG_OPT_PCR_WINDOW},
+        {"au-table",      required_argument, 0, LONG_OPT_AU_TABLE},
+        {"tr101290",      required_argument, 0, LONG_OPT_TR101290},
+        {"checkpoint",    required_argument, 0, LONG_OPT_CHECKPOINT},
+        {"checkpoint-interval", required_argument, 0, LONG_OPT_CHECKPOINT_INTERVAL},
+        {"force",         no_argument,       0, LONG_OPT_FORCE},
+        {"batch",         required_argument, 0, LONG_OPT_BATCH},
+        {"batch-report",  required_argument, 0, LONG_OPT_BATCH_REPORT},
+        {"batch-max-files", required_argument, 0, LONG_OPT_BATCH_MAX_FILES},
+        {"batch-max-mem", required_argument, 0, LONG_OPT_BATCH_MAX_MEM},
         {0, 0, 0, 0}
     };
     TsParser parser;
     int pid = 0;
     bool showInfoFlag = false;
     bool hasInputFile = false;
+    TsBatchConfig batchConfig; // the options a batch applies to every file
+    string batchSource;
     if (argc == 2 && argv[1][0] != '-') {
         parser.setCommand(OPTION_SET_INPUT_FILE, (void*)argv[1]);
         showInfoFlag = true;
@@ -93,8 +213,7 @@ int main(int argc, char *argv[]) {
                     parser.setCommand(OPTION_OUTPUT_PID, (void*)&pid);
                     break;
                 case 'r':
-                    // Implement remove all PIDs except video, audio and text functionality
-                    // TODO
+                    parser.setCommand(OPTION_REMOVE_OTHER_PIDS, (void*)optarg);
                     break;
                 case 'm':
                     // Implement merge all PIDs into one file functionality
@@ -123,6 +242,199 @@ int main(int argc, char *argv[]) {
                     parser.setCommand(OPTION_PRINT_PTS, (void*)&pid);
                     break;
                 }
+                case 'j':
+                {
+                    int jobs = atoi(optarg);
+                    if (jobs < 1) {
+                        std::cerr << "Invalid jobs: " << optarg << std::endl;
+                        return -1;
+                    }
+                    parser.setCommand(OPTION_THREADS, (void*)&jobs);
+                    batchConfig.threads = jobs;
+                    break;
+                }
+                case LONG_OPT_NO_MMAP:
+                    parser.setCommand(OPTION_DISABLE_MMAP, nullptr);
+                    batchConfig.allowMmap = false;
+                    break;
+                case LONG_OPT_URING:
+                {
+                    int depth = atoi(optarg);
+                    if (depth < 1 || depth > TS_URING_MAX_DEPTH) {
+                        std::cerr << "--io-uring depth must be 1.." << TS_URING_MAX_DEPTH << std::endl;
+                        return -1;
+                    }
+                    parser.setCommand(OPTION_URING_DEPTH, (void*)&depth);
+                    break;
+                }
+                case LONG_OPT_URING_DIRECT:
+                    parser.setCommand(OPTION_DIRECT_INPUT, nullptr);
+                    break;
+                case LONG_OPT_ES_BUFFER:
+                {
+                    int mb = atoi(optarg);
+                    if (mb < 1) {
+                        std::cerr << "Invalid buffer size: " << optarg << std::endl;
+                        return -1;
+                    }
+                    size_t bytes = (size_t)mb << 20;
+                    parser.setCommand(OPTION_ES_BUFFER_SIZE, (void*)&bytes);
+                    break;
+                }
+                case LONG_OPT_ES_PREALLOC:
+                {
+                    uint64_t bytes = (uint64_t)strtoull(optarg, nullptr, 10) << 20;
+                    parser.setCommand(OPTION_ES_PREALLOCATE, (void*)&bytes);
+                    break;
+                }
+                case LONG_OPT_ES_DIRECT:
+                    parser.setCommand(OPTION_ES_DIRECT_IO, nullptr);
+                    break;
+                case LONG_OPT_ES_STATS:
+                    parser.setCommand(OPTION_ES_STATS, nullptr);
+                    break;
+                case LONG_OPT_RCVBUF:
+                {
+                    int bytes = atoi(optarg) * 1024;
+                    parser.setCommand(OPTION_RCVBUF, (void*)&bytes);
+                    break;
+                }
+                case LONG_OPT_IDLE_TIMEOUT:
+                {
+                    int ms = atoi(optarg);
+                    parser.setCommand(OPTION_IDLE_TIMEOUT, (void*)&ms);
+                    break;
+                }
+                case LONG_OPT_DROP_CORRUPT:
+                    parser.setCommand(OPTION_DROP_CORRUPT_PES);
+                    break;
+                case LONG_OPT_PIPELINE:
+                    parser.setCommand(OPTION_PIPELINE);
+                    break;
+                case LONG_OPT_PIN:
+                {
+                    int cpus[3] = {-1, -1, -1};
+                    if (sscanf(optarg, "%d,%d,%d", &cpus[0], &cpus[1], &cpus[2]) != 3) {
+                        std::cerr << "--pin expects three CPU numbers, e.g. 0,2,4" << std::endl;
+                        return -1;
+                    }
+                    parser.setCommand(OPTION_PIN_CPUS, (void*)cpus);
+                    parser.setCommand(OPTION_PIPELINE);
+                    break;
+                }
+                case LONG_OPT_INDEX:
+                    parser.setCommand(OPTION_BUILD_INDEX);
+                    break;
+                case LONG_OPT_NO_INDEX:
+                    parser.setCommand(OPTION_NO_INDEX);
+                    batchConfig.useIndex = false;
+                    break;
+                case LONG_OPT_FROM:
+                case LONG_OPT_TO:
+                {
+                    double seconds = atof(optarg);
+                    parser.setCommand(optionChar == LONG_OPT_FROM ? OPTION_TIME_FROM : OPTION_TIME_TO, (void*)&seconds);
+                    break;
+                }
+                case LONG_OPT_PROBE:
+                    showInfoFlag = true;
+                    parser.setCommand(OPTION_PROBE);
+                    batchConfig.probe = true;
+                    break;
+                case LONG_OPT_PROBE_BYTES:
+                {
+                    uint64_t bytes = strtoull(optarg, nullptr, 10) << 10;
+                    parser.setCommand(OPTION_PROBE_BYTES, (void*)&bytes);
+                    batchConfig.probeBytes = bytes;
+                    break;
+                }
+                case LONG_OPT_PROBE_MS:
+                {
+                    int ms = atoi(optarg);
+                    parser.setCommand(OPTION_PROBE_MS, (void*)&ms);
+                    batchConfig.probeMs = ms;
+                    break;
+                }
+                case LONG_OPT_METRICS:
+                    parser.setCommand(OPTION_METRICS_FILE, (void*)optarg);
+                    break;
+                case LONG_OPT_METRICS_INTERVAL:
+                {
+                    int ms = (int)(atof(optarg) * 1000);
+                    parser.setCommand(OPTION_METRICS_INTERVAL, (void*)&ms);
+                    break;
+                }
+                case LONG_OPT_KEEP:
+                    pid = GetPid(optarg);
+                    if (pid < 0) {
+                        std::cerr << "Invalid PID: " << optarg << std::endl;
+                        return -1;
+                    }
+                    parser.setCommand(OPTION_REMUX_KEEP, (void*)&pid);
+                    break;
+                case LONG_OPT_PTS_FORMAT:
+                {
+                    int format = TsTimestampWriter::parseFormat(optarg);
+                    if (format < 0) {
+                        std::cerr << "Invalid PTS format: " << optarg << std::endl;
+                        return -1;
+                    }
+                    parser.setCommand(OPTION_PTS_FORMAT, (void*)&format);
+                    break;
+                }
+                case LONG_OPT_PCR:
+                    parser.setCommand(OPTION_PCR_REPORT);
+                    break;
+                case LONG_OPT_PCR_TIMELINE:
+                    parser.setCommand(OPTION_PCR_TIMELINE, (void*)optarg);
+                    break;
+                case LONG_OPT_AU_TABLE:
+                    parser.setCommand(OPTION_AU_TABLE, (void*)optarg);
+                    break;
+                case LONG_OPT_PCR_WINDOW:
+                {
+                    int ms = atoi(optarg);
+                    parser.setCommand(OPTION_PCR_WINDOW, (void*)&ms);
+                    break;
+                }
+                case LONG_OPT_TR101290:
+                    parser.setCommand(OPTION_TR101290, (void*)optarg);
+                    break;
+                case LONG_OPT_CHECKPOINT:
+                    parser.setCommand(OPTION_CHECKPOINT, (void*)optarg);
+                    break;
+                case LONG_OPT_CHECKPOINT_INTERVAL:
+                {
+                    int seconds = atoi(optarg);
+                    if (seconds < 1) {
+                        std::cerr << "Invalid checkpoint interval: " << optarg << std::endl;
+                        return -1;
+                    }
+                    parser.setCommand(OPTION_CHECKPOINT_INTERVAL, (void*)&seconds);
+                    break;
+                }
+                case LONG_OPT_FORCE:
+                    parser.setCommand(OPTION_CHECKPOINT_FORCE, nullptr);
+                    break;
+                case LONG_OPT_BATCH:
+                    batchSource = optarg;
+                    break;
+                case LONG_OPT_BATCH_REPORT:
+                    batchConfig.reportPath = optarg;
+                    break;
+                case LONG_OPT_BATCH_MAX_FILES:
+                    batchConfig.maxOpenFiles = atoi(optarg);
+                    break;
+                case LONG_OPT_BATCH_MAX_MEM:
+                {
+                    int mb = atoi(optarg);
+                    if (mb < 1) {
+                        std::cerr << "Invalid memory limit: " << optarg << std::endl;
+                        return -1;
+                    }
+                    batchConfig.maxMemory = (uint64_t)mb << 20;
+                    break;
+                }
                 case 'v':
                 case ':':
                 case '?':
@@ -132,11 +444,24 @@ int main(int argc, char *argv[]) {
             }
         }
     }
+    if (!batchSource.empty()) {
+        TsBatch batch(batchConfig);
+        return batch.run(batchSource);
+    }
     if (!hasInputFile) {
         Usage(argv);
         return -1;
     }
-    parser.parse();
+    // Ctrl-C ends any parse cleanly so the summary still gets printed, a
+    // checkpointed scan after saving its state
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = StopHandler;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    if (parser.parse() < 0) {
+        return -1;
+    }
     if (showInfoFlag) {
         parser.showStreamInfo();
     }